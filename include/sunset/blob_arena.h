@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunset/vector.h"
+
+/// every blob starts at a multiple of this within the arena
+#define BLOB_ALIGNMENT 16
+
+#define BLOB_REF_NONE 0
+#define BLOB_OWNER_NONE UINT32_MAX
+#define BLOB_OFFSET_FREE UINT64_MAX
+
+/// handle to a blob, stays valid when the arena grows or is compacted.
+/// `BLOB_REF_NONE` is never handed out, so zeroed handles mean no blob.
+typedef uint32_t BlobRef;
+
+typedef struct BlobSlot {
+    /// `BLOB_OFFSET_FREE` for free slots
+    uint64_t offset;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t owner;
+    /// next blob of the same owner, or next free slot
+    BlobRef next;
+} BlobSlot;
+
+/// variable length data packed into a single buffer, so that it is copied
+/// with one `memcpy` instead of chasing a heap allocation per blob. blobs
+/// may have an owner, typically an entity slot, whose blobs are all freed
+/// at once.
+typedef struct BlobArena {
+    vector(uint8_t) data;
+    /// indexed by `BlobRef`, the first slot is never used
+    vector(BlobSlot) slots;
+    /// first blob of every owner
+    vector(BlobRef) owner_heads;
+    BlobRef free_slots;
+    /// bytes of `data` left behind by freed or moved blobs, reclaimed by
+    /// `blob_arena_compact`
+    size_t garbage_size;
+} BlobArena;
+
+void blob_arena_init(BlobArena *arena);
+void blob_arena_destroy(BlobArena *arena);
+
+/// adds a zeroed blob, `owner` may be `BLOB_OWNER_NONE`
+BlobRef blob_arena_alloc(BlobArena *arena, size_t size, uint32_t owner);
+void blob_arena_free(BlobArena *arena, BlobRef blob);
+/// frees every blob of `owner`
+void blob_arena_free_owner(BlobArena *arena, uint32_t owner);
+
+/// the pointer is only valid until the next allocation, resize or
+/// compaction. NULL for `BLOB_REF_NONE`.
+void *blob_arena_get(BlobArena const *arena, BlobRef blob);
+/// 0 for `BLOB_REF_NONE`
+size_t blob_arena_size(BlobArena const *arena, BlobRef blob);
+/// keeps the contents up to the smaller size, added bytes are zeroed
+void blob_arena_resize(BlobArena *arena, BlobRef blob, size_t size);
+
+/// moves every blob down over the garbage and releases the rest
+void blob_arena_compact(BlobArena *arena);
+/// rebuilds the owner lists, the free list and `garbage_size` after the
+/// data and slots were copied in, only the slots' offsets, sizes,
+/// capacities and owners are used
+void blob_arena_relink(BlobArena *arena);
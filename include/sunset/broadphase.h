@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunset/geometry.h"
+#include "sunset/vector.h"
+
+#define BROADPHASE_PROXY_NONE UINT32_MAX
+
+/// candidate pair of overlapping boxes, `a < b`
+typedef struct BroadphasePair {
+    uint32_t a;
+    uint32_t b;
+} BroadphasePair;
+
+/// one end of a proxy's extent along the sweep axis
+typedef struct SapEndpoint {
+    float value;
+    /// the proxy shifted left by one, the lowest bit is set for max ends
+    uint32_t data;
+} SapEndpoint;
+
+/// sweep and prune over the axis along which the boxes are spread the
+/// most. endpoints stay sorted between steps, so with coherent motion
+/// re-sorting them by insertion is close to linear.
+typedef struct Broadphase {
+    /// indexed by proxy
+    vector(AABB) boxes;
+    vector(bool) live;
+    vector(uint32_t) free_proxies;
+
+    size_t axis;
+    vector(SapEndpoint) endpoints;
+
+    /// proxies overlapping the sweep position, with each one's index in
+    /// `active`
+    vector(uint32_t) active;
+    vector(uint32_t) active_index;
+
+    /// filled by `broadphase_find_pairs`
+    vector(BroadphasePair) pairs;
+} Broadphase;
+
+void broadphase_init(Broadphase *broadphase);
+void broadphase_destroy(Broadphase *broadphase);
+
+/// ids of removed proxies are handed out again
+uint32_t broadphase_add(Broadphase *broadphase, AABB const *box);
+void broadphase_remove(Broadphase *broadphase, uint32_t proxy);
+void broadphase_update(
+        Broadphase *broadphase, uint32_t proxy, AABB const *box);
+
+/// re-sorts the endpoints and replaces `pairs` with every pair of boxes
+/// that overlap or touch
+void broadphase_find_pairs(Broadphase *broadphase);
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#include "sunset/crc64.h"
+
+/// highest number of registered components, a multiple of 64. raised with
+/// the `ecs_max_components` meson option
+#ifndef ECS_MAX_COMPONENTS
+#define ECS_MAX_COMPONENTS 64
+#endif
+
+static_assert(ECS_MAX_COMPONENTS > 0 && ECS_MAX_COMPONENTS % 64 == 0,
+        "ECS_MAX_COMPONENTS has to be a multiple of 64");
+
+#define COMPONENT_MASK_WORDS (ECS_MAX_COMPONENTS / 64)
+
+// set tests use the widest vectors that evenly cover the mask, a single
+// word is faster as plain integer ops. loads are unaligned since masks
+// live in vectors, which only guarantee 16 byte alignment.
+#if defined(__AVX__) && COMPONENT_MASK_WORDS % 4 == 0
+#define COMPONENT_MASK_AVX
+#elif defined(__SSE4_1__) && COMPONENT_MASK_WORDS % 2 == 0
+#define COMPONENT_MASK_SSE
+#endif
+
+/// set of component ids. unlike `Bitmask` it's a plain value that never
+/// allocates, so it can be copied, compared and dropped freely.
+typedef struct ComponentMask {
+    uint64_t words[COMPONENT_MASK_WORDS];
+} ComponentMask;
+
+static inline ComponentMask cmask_empty(void) {
+    return (ComponentMask){0};
+}
+
+static inline void cmask_set(ComponentMask *mask, size_t id) {
+    mask->words[id / 64] |= UINT64_C(1) << (id % 64);
+}
+
+static inline void cmask_unset(ComponentMask *mask, size_t id) {
+    mask->words[id / 64] &= ~(UINT64_C(1) << (id % 64));
+}
+
+static inline bool cmask_is_set(ComponentMask const *mask, size_t id) {
+    return mask->words[id / 64] & (UINT64_C(1) << (id % 64));
+}
+
+/// whether `mask` has every id of `other`
+static inline bool cmask_is_superset(
+        ComponentMask const *mask, ComponentMask const *other) {
+#if defined(COMPONENT_MASK_AVX)
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i const *)&mask->words[i]);
+        __m256i b = _mm256_loadu_si256((__m256i const *)&other->words[i]);
+
+        // set when `b & ~a` is all zeroes
+        if (!_mm256_testc_si256(a, b)) {
+            return false;
+        }
+    }
+#elif defined(COMPONENT_MASK_SSE)
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i const *)&mask->words[i]);
+        __m128i b = _mm_loadu_si128((__m128i const *)&other->words[i]);
+
+        if (!_mm_testc_si128(a, b)) {
+            return false;
+        }
+    }
+#else
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i++) {
+        if (other->words[i] & ~mask->words[i]) {
+            return false;
+        }
+    }
+#endif
+
+    return true;
+}
+
+static inline bool cmask_is_eql(
+        ComponentMask const *mask, ComponentMask const *other) {
+#if defined(COMPONENT_MASK_AVX)
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i += 4) {
+        __m256 a = _mm256_loadu_ps((float const *)&mask->words[i]);
+        __m256 b = _mm256_loadu_ps((float const *)&other->words[i]);
+        __m256i diff = _mm256_castps_si256(_mm256_xor_ps(a, b));
+
+        if (!_mm256_testz_si256(diff, diff)) {
+            return false;
+        }
+    }
+#elif defined(COMPONENT_MASK_SSE)
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i const *)&mask->words[i]);
+        __m128i b = _mm_loadu_si128((__m128i const *)&other->words[i]);
+        __m128i diff = _mm_xor_si128(a, b);
+
+        if (!_mm_testz_si128(diff, diff)) {
+            return false;
+        }
+    }
+#else
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i++) {
+        if (mask->words[i] != other->words[i]) {
+            return false;
+        }
+    }
+#endif
+
+    return true;
+}
+
+/// whether the masks share any id
+static inline bool cmask_intersects(
+        ComponentMask const *mask, ComponentMask const *other) {
+#if defined(COMPONENT_MASK_AVX)
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i const *)&mask->words[i]);
+        __m256i b = _mm256_loadu_si256((__m256i const *)&other->words[i]);
+
+        if (!_mm256_testz_si256(a, b)) {
+            return true;
+        }
+    }
+#elif defined(COMPONENT_MASK_SSE)
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i const *)&mask->words[i]);
+        __m128i b = _mm_loadu_si128((__m128i const *)&other->words[i]);
+
+        if (!_mm_testz_si128(a, b)) {
+            return true;
+        }
+    }
+#else
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i++) {
+        if (mask->words[i] & other->words[i]) {
+            return true;
+        }
+    }
+#endif
+
+    return false;
+}
+
+/// the ids of `mask` that aren't in `other`
+static inline ComponentMask cmask_without(
+        ComponentMask const *mask, ComponentMask const *other) {
+    ComponentMask result;
+
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i++) {
+        result.words[i] = mask->words[i] & ~other->words[i];
+    }
+
+    return result;
+}
+
+static inline ComponentMask cmask_and(
+        ComponentMask const *mask, ComponentMask const *other) {
+    ComponentMask result;
+
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i++) {
+        result.words[i] = mask->words[i] & other->words[i];
+    }
+
+    return result;
+}
+
+static inline bool cmask_is_zero(ComponentMask const *mask) {
+    return !cmask_intersects(mask, mask);
+}
+
+static inline size_t cmask_popcount(ComponentMask const *mask) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i++) {
+        count += __builtin_popcountll(mask->words[i]);
+    }
+
+    return count;
+}
+
+/// lowest id in `mask` that is at least `from`, `ECS_MAX_COMPONENTS` if
+/// there is none. visits every id with
+/// `for (id = cmask_next(m, 0); id < ECS_MAX_COMPONENTS;
+///         id = cmask_next(m, id + 1))`
+static inline size_t cmask_next(ComponentMask const *mask, size_t from) {
+    for (size_t i = from / 64; i < COMPONENT_MASK_WORDS; i++) {
+        uint64_t word = mask->words[i];
+
+        if (i == from / 64) {
+            word &= UINT64_MAX << (from % 64);
+        }
+
+        if (word) {
+            return i * 64 + __builtin_ctzll(word);
+        }
+    }
+
+    return ECS_MAX_COMPONENTS;
+}
+
+static inline uint64_t cmask_hash(ComponentMask const *mask) {
+    return crc64((uint8_t const *)mask->words, sizeof(mask->words));
+}
@@ -1,60 +1,203 @@
 #ifndef SUNSET_ECS_H_
 #define SUNSET_ECS_H_
 
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "internal/utils.h"
-#include "sunset/bitmask.h"
+#include "sunset/blob_arena.h"
+#include "sunset/component_mask.h"
+#include "sunset/map.h"
 #include "sunset/vector.h"
 
-#define ECS_MAX_COMPONENTS 64
+#define ECS_COLUMN_NONE UINT16_MAX
 
 #define ENTITY_PTR_INVALID                                                 \
     (EntityPtr) {                                                          \
-        SIZE_MAX, SIZE_MAX                                                 \
+        UINT32_MAX, UINT32_MAX                                             \
     }
 
+#define ENTITY_INVALID UINT64_MAX
+
 #define COMPONENT_ID(type) _component_id_##type
 #define DECLARE_COMPONENT_ID(type)                                         \
     __attribute__((weak)) size_t COMPONENT_ID(type)
 
+#define ECS_DEFAULT_GRAIN_SIZE 1024
+
+/// rows per column page, a power of two and a multiple of 64 so every
+/// page size is a multiple of `ECS_PAGE_ALIGNMENT`
+#ifndef ECS_PAGE_ROWS
+#define ECS_PAGE_ROWS 1024
+#endif
+#define ECS_PAGE_ALIGNMENT 64
+/// with `SUNSET_ECS_HUGE_PAGES`, pages at least this big are aligned to it
+/// and advised to be backed by transparent huge pages
+#define ECS_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#define ENTITY_BUILDER_INLINE_SIZE 256
+#define ENTITY_BUILDER_ALIGNMENT 16
+
 typedef struct Writer Writer;
+typedef struct VfsFile VfsFile;
 typedef struct World World;
+typedef struct ThreadPool ThreadPool;
 
 typedef uint32_t Index;
 
-size_t _ecs_register_component(
-        World *world, size_t component_size, char const *component_name);
+/// generational entity handle, the entity's slot in `World.entity_ptrs` in
+/// the low 32 bits and the slot's generation in the high 32 bits. a handle
+/// goes stale once its entity is removed, even if the slot is reused.
+typedef uint64_t Entity;
+
+typedef enum ComponentStorage {
+    /// a column in every archetype with the component. fastest to iterate,
+    /// but adding or removing the component moves the entity's whole row
+    COMPONENT_STORAGE_TABLE,
+    /// a sparse set outside of the archetypes, added and removed in O(1)
+    /// without moving the entity. meant for short lived tags and markers
+    COMPONENT_STORAGE_SPARSE,
+    /// a column of `SharedRef`s into a table of deduplicated, reference
+    /// counted values. meant for data many entities have identical
+    /// copies of, writing it copies the value for that one entity only
+    COMPONENT_STORAGE_SHARED,
+} ComponentStorage;
+
+size_t _ecs_register_component(World *world,
+        size_t component_size,
+        char const *component_name,
+        ComponentStorage storage);
 
 #define REGISTER_COMPONENT(world, type)                                    \
-    COMPONENT_ID(type) =                                                   \
-            _ecs_register_component(world, sizeof(type), stringify(type))
+    COMPONENT_ID(type) = _ecs_register_component(                          \
+            world, sizeof(type), stringify(type), COMPONENT_STORAGE_TABLE)
+
+#define REGISTER_SPARSE_COMPONENT(world, type)                             \
+    COMPONENT_ID(type) = _ecs_register_component(                          \
+            world, sizeof(type), stringify(type), COMPONENT_STORAGE_SPARSE)
+
+#define REGISTER_SHARED_COMPONENT(world, type)                             \
+    COMPONENT_ID(type) = _ecs_register_component(                          \
+            world, sizeof(type), stringify(type), COMPONENT_STORAGE_SHARED)
 
 typedef struct Column {
-    Bitmask mask;
+    Index component_id;
     size_t element_size;
-    vector(uint8_t) data;
+    /// `ECS_PAGE_ROWS` rows each, aligned to `ECS_PAGE_ALIGNMENT`. pages
+    /// never move, so a component pointer stays valid while other rows are
+    /// added, until its own row is removed or swapped into.
+    vector(uint8_t *) pages;
+    /// the first pages live in the world's save file mapping rather than
+    /// on the heap
+    size_t num_borrowed_pages;
+    /// world tick of the latest write to any row, atomic so that
+    /// `span_mark_changed` can be called from `ecs_par_for` workers
+    _Atomic uint32_t changed_tick;
+    /// world tick of the latest write to every row
+    vector(uint32_t) row_ticks;
 } Column;
 
+/// cached archetype graph edge: the archetypes reached by adding or
+/// removing `component_id`, `SIZE_MAX` until first used
+typedef struct ArchetypeEdge {
+    Index component_id;
+    size_t add;
+    size_t remove;
+} ArchetypeEdge;
+
 typedef struct Archetype {
-    Bitmask mask;
+    ComponentMask mask;
     size_t num_elements;
     vector(Column) columns;
-    vector(Index) free_elems;
+    /// entity slot of every row, kept dense by swap-removal
+    vector(Index) entities;
+    /// maps a component id to its index in `columns`, or
+    /// `ECS_COLUMN_NONE` if the archetype doesn't have it
+    uint16_t column_index[ECS_MAX_COMPONENTS];
+    /// sorted by component id
+    map(ArchetypeEdge) edges;
 } Archetype;
 
+typedef struct ArchetypeSlot {
+    uint64_t hash;
+    /// archetype index + 1, 0 marks an empty slot
+    size_t index;
+} ArchetypeSlot;
+
+/// storage of a `COMPONENT_STORAGE_SPARSE` component
+typedef struct SparseSet {
+    size_t element_size;
+    /// position in `entities` + 1 for every entity slot, 0 if the entity
+    /// doesn't have the component
+    vector(Index) sparse;
+    /// entity slot of every element, kept dense by swap-removal
+    vector(Index) entities;
+    /// moves when elements are added, unlike column pages
+    vector(uint8_t) data;
+    vector(uint32_t) ticks;
+    _Atomic uint32_t changed_tick;
+} SparseSet;
+
+/// handle to a value of a shared component. rows with equal values have
+/// equal handles, so they can be grouped without comparing the values.
+typedef uint32_t SharedRef;
+
+/// the zeroed value that rows of a shared component start out with. it's
+/// never freed, so it isn't reference counted
+#define SHARED_REF_ZERO 0
+
+typedef struct SharedKey {
+    uint64_t hash;
+    SharedRef ref;
+} SharedKey;
+
+/// storage of a `COMPONENT_STORAGE_SHARED` component's values
+typedef struct SharedTable {
+    size_t element_size;
+    /// moves when values are added, like sparse set data
+    vector(uint8_t) values;
+    /// rows referring to every value, 0 for free slots
+    vector(uint32_t) refcounts;
+    vector(SharedRef) free_refs;
+    /// `crc64` of every live value, sorted by hash. a value whose hash is
+    /// already taken by a different one is stored without deduplication
+    map(SharedKey) lookup;
+} SharedTable;
+
 typedef struct EntityPtr {
-    size_t archetype;
-    size_t element;
+    uint32_t archetype;
+    uint32_t element;
 } EntityPtr;
 
 typedef struct World {
     vector(size_t) component_sizes;
     vector(Archetype) archetypes;
+    /// open-addressed, keyed by `cmask_hash` of the archetype mask.
+    /// size is always a power of two
+    vector(ArchetypeSlot) archetype_lookup;
     vector(EntityPtr) entity_ptrs;
+    /// bumped every time the matching slot of `entity_ptrs` is freed
+    vector(uint32_t) generations;
     vector(Index) free_ids;
+    /// one per component, only used by sparse ones
+    vector(SparseSet) sparse_sets;
+    /// components with `COMPONENT_STORAGE_SPARSE`. they are never part of
+    /// an archetype's mask, queries check them row by row instead
+    ComponentMask sparse_components;
+    /// one per component, only used by shared ones
+    vector(SharedTable) shared_tables;
+    ComponentMask shared_components;
+    /// variable length component data, see `ecs_blob_alloc`
+    BlobArena blobs;
+    /// stamped onto every column and row written, see `ecs_advance_tick`.
+    /// atomic since systems running concurrently may advance it
+    _Atomic uint32_t change_tick;
+    /// save file adopted by `ecs_load`, NULL if none
+    void *mapping;
+    size_t mapping_size;
 #ifdef SUNSET_REFLECTION
     vector(char const *) component_names;
 #endif
@@ -62,41 +205,268 @@ typedef struct World {
 
 typedef struct EntityBuilder {
     World *world;
-    Bitmask mask;
-    vector(void *) components;
-    vector(size_t) component_ids;
+    ComponentMask mask;
+
+    size_t num_components;
+    Index component_ids[ECS_MAX_COMPONENTS];
+    size_t component_offsets[ECS_MAX_COMPONENTS];
+
+    // component copies are packed into `inline_storage` and only spill to
+    // a single heap buffer once that is full
+    size_t storage_size;
+    size_t storage_capacity;
+    uint8_t *heap_storage;
+    alignas(ENTITY_BUILDER_ALIGNMENT) uint8_t
+            inline_storage[ENTITY_BUILDER_INLINE_SIZE];
 } EntityBuilder;
 
+/// a persistent set of archetypes matching `mask`. the archetype list is
+/// only extended with archetypes created since the last update, so
+/// keeping a `Query` around across frames makes iteration independent of
+/// the total number of archetypes.
+typedef struct Query {
+    ComponentMask mask;
+    /// see `query_without`, `query_any_of` and `query_optional`
+    ComponentMask without;
+    ComponentMask any_of;
+    ComponentMask optional;
+    vector(size_t) archetypes;
+    size_t num_archetypes_seen;
+    /// see `query_filter_changed`
+    vector(Index) changed_filter;
+    uint32_t last_run_tick;
+} Query;
+
 typedef struct WorldIterator {
     World const *world;
-    Bitmask mask;
+    ComponentMask mask;
+    /// when set, only the archetypes of `query` are visited
+    Query const *query;
+    size_t current_match;
     size_t current_archetype;
     size_t current_element;
 } WorldIterator;
 
+/// a contiguous run of rows of a single archetype, never crossing a column
+/// page. every column is packed within a page, so `span_get_column` gives
+/// a base pointer that can be indexed `[0, count)` directly. sparse
+/// components are reached row by row through `span_get_component`.
+typedef struct ArchetypeSpan {
+    Archetype *archetype;
+    size_t archetype_index;
+    size_t begin;
+    size_t count;
+    /// rows written after this tick count as changed, see
+    /// `span_row_changed`
+    uint32_t changed_since;
+} ArchetypeSpan;
+
+typedef void (*SpanFn)(World *world,
+        ArchetypeSpan const *span,
+        size_t worker_index,
+        void *ctx);
+
+typedef struct SpanIterator {
+    World *world;
+    /// NULL when only iterating rows of a single archetype
+    Query const *query;
+    size_t current_match;
+    uint32_t changed_since;
+    /// whether the current archetype has rows the query doesn't match,
+    /// because of terms on sparse components. spans are split around them
+    bool row_terms;
+    /// rows of the current archetype not yet split into spans
+    size_t archetype_index;
+    size_t next_row;
+    size_t end_row;
+} SpanIterator;
+
 void ecs_init(World *world);
+void ecs_destroy(World *world);
+
+Entity ecs_add_entity(World *world, ComponentMask mask);
+/// adds `count` entities sharing `mask` with a single resize per column.
+/// their rows are contiguous and zeroed, the returned iterator yields them
+/// as one span per page to be filled through `span_get_column`, or
+/// `span_get_component` for sparse components and `ecs_write_component`
+/// for shared ones. it's only valid until the next structural change.
+/// `entities_out` may be NULL.
+SpanIterator ecs_spawn_batch(World *world,
+        ComponentMask mask,
+        size_t count,
+        Entity *entities_out);
+/// moves the archetype's last row into the removed entity's slot, so
+/// `EntityPtr`s to that row are invalidated. keep `Entity` handles around
+/// instead of `EntityPtr`s across removals. stale handles are ignored.
+void ecs_remove_entity(World *world, Entity entity);
+/// releases storage left over after many entities were removed
+void ecs_compress(World *world);
 
-Index ecs_add_entity(World *world, Bitmask mask);
-void ecs_remove_entity(World *world, uint32_t entity_id);
+bool ecs_is_alive(World const *world, Entity entity);
+/// returns `ENTITY_PTR_INVALID` for stale handles
+EntityPtr ecs_entity_ptr(World const *world, Entity entity);
+/// handle of the entity `eptr` points at, `ENTITY_INVALID` for
+/// `ENTITY_PTR_INVALID`
+Entity ecs_ptr_entity(World const *world, EntityPtr eptr);
 
-void *ecs_get_component(
-        World *world, uint32_t entity_id, uint32_t component_id);
+/// returns NULL for stale handles. a pointer to a sparse component is
+/// only valid until the same component is added to another entity.
+/// shared components are read only, their pointers stay valid until the
+/// next write to the same component.
+void *ecs_get_component(World *world, Entity entity, Index component_id);
+/// copies `component` into the entity's row and marks it changed. rows of
+/// a shared component are pointed at an equal value instead, which is
+/// added if there is none yet, leaving other rows sharing the old value
+/// untouched. the entity has to have the component already.
+void ecs_write_component(World *world,
+        EntityPtr eptr,
+        Index component_id,
+        void const *component);
+/// adds a zeroed blob to `world->blobs` for a component to refer to. it's
+/// freed along with `owner`, unless that is `ENTITY_PTR_INVALID`.
+/// `ecs_compress` packs the arena, which leaves handles valid.
+BlobRef ecs_blob_alloc(World *world, EntityPtr owner, size_t size);
+/// the value behind a handle taken from a shared component's column
+void const *ecs_shared_value(
+        World const *world, Index component_id, SharedRef ref);
+
+/// returns the current tick and starts a new one. a reader keeps the
+/// returned tick as its last run, everything written afterwards compares
+/// newer than it.
+uint32_t ecs_advance_tick(World *world);
+/// records a write to a component through `ecs_component_from_ptr` or
+/// `ecs_get_component`. adding entities or components marks the new rows
+/// on its own.
+void ecs_mark_changed(World *world, EntityPtr eptr, Index component_id);
+bool ecs_changed_since(World const *world,
+        EntityPtr eptr,
+        Index component_id,
+        uint32_t since);
+
+/// moves the entity to the archetype with `component_id` added, sparse
+/// components are added in place. the component is copied from
+/// `component`, or zeroed if it's NULL. if the entity already has the
+/// component it's only overwritten.
+void ecs_add_component(World *world,
+        Entity entity,
+        Index component_id,
+        void const *component);
+/// moves the entity to the archetype without `component_id`, if it has it.
+/// sparse components are removed in place.
+void ecs_remove_component(World *world, Entity entity, Index component_id);
 
 void entity_builder_init(EntityBuilder *builder, World *world);
 void entity_builder_add(EntityBuilder *builder, size_t id, void *component);
-Index entity_builder_finish(EntityBuilder *builder);
+Entity entity_builder_finish(EntityBuilder *builder);
+/// discards a builder without adding an entity
+void entity_builder_destroy(EntityBuilder *builder);
+
+void query_init(Query *query, ComponentMask mask);
+void query_destroy(Query *query);
+void query_update(Query *query, World const *world);
+/// terms are resolved once per archetype, so like the mask they have to
+/// be added before the query's first update. terms on sparse components
+/// are checked per row instead.
+///
+/// skips archetypes with `component_id`
+void query_without(Query *query, Index component_id);
+/// matches archetypes with at least one of the components passed to
+/// `query_any_of`, when there are any
+void query_any_of(Query *query, Index component_id);
+/// declares a component read when present without affecting matching.
+/// `span_get_column` gives either the column or NULL for a whole span, so
+/// it has to be a table component.
+void query_optional(Query *query, Index component_id);
+/// restricts span iteration to archetypes where any filtered component was
+/// written since the previous `spanit_create` with this query. rows within
+/// those spans can be told apart with `span_row_changed`. writes made
+/// while iterating are picked up by the next run.
+void query_filter_changed(Query *query, Index component_id);
 
-WorldIterator worldit_create(World const *world, Bitmask mask);
+WorldIterator worldit_create(World const *world, ComponentMask mask);
+WorldIterator worldit_from_query(World const *world, Query *query);
 bool worldit_is_valid(WorldIterator const *iterator);
 void worldit_advance(WorldIterator *iterator);
 EntityPtr worldit_get_entityptr(WorldIterator *iterator);
+Entity worldit_get_entity(WorldIterator *iterator);
 void *worldit_get_component(WorldIterator *iterator, Index component_id);
-void worldit_destroy(WorldIterator *iterator);
+
+SpanIterator spanit_create(World *world, Query *query);
+/// returns false once every matching archetype has been visited
+bool spanit_next(SpanIterator *iterator, ArchetypeSpan *span_out);
+
+/// returns NULL if the span's archetype doesn't have `component_id` as a
+/// column, which includes every sparse component. columns of shared
+/// components hold `SharedRef`s rather than the values.
+void *span_get_column(ArchetypeSpan const *span, Index component_id);
+/// row `i` of either kind of component, NULL if the row doesn't have it
+void *span_get_component(World const *world,
+        ArchetypeSpan const *span,
+        Index component_id,
+        size_t i);
+EntityPtr span_get_entityptr(ArchetypeSpan const *span, size_t i);
+Entity span_get_entity(
+        World const *world, ArchetypeSpan const *span, size_t i);
+/// marks every row of the span, safe to call from `ecs_par_for`
+void span_mark_changed(
+        World const *world, ArchetypeSpan const *span, Index component_id);
+/// whether row `i` was written since the span's `changed_since`. false if
+/// the archetype doesn't have `component_id` as a column
+bool span_row_changed(
+        ArchetypeSpan const *span, Index component_id, size_t i);
+
+#define span_column(span, type)                                            \
+    ((type *)span_get_column(span, COMPONENT_ID(type)))
+
+/// splits every archetype matched by `query` into spans of at most
+/// `grain_size` rows (0 picks `ECS_DEFAULT_GRAIN_SIZE`) and runs `fn` on
+/// them across `pool`, returning once all spans were processed.
+///
+/// guarantees while `fn` runs:
+/// - spans never overlap and every matching row is visited exactly once,
+///   so writing any column of the rows in the passed span is race free.
+/// - any column may be read concurrently, but rows outside the passed span
+///   may be written by another worker at the same time; reading them is
+///   only safe for columns no system writes during this call.
+/// - no structural changes (adding/removing entities or components,
+///   registering components) may happen from `fn`, since they reallocate
+///   archetype and column storage other workers are reading. record them
+///   into an `EcsCommandBuffer` per worker instead.
+void ecs_par_for(World *world,
+        Query *query,
+        ThreadPool *pool,
+        size_t grain_size,
+        SpanFn fn,
+        void *ctx);
 
 void *ecs_component_from_ptr(
         World *world, EntityPtr eptr, Index component_id);
 
-void ecs_save(World *world, Writer *writer);
+/// writes a versioned binary snapshot of every entity. columns are
+/// written verbatim in native byte order, so snapshots are only portable
+/// between builds with the same component layouts.
+int ecs_save(World const *world, Writer *writer);
+/// maps a snapshot written by `ecs_save` into `world`, which has to be
+/// empty and have the same components registered in the same order.
+/// column data is used in place from the mapping rather than copied.
+int ecs_load(World *world, VfsFile *file);
+
+/// wrapping comparison of change ticks
+static inline bool ecs_tick_newer(uint32_t tick, uint32_t since) {
+    return (int32_t)(tick - since) > 0;
+}
+
+static inline Entity entity_make(Index index, uint32_t generation) {
+    return (Entity)generation << 32 | index;
+}
+
+static inline Index entity_index(Entity entity) {
+    return (Index)entity;
+}
+
+static inline uint32_t entity_generation(Entity entity) {
+    return (uint32_t)(entity >> 32);
+}
 
 static inline bool eptr_eql(EntityPtr a, EntityPtr b) {
     return a.element == b.element && a.archetype == b.archetype;
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunset/component_mask.h"
+#include "sunset/ecs.h"
+#include "sunset/vector.h"
+
+typedef enum EcsCommandType {
+    ECS_COMMAND_SPAWN,
+    ECS_COMMAND_DESPAWN,
+    ECS_COMMAND_ADD_COMPONENT,
+    ECS_COMMAND_REMOVE_COMPONENT,
+} EcsCommandType;
+
+typedef struct EcsCommandComponent {
+    Index component_id;
+    /// offset of the component's bytes in `EcsCommandBuffer.data`, or
+    /// `SIZE_MAX` if it should be zeroed
+    size_t offset;
+} EcsCommandComponent;
+
+typedef struct EcsCommand {
+    EcsCommandType type;
+    Entity entity;
+    /// spawns only
+    ComponentMask mask;
+    Entity *entity_out;
+    /// range of `EcsCommandBuffer.components`
+    size_t first_component;
+    size_t num_components;
+} EcsCommand;
+
+/// records structural changes to be applied later, so they can be issued
+/// while iterating or from `ecs_par_for` workers. recording only reads
+/// component sizes from the world, so every thread can fill its own
+/// buffer concurrently.
+typedef struct EcsCommandBuffer {
+    World const *world;
+    vector(EcsCommand) commands;
+    vector(EcsCommandComponent) components;
+    vector(uint8_t) data;
+} EcsCommandBuffer;
+
+void ecs_cmdbuf_init(EcsCommandBuffer *cmdbuf, World const *world);
+void ecs_cmdbuf_destroy(EcsCommandBuffer *cmdbuf);
+
+/// takes over the builder's components and destroys it. `entity_out` may
+/// be NULL, otherwise it must stay valid until the flush and receives the
+/// new entity's handle then.
+void ecs_cmdbuf_spawn(EcsCommandBuffer *cmdbuf,
+        EntityBuilder *builder,
+        Entity *entity_out);
+void ecs_cmdbuf_despawn(EcsCommandBuffer *cmdbuf, Entity entity);
+/// `component` is copied right away, NULL zeroes the component
+void ecs_cmdbuf_add_component(EcsCommandBuffer *cmdbuf,
+        Entity entity,
+        Index component_id,
+        void const *component);
+void ecs_cmdbuf_remove_component(
+        EcsCommandBuffer *cmdbuf, Entity entity, Index component_id);
+
+/// applies and clears `num_cmdbufs` buffers at once, typically one per
+/// worker of a `ThreadPool`. spawns from every buffer are grouped by
+/// archetype and added with one `ecs_spawn_batch` per group. the other
+/// commands are applied afterwards, grouped by the archetype their target
+/// is in and from its last row down, so rows are moved as little as
+/// possible. commands on the same entity keep the order they were
+/// recorded in, buffer by buffer.
+void ecs_cmdbuf_flush(
+        EcsCommandBuffer *cmdbufs, size_t num_cmdbufs, World *world);
@@ -10,9 +10,15 @@
 #include "sunset/crypto.h"
 #include "sunset/ecs.h"
 #include "sunset/events.h"
+#include "sunset/fixed_step.h"
+#include "sunset/physics_system.h"
 #include "sunset/rman.h"
+#include "sunset/scheduler.h"
+#include "sunset/thread_pool.h"
 #include "sunset/vector.h"
 
+#define ENGINE_DEFAULT_TICK_RATE 60.0f
+
 typedef struct UIContext UIContext;
 
 typedef void *PluginHandle;
@@ -34,10 +40,19 @@ typedef struct EngineContext {
     EventQueue event_queue;
     ResourceManager rman;
     World world;
+    /// shared by every system that iterates the world in parallel
+    ThreadPool thread_pool;
+    /// runs every tick, after the `SYSTEM_EVENT_TICK` handlers
+    Scheduler scheduler;
+    /// stepped by a system of `scheduler`
+    PhysicsWorld physics;
 
     Camera camera;
 
+    /// length of a simulation tick, ticks run at a fixed rate however
+    /// long frames take
     float dt;
+    FixedStep fixed_step;
 
     DebugInfo debug_info;
 } EngineContext;
@@ -55,6 +70,9 @@ typedef struct Plugin {
 typedef struct Game {
     World world;
 
+    /// simulation ticks per second, `ENGINE_DEFAULT_TICK_RATE` when 0
+    float tick_rate;
+
     vector(Plugin) plugins;
 
     vector(char const *) resources;
@@ -5,6 +5,7 @@
 
 #include <cglm/types.h>
 
+#include "sunset/ecs.h"
 #include "sunset/vector.h"
 
 typedef struct EngineContext EngineContext;
@@ -53,9 +54,9 @@ enum collision_type {
 struct collision_event {
     enum collision_type type;
     vec3 a_velocity;
-    struct object *a;
+    Entity a;
     vec3 b_velocity;
-    struct object *b;
+    Entity b;
 };
 
 static_assert(
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+/// simulation ticks run by a single `fixed_step_advance` at most. time
+/// past that is dropped, so that a long frame can't make the next one
+/// even longer by queueing up ticks
+#define FIXED_STEP_MAX_SUBSTEPS 5
+
+/// turns variable frame times into a whole number of ticks of `step`
+/// seconds, carrying the remainder over to the next frame
+typedef struct FixedStep {
+    float step;
+    float accumulator;
+    size_t max_substeps;
+} FixedStep;
+
+void fixed_step_init(
+        FixedStep *fixed_step, float step, size_t max_substeps);
+
+/// adds the frame's time and returns how many ticks to run for it
+size_t fixed_step_advance(FixedStep *fixed_step, float frame_time);
+/// how far the time left over is into the next tick, from 0 to 1. used to
+/// blend the state of the last two ticks when rendering
+float fixed_step_alpha(FixedStep const *fixed_step);
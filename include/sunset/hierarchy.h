@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunset/ecs_types.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+/// parent of root entities and nodes
+#define HIERARCHY_ROOT UINT32_MAX
+/// parent of entity slots that aren't part of the hierarchy
+#define HIERARCHY_ABSENT (UINT32_MAX - 1)
+
+/// nodes of a root and all its descendants handed to a single task are
+/// batched until they reach this many
+#define HIERARCHY_GRAIN_SIZE 256
+
+typedef struct Hierarchy Hierarchy;
+
+/// called on every node whose own or an ancestor's `hierarchy_mark_dirty`
+/// is pending, always after its parent. calls for nodes of different
+/// roots may run concurrently.
+typedef void (*HierarchyFn)(
+        Hierarchy const *hierarchy, uint32_t node, void *ctx);
+
+/// parent/child relations between entity slots, laid out flat for
+/// passes that visit parents before their children. nodes are grouped by
+/// root and sorted by depth within each group, so a pass only has to
+/// walk the arrays once and independent roots can be split across
+/// workers.
+typedef struct Hierarchy {
+    /// indexed by entity slot, the parent's slot, `HIERARCHY_ROOT` or
+    /// `HIERARCHY_ABSENT`
+    vector(Index) entity_parents;
+    size_t num_entities;
+
+    // the flat layout, rebuilt by the next pass once `layout_dirty` is
+    // set. entities caught in a parent cycle are left out.
+
+    /// entity slot of every node
+    vector(Index) entities;
+    /// node of every node's parent, `HIERARCHY_ROOT` for roots
+    vector(uint32_t) parents;
+    /// indexed by entity slot, `HIERARCHY_ABSENT` without a node
+    vector(uint32_t) entity_nodes;
+    /// first node of every root, followed by the number of nodes
+    vector(uint32_t) root_offsets;
+    /// index into `root_offsets` of every node's root
+    vector(uint32_t) node_roots;
+    vector(bool) dirty;
+    /// roots with a dirty node, each listed once in `dirty_roots`
+    vector(bool) root_dirty;
+    vector(uint32_t) dirty_roots;
+    bool layout_dirty;
+} Hierarchy;
+
+void hierarchy_init(Hierarchy *hierarchy);
+void hierarchy_destroy(Hierarchy *hierarchy);
+
+/// adds the entity slot if it isn't part of the hierarchy yet, `parent`
+/// is `HIERARCHY_ROOT` for roots. a parent that isn't part of the
+/// hierarchy makes the entity a root until it's added.
+void hierarchy_set_parent(Hierarchy *hierarchy, Index entity, Index parent);
+/// children of the entity are kept, they become roots
+void hierarchy_remove(Hierarchy *hierarchy, Index entity);
+/// makes every child of the entity a root, so that they don't attach to
+/// whatever is added to its slot next. walks every slot.
+void hierarchy_detach_children(Hierarchy *hierarchy, Index entity);
+bool hierarchy_contains(Hierarchy const *hierarchy, Index entity);
+/// the next pass visits the entity and all its descendants
+void hierarchy_mark_dirty(Hierarchy *hierarchy, Index entity);
+
+/// rebuilds the layout if needed and runs `fn` on every dirty node,
+/// spreading the dirty roots across `pool`. every node is dirty after
+/// the layout changed.
+void hierarchy_propagate(Hierarchy *hierarchy,
+        ThreadPool *pool,
+        HierarchyFn fn,
+        void *ctx);
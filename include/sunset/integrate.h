@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/// bodies integrated by a single kernel call
+#define INTEGRATE_LANES 8
+
+// the kernel uses the widest vectors the target has, a batch is a single
+// AVX register per field or two SSE ones
+#if defined(__AVX__)
+#define INTEGRATE_AVX
+#elif defined(__SSE__)
+#define INTEGRATE_SSE
+#endif
+
+/// bodies staged field by field, so every field of all lanes is a single
+/// vector load. lanes past the batch's count are ignored.
+typedef struct IntegrateBatch {
+    _Alignas(32) float position[3][INTEGRATE_LANES];
+    _Alignas(32) float velocity[3][INTEGRATE_LANES];
+    _Alignas(32) float acceleration[3][INTEGRATE_LANES];
+    _Alignas(32) float damping[INTEGRATE_LANES];
+} IntegrateBatch;
+
+/// semi-implicit euler over every lane: acceleration is added to the
+/// velocity, which is damped by `damping` per second and then moves the
+/// position
+void integrate_batch(IntegrateBatch *batch, float dt);
+/// same as `integrate_batch`, one lane at a time over the first `count`
+/// lanes. used for leftover bodies and to check the vector kernel
+void integrate_batch_scalar(IntegrateBatch *batch, size_t count, float dt);
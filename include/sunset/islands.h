@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunset/broadphase.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+/// pairs of all islands handed to a single task are batched until they
+/// reach this many
+#define ISLAND_GRAIN_SIZE 64
+
+typedef struct ContactIslands ContactIslands;
+
+/// called once for every island on the pool worker `worker_index`, calls
+/// for different islands may run concurrently
+typedef void (*ContactIslandFn)(ContactIslands const *islands,
+        uint32_t island,
+        size_t worker_index,
+        void *ctx);
+
+/// bodies connected through candidate pairs, partitioned so that islands
+/// share no body that can move and can be solved independently. bodies
+/// flagged fixed don't connect the islands they touch.
+///
+/// the partition only depends on the order of the pairs: islands are
+/// numbered by their first pair and list their pairs in order.
+typedef struct ContactIslands {
+    /// union-find forest over bodies
+    vector(uint32_t) parents;
+    vector(uint32_t) body_islands;
+
+    /// first entry of `island_pairs` of every island, followed by the
+    /// number of entries
+    vector(uint32_t) island_offsets;
+    /// indices into the pairs passed to `contact_islands_build`
+    vector(uint32_t) island_pairs;
+
+    vector(uint32_t) task_offsets;
+} ContactIslands;
+
+void contact_islands_init(ContactIslands *islands);
+void contact_islands_destroy(ContactIslands *islands);
+
+/// pairs of two fixed bodies are left out of every island
+void contact_islands_build(ContactIslands *islands,
+        size_t num_bodies,
+        bool const *fixed,
+        BroadphasePair const *pairs,
+        size_t num_pairs);
+size_t contact_islands_count(ContactIslands const *islands);
+
+/// runs `fn` on every island, spreading them across `pool`
+void contact_islands_run(ContactIslands *islands,
+        ThreadPool *pool,
+        ContactIslandFn fn,
+        void *ctx);
@@ -8,6 +8,7 @@
 #include "internal/utils.h"
 #include "sunset/ecs.h"
 #include "sunset/events.h"
+#include "sunset/physics_system.h"
 #include "sunset/vector.h"
 
 typedef struct EngineContext EngineContext;
@@ -18,25 +19,6 @@ struct constraint {
     float distance;
 };
 
-struct physics_material {
-    float restitution;
-    float friction;
-};
-
-enum physics_object_type {
-    /// doesn't affect other objects, just checks for collisions
-    PHYSICS_OBJECT_COLLIDER,
-    /// objects that don't get fixed after a collision, but do affect other
-    /// objects
-    PHYSICS_OBJECT_INFINITE,
-    /// regular objects
-    PHYSICS_OBJECT_REGULAR,
-};
-
-enum physics_flags {
-    PHYSICS_FLAGS_APPLY_GRAVITY = sunset_flag(0),
-};
-
 struct PhysicsObject {
     enum physics_object_type type;
 
@@ -83,19 +65,3 @@ bool physics_move_object(struct scene *scene,
         struct object *object,
         vec3 direction,
         EventQueue *event_queue);
-
-void physics_callback(EngineContext *engine_context,
-        void *physics,
-        Event /* engine tick */);
-
-struct PhysicsState {
-    enum physics_object_type type;
-    struct physics_material material;
-
-    enum physics_flags flags;
-
-    vec3 acceleration;
-    vec3 velocity;
-    float damping;
-    float mass;
-} typedef PhysicsState;
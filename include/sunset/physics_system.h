@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cglm/types.h>
+
+#include "internal/utils.h"
+#include "sunset/broadphase.h"
+#include "sunset/ecs.h"
+#include "sunset/events.h"
+#include "sunset/islands.h"
+#include "sunset/map.h"
+#include "sunset/scheduler.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+/// downward acceleration of bodies with `PHYSICS_FLAGS_APPLY_GRAVITY`
+#define PHYSICS_GRAVITY 9.81f
+/// default of `solver_iterations`
+#define PHYSICS_SOLVER_ITERATIONS 8
+/// fraction of a contact's penetration pushed out per second of ticks
+#define PHYSICS_BAUMGARTE 0.2f
+/// penetration that's left alone, so resting contacts don't jitter
+#define PHYSICS_PENETRATION_SLOP 0.01f
+
+struct physics_material {
+    float restitution;
+    float friction;
+};
+
+enum physics_object_type {
+    /// doesn't affect other objects, just checks for collisions
+    PHYSICS_OBJECT_COLLIDER,
+    /// objects that don't get fixed after a collision, but do affect other
+    /// objects
+    PHYSICS_OBJECT_INFINITE,
+    /// regular objects
+    PHYSICS_OBJECT_REGULAR,
+};
+
+enum physics_flags {
+    PHYSICS_FLAGS_APPLY_GRAVITY = sunset_flag(0),
+};
+
+typedef struct PhysicsState {
+    enum physics_object_type type;
+    struct physics_material material;
+
+    enum physics_flags flags;
+
+    vec3 acceleration;
+    vec3 velocity;
+    float damping;
+    float mass;
+} PhysicsState;
+
+/// narrowphase result of a candidate pair, by proxy
+typedef struct Contact {
+    uint32_t a;
+    uint32_t b;
+    /// points from `a` to `b`
+    vec3 normal;
+    float depth;
+    bool touching;
+
+    // set up before the island is solved. `body_a` is NULL for contacts
+    // the bodies don't respond to.
+
+    PhysicsState *body_a;
+    PhysicsState *body_b;
+    float inverse_mass_a;
+    float inverse_mass_b;
+    /// separating velocity along the normal the solver aims for
+    float velocity_bias;
+    /// accumulated over the solver iterations, never negative
+    float impulse;
+} Contact;
+
+/// impulse a contact ended the previous tick with, to warm start from
+typedef struct CachedContact {
+    Entity a;
+    Entity b;
+    vec3 normal;
+    float impulse;
+} CachedContact;
+
+/// simulates entities with `PhysicsState`, `Position` and `Bounds`. bodies
+/// move through `Position`, their `Bounds` are expected to follow it
+/// before the next tick, see `transform_propagate`.
+typedef struct PhysicsWorld {
+    Query body_query;
+    /// indexed by entity slot, how far the body was integrated this step.
+    /// its `Bounds` still lag behind by this much.
+    vector(vec3) body_offsets;
+
+    Broadphase broadphase;
+    /// indexed by entity slot, `BROADPHASE_PROXY_NONE` without a proxy
+    vector(uint32_t) body_proxies;
+    /// indexed by proxy, the body and the last step it was seen, proxies
+    /// of bodies that are gone are removed after every step
+    vector(Entity) proxy_bodies;
+    vector(uint32_t) proxy_steps;
+    /// indexed by proxy, bodies of infinite mass
+    vector(bool) proxy_fixed;
+    uint32_t step;
+
+    ContactIslands islands;
+    /// one per entry of `islands.island_pairs`, so that islands solved in
+    /// parallel never share a slot and the results come out in the same
+    /// order every run
+    vector(Contact) contacts;
+    /// sequential impulse passes over the contacts of every island per
+    /// tick, more make stacks settle faster
+    size_t solver_iterations;
+    /// responding contacts of the previous tick, by body pair
+    map(CachedContact) contact_cache;
+
+    /// collisions are pushed here, NULL to drop them
+    EventQueue *event_queue;
+    /// the scheduler's, set by `physics_add_system`
+    ThreadPool *pool;
+} PhysicsWorld;
+
+extern DECLARE_COMPONENT_ID(PhysicsState);
+
+/// registers `PhysicsState`. `Position` and `Bounds` have to be registered
+/// already.
+void physics_world_init(
+        PhysicsWorld *physics, World *world, EventQueue *event_queue);
+void physics_world_destroy(PhysicsWorld *physics);
+
+/// integrates velocity and position of every body across `pool`, see
+/// `integrate_batch`. bodies of infinite mass stay where they are.
+void physics_integrate(PhysicsWorld *physics,
+        World *world,
+        ThreadPool *pool,
+        float dt);
+/// integrates, then finds and solves the contacts of the bodies' bounds
+/// moved along with their integrated positions
+void physics_world_step(PhysicsWorld *physics,
+        World *world,
+        ThreadPool *pool,
+        float dt);
+
+/// runs `physics_world_step` every scheduler run as an exclusive system,
+/// so that it spreads its own work across the scheduler's pool. it
+/// writes `PhysicsState` and `Position` and reads `Bounds`.
+Index physics_add_system(PhysicsWorld *physics, Scheduler *scheduler);
@@ -7,6 +7,7 @@
 #include "sunset/ecs.h"
 #include "sunset/ecs_types.h"
 #include "sunset/geometry.h"
+#include "sunset/thread_pool.h"
 #include "sunset/vector.h"
 
 typedef struct CommandBuffer CommandBuffer;
@@ -22,15 +23,62 @@ typedef struct RenderConfig {
     bool enable_vsync;
 } RenderConfig;
 
+// an entity's transform is split across several components, so that
+// systems only touching positions don't pull matrices and bounds through
+// the cache. the hot ones are written every frame, the cold ones are
+// derived from them by `transform_propagate` or change rarely.
+// `entity_builder_add_transform` adds all of them at once.
+
+/// relative to the parent
+typedef struct Position {
+    vec3 value;
+} Position;
+
+/// unit quaternion, relative to the parent
+typedef struct Rotation {
+    versor value;
+} Rotation;
+
+typedef struct Scale {
+    float value;
+} Scale;
+
+typedef struct TransformLinks {
+    /// `ENTITY_INVALID` for roots, a handle so that it survives the
+    /// parent's row moving
+    Entity parent;
+    /// `Entity`s in the world's blob arena, `BLOB_REF_NONE` without
+    /// children. world matrices are propagated through `parent` alone.
+    BlobRef children;
+} TransformLinks;
+
+/// see `transform_propagate`
+typedef struct WorldTransform {
+    mat4 model;
+    /// `model` before the propagation that last wrote it, which
+    /// `render_world` blends from while that was the latest one
+    mat4 previous;
+    uint32_t generation;
+} WorldTransform;
+
+/// world space, follows the entity's world position
+typedef struct Bounds {
+    AABB box;
+} Bounds;
+
+/// all transform components in one, as they were before the split. only
+/// used to add and inspect them through `entity_builder_add_transform`,
+/// `transform_get` and `transform_set`, it isn't a component itself.
+/// `parent` is converted from and to the `Entity` in `TransformLinks`.
 typedef struct Transform {
     AABB bounding_box;
     vec3 position;
+    /// axis scaled by the angle
     vec3 rotation;
     float scale;
-    bool dirty;
 
     EntityPtr parent;
-    vector(EntityPtr) children;
+    BlobRef children;
 
     mat4 cached_model;
 } Transform;
@@ -48,16 +96,51 @@ typedef enum WindowPoint {
     WINDOW_BOTTOM_RIGHT,
 } WindowPoint;
 
-extern DECLARE_COMPONENT_ID(Transform);
-
+extern DECLARE_COMPONENT_ID(Position);
+extern DECLARE_COMPONENT_ID(Rotation);
+extern DECLARE_COMPONENT_ID(Scale);
+extern DECLARE_COMPONENT_ID(TransformLinks);
+extern DECLARE_COMPONENT_ID(WorldTransform);
+extern DECLARE_COMPONENT_ID(Bounds);
+
+/// adds every transform component, `cached_model` is ignored
+void entity_builder_add_transform(
+        EntityBuilder *builder, Transform *transform);
+/// gathers the entity's transform components, which it has to have
+void transform_get(World *world, EntityPtr eptr, Transform *out);
+/// writes back every transform component but `WorldTransform`
+void transform_set(World *world, EntityPtr eptr, Transform *transform);
+
+void rotation_from_axis_angle(vec3 axis_angle, versor out);
+void rotation_to_axis_angle(versor rotation, vec3 out);
+
+/// walks the parent chain, prefer `WorldTransform`
 void calculate_model_matrix(
         World *world, EntityPtr eptr, mat4 model_matrix);
 
+/// updates `WorldTransform` and `Bounds` of every entity whose position,
+/// rotation, scale or parent was written, or has an ancestor whose were,
+/// since the previous call. parents are computed first and separate
+/// roots are spread across `pool`. has to run after every simulation
+/// tick.
+void transform_propagate(World *world, ThreadPool *pool);
+/// `transform_propagate` for writes made outside of ticks, such as by
+/// input handlers. has to run before every `render_world`, even on frames
+/// without a tick. it doesn't start a new blend, transforms the latest
+/// tick moved keep blending towards where they are now.
+void transform_propagate_frame(World *world, ThreadPool *pool);
+
+/// `alpha` blends the world matrices written by the latest
+/// `transform_propagate` from their previous value, see
+/// `fixed_step_alpha`. 1 draws the latest state as is.
 void render_world(World /*const*/ *world,
         Camera const *camera,
+        float alpha,
         CommandBuffer *cmdbuf);
 
 void render_setup(EngineContext *engine_context);
+/// frees what `render_setup` set up
+void render_destroy(void);
 
 void entity_move(World *world, EntityPtr eptr, vec3 offset);
 
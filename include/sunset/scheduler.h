@@ -0,0 +1,94 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunset/component_mask.h"
+#include "sunset/ecs.h"
+#include "sunset/ecs_commands.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+typedef struct SystemContext {
+    World *world;
+    /// structural changes go here, they are applied once every system of
+    /// the run finished
+    EcsCommandBuffer *cmdbuf;
+    float dt;
+    size_t worker_index;
+} SystemContext;
+
+/// systems of one run execute concurrently, so a system may only touch
+/// the components it declared. a nested `ecs_par_for` on the scheduler's
+/// pool runs serially on the system's worker, unless the system is
+/// exclusive.
+typedef void (*SystemFn)(SystemContext const *system_context, void *ctx);
+
+typedef struct System {
+    char const *name;
+    SystemFn fn;
+    void *ctx;
+    ComponentMask reads;
+    ComponentMask writes;
+    /// see `scheduler_system_exclusive`
+    bool exclusive;
+
+    /// systems registered later that conflict with this one
+    vector(Index) dependents;
+    size_t num_dependencies;
+
+    /// seconds spent in the last run, and smoothed over recent runs
+    float last_time_s;
+    float avg_time_s;
+} System;
+
+/// runs systems on a `ThreadPool`. two systems conflict when one writes a
+/// component the other reads or writes, conflicting systems run in the
+/// order they were registered and everything else runs concurrently.
+/// exclusive systems split a run into stages that run one after another.
+typedef struct Scheduler {
+    World *world;
+    ThreadPool *pool;
+    vector(System) systems;
+    /// set when systems or their accesses change, the dependency graph is
+    /// rebuilt on the next run
+    bool graph_dirty;
+
+    /// one per pool worker
+    vector(EcsCommandBuffer) cmdbufs;
+
+    // state of the current run, guarded by `lock`
+    pthread_mutex_t lock;
+    pthread_cond_t system_finished;
+    vector(Index) ready;
+    vector(size_t) num_pending;
+    size_t num_finished;
+    /// systems of the current stage
+    size_t num_staged;
+    float dt;
+} Scheduler;
+
+void scheduler_init(Scheduler *scheduler, World *world, ThreadPool *pool);
+void scheduler_destroy(Scheduler *scheduler);
+
+/// `name` isn't copied and has to outlive the scheduler
+Index scheduler_add_system(
+        Scheduler *scheduler, char const *name, SystemFn fn, void *ctx);
+void scheduler_system_reads(
+        Scheduler *scheduler, Index system, Index component_id);
+void scheduler_system_writes(
+        Scheduler *scheduler, Index system, Index component_id);
+/// the system runs on its own on the thread calling `scheduler_run`,
+/// once every system registered before it finished and before any
+/// registered after it starts. its nested `thread_pool_run`s get all of
+/// the scheduler's pool, for systems that spread their own work.
+void scheduler_system_exclusive(Scheduler *scheduler, Index system);
+
+/// runs every system once and blocks until they all finished, then
+/// flushes their command buffers
+void scheduler_run(Scheduler *scheduler, float dt);
+
+System const *scheduler_get_system(
+        Scheduler const *scheduler, Index system);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunset/vector.h"
+
+typedef struct ThreadPool ThreadPool;
+
+/// `worker_index` is in `[0, thread_pool_num_workers(pool))`, the thread
+/// calling `thread_pool_run` is always worker 0.
+typedef void (*TaskFn)(void *ctx, size_t task_index, size_t worker_index);
+
+typedef struct ThreadPoolWorker {
+    ThreadPool *pool;
+    size_t index;
+    pthread_t thread;
+} ThreadPoolWorker;
+
+typedef struct ThreadPool {
+    vector(ThreadPoolWorker) workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+
+    // the batch currently being run, guarded by `lock` except for the
+    // two atomics
+    TaskFn fn;
+    void *ctx;
+    size_t num_tasks;
+    _Atomic size_t next_task;
+    _Atomic size_t tasks_done;
+    size_t active_workers;
+    uint64_t generation;
+    bool stopping;
+} ThreadPool;
+
+/// spawns `num_threads` background threads. `num_threads` may be 0, in
+/// which case every batch runs on the calling thread.
+int thread_pool_init(ThreadPool *pool, size_t num_threads);
+
+void thread_pool_destroy(ThreadPool *pool);
+
+/// background threads plus the calling thread
+size_t thread_pool_num_workers(ThreadPool const *pool);
+
+/// runs `fn` for every task index in `[0, num_tasks)` and blocks until all
+/// of them finished. calling this from inside a task runs the nested batch
+/// serially on the current worker instead of deadlocking.
+void thread_pool_run(
+        ThreadPool *pool, size_t num_tasks, TaskFn fn, void *ctx);
+
+size_t thread_pool_default_num_threads(void);
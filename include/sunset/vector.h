@@ -62,6 +62,19 @@ struct vector_metadata {
         }                                                                  \
     } while (0)
 
+#define vector_shrink_to_fit(v)                                            \
+    do {                                                                   \
+        struct vector_metadata *meta = _vector_metadata(v);                \
+        size_t _new_capacity = meta->size > 0 ? meta->size : 1;            \
+        if (meta->capacity > _new_capacity) {                              \
+            meta = (struct vector_metadata *)sunset_realloc(meta,          \
+                    sizeof(struct vector_metadata)                         \
+                            + sizeof(*(v)) * _new_capacity);               \
+            meta->capacity = _new_capacity;                                \
+            v = (void *)(meta + 1);                                        \
+        }                                                                  \
+    } while (0)
+
 #define PRAGMA_DISABLE_PTR_WARN                                            \
     _Pragma("GCC diagnostic ignored \"-Wsizeof-pointer-memaccess\"");
 
@@ -0,0 +1,263 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "internal/math.h"
+#include "sunset/vector.h"
+
+#include "sunset/blob_arena.h"
+
+static size_t blob_align(size_t size) {
+    return (size + BLOB_ALIGNMENT - 1) & ~(size_t)(BLOB_ALIGNMENT - 1);
+}
+
+void blob_arena_init(BlobArena *arena) {
+    vector_init(arena->data);
+    vector_init(arena->slots);
+    vector_init(arena->owner_heads);
+
+    // `BLOB_REF_NONE`
+    BlobSlot none = {
+            .offset = BLOB_OFFSET_FREE,
+            .owner = BLOB_OWNER_NONE,
+            .next = BLOB_REF_NONE,
+    };
+    vector_append(arena->slots, none);
+
+    arena->free_slots = BLOB_REF_NONE;
+    arena->garbage_size = 0;
+}
+
+void blob_arena_destroy(BlobArena *arena) {
+    vector_destroy(arena->data);
+    vector_destroy(arena->slots);
+    vector_destroy(arena->owner_heads);
+}
+
+/// appends `capacity` zeroed bytes to the data and returns their offset
+static size_t blob_arena_push(BlobArena *arena, size_t capacity) {
+    size_t offset = vector_size(arena->data);
+    size_t data_size = offset + capacity;
+
+    if (data_size > vector_capacity(arena->data)) {
+        size_t data_capacity =
+                max(data_size, vector_capacity(arena->data) * 2);
+        vector_reserve(arena->data, data_capacity);
+    }
+
+    vector_resize(arena->data, data_size);
+
+    return offset;
+}
+
+BlobRef blob_arena_alloc(BlobArena *arena, size_t size, uint32_t owner) {
+    assert(size <= UINT32_MAX);
+
+    BlobRef blob = arena->free_slots;
+
+    if (blob != BLOB_REF_NONE) {
+        arena->free_slots = arena->slots[blob].next;
+    } else {
+        blob = vector_size(arena->slots);
+        size_t num_slots = (size_t)blob + 1;
+        size_t slots_capacity =
+                max(num_slots, vector_capacity(arena->slots) * 2);
+
+        vector_reserve(arena->slots, slots_capacity);
+        vector_resize(arena->slots, num_slots);
+    }
+
+    size_t capacity = blob_align(size);
+
+    BlobSlot *slot = &arena->slots[blob];
+    slot->offset = blob_arena_push(arena, capacity);
+    slot->size = size;
+    slot->capacity = capacity;
+    slot->owner = owner;
+    slot->next = BLOB_REF_NONE;
+
+    if (owner != BLOB_OWNER_NONE) {
+        if (owner >= vector_size(arena->owner_heads)) {
+            size_t num_owners = (size_t)owner + 1;
+            size_t owners_capacity = max(
+                    num_owners, vector_capacity(arena->owner_heads) * 2);
+
+            vector_reserve(arena->owner_heads, owners_capacity);
+            // new heads are zeroed, which is `BLOB_REF_NONE`
+            vector_resize(arena->owner_heads, num_owners);
+        }
+
+        slot->next = arena->owner_heads[owner];
+        arena->owner_heads[owner] = blob;
+    }
+
+    return blob;
+}
+
+/// puts the slot on the free list, it has to be unlinked from its owner
+static void blob_arena_release(BlobArena *arena, BlobRef blob) {
+    arena->garbage_size += arena->slots[blob].capacity;
+
+    arena->slots[blob] = (BlobSlot){
+            .offset = BLOB_OFFSET_FREE,
+            .owner = BLOB_OWNER_NONE,
+            .next = arena->free_slots,
+    };
+    arena->free_slots = blob;
+}
+
+void blob_arena_free(BlobArena *arena, BlobRef blob) {
+    if (blob == BLOB_REF_NONE) {
+        return;
+    }
+
+    uint32_t owner = arena->slots[blob].owner;
+
+    if (owner != BLOB_OWNER_NONE) {
+        // owners only have a handful of blobs, the list is just walked
+        BlobRef *link = &arena->owner_heads[owner];
+
+        while (*link != blob) {
+            link = &arena->slots[*link].next;
+        }
+
+        *link = arena->slots[blob].next;
+    }
+
+    blob_arena_release(arena, blob);
+}
+
+void blob_arena_free_owner(BlobArena *arena, uint32_t owner) {
+    if (owner >= vector_size(arena->owner_heads)) {
+        return;
+    }
+
+    BlobRef blob = arena->owner_heads[owner];
+
+    while (blob != BLOB_REF_NONE) {
+        BlobRef next = arena->slots[blob].next;
+        blob_arena_release(arena, blob);
+        blob = next;
+    }
+
+    arena->owner_heads[owner] = BLOB_REF_NONE;
+}
+
+void *blob_arena_get(BlobArena const *arena, BlobRef blob) {
+    if (blob == BLOB_REF_NONE) {
+        return NULL;
+    }
+
+    return arena->data + arena->slots[blob].offset;
+}
+
+size_t blob_arena_size(BlobArena const *arena, BlobRef blob) {
+    return arena->slots[blob].size;
+}
+
+void blob_arena_resize(BlobArena *arena, BlobRef blob, size_t size) {
+    assert(blob != BLOB_REF_NONE && size <= UINT32_MAX);
+
+    BlobSlot *slot = &arena->slots[blob];
+
+    if (size > slot->capacity) {
+        size_t capacity = blob_align(max(size, (size_t)slot->capacity * 2));
+
+        if (slot->offset + slot->capacity == vector_size(arena->data)) {
+            // the last blob grows in place
+            blob_arena_push(arena, capacity - slot->capacity);
+        } else {
+            size_t offset = blob_arena_push(arena, capacity);
+
+            memcpy(arena->data + offset,
+                    arena->data + slot->offset,
+                    slot->size);
+            arena->garbage_size += slot->capacity;
+            slot->offset = offset;
+        }
+
+        slot->capacity = capacity;
+    }
+
+    if (size > slot->size) {
+        memset(arena->data + slot->offset + slot->size,
+                0,
+                size - slot->size);
+    }
+
+    slot->size = size;
+}
+
+void blob_arena_compact(BlobArena *arena) {
+    size_t data_capacity = vector_size(arena->data) - arena->garbage_size;
+
+    vector(uint8_t) data;
+    vector_init(data);
+    vector_reserve(data, data_capacity);
+
+    for (size_t blob = 1; blob < vector_size(arena->slots); blob++) {
+        BlobSlot *slot = &arena->slots[blob];
+
+        if (slot->offset == BLOB_OFFSET_FREE) {
+            continue;
+        }
+
+        // capacity left over from growing is dropped as well
+        size_t offset = vector_size(data);
+        size_t capacity = blob_align(slot->size);
+        size_t data_size = offset + capacity;
+
+        vector_resize(data, data_size);
+        memcpy(data + offset, arena->data + slot->offset, slot->size);
+
+        slot->offset = offset;
+        slot->capacity = capacity;
+    }
+
+    vector_destroy(arena->data);
+    arena->data = data;
+    arena->garbage_size = 0;
+}
+
+void blob_arena_relink(BlobArena *arena) {
+    vector_clear(arena->owner_heads);
+    arena->free_slots = BLOB_REF_NONE;
+    arena->garbage_size = vector_size(arena->data);
+
+    arena->slots[BLOB_REF_NONE] = (BlobSlot){
+            .offset = BLOB_OFFSET_FREE,
+            .owner = BLOB_OWNER_NONE,
+            .next = BLOB_REF_NONE,
+    };
+
+    // walked backwards so that lower slots end up first in every list
+    for (size_t blob = vector_size(arena->slots) - 1; blob > 0; blob--) {
+        BlobSlot *slot = &arena->slots[blob];
+
+        if (slot->offset == BLOB_OFFSET_FREE) {
+            *slot = (BlobSlot){
+                    .offset = BLOB_OFFSET_FREE,
+                    .owner = BLOB_OWNER_NONE,
+                    .next = arena->free_slots,
+            };
+            arena->free_slots = blob;
+            continue;
+        }
+
+        arena->garbage_size -= slot->capacity;
+        slot->next = BLOB_REF_NONE;
+
+        if (slot->owner == BLOB_OWNER_NONE) {
+            continue;
+        }
+
+        if (slot->owner >= vector_size(arena->owner_heads)) {
+            size_t num_owners = (size_t)slot->owner + 1;
+            vector_resize(arena->owner_heads, num_owners);
+        }
+
+        slot->next = arena->owner_heads[slot->owner];
+        arena->owner_heads[slot->owner] = blob;
+    }
+}
@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "internal/math.h"
+#include "sunset/geometry.h"
+#include "sunset/vector.h"
+
+#include "sunset/broadphase.h"
+
+/// the sweep axis only changes once another one is spread this much more,
+/// so that it doesn't flip back and forth every step
+#define BROADPHASE_AXIS_HYSTERESIS 1.5f
+
+static uint32_t endpoint_proxy(SapEndpoint endpoint) {
+    return endpoint.data >> 1;
+}
+
+static bool endpoint_is_max(SapEndpoint endpoint) {
+    return endpoint.data & 1;
+}
+
+/// min ends sort before max ends at the same value, so touching boxes
+/// are reported like overlapping ones
+static bool endpoint_less(SapEndpoint a, SapEndpoint b) {
+    return a.value < b.value
+            || (a.value == b.value
+                    && endpoint_is_max(b) && !endpoint_is_max(a));
+}
+
+static int compare_endpoints(void const *a, void const *b) {
+    SapEndpoint const *endpoint_a = a;
+    SapEndpoint const *endpoint_b = b;
+
+    if (endpoint_less(*endpoint_a, *endpoint_b)) {
+        return -1;
+    }
+
+    return endpoint_less(*endpoint_b, *endpoint_a);
+}
+
+void broadphase_init(Broadphase *broadphase) {
+    vector_init(broadphase->boxes);
+    vector_init(broadphase->live);
+    vector_init(broadphase->free_proxies);
+
+    broadphase->axis = 0;
+    vector_init(broadphase->endpoints);
+
+    vector_init(broadphase->active);
+    vector_init(broadphase->active_index);
+
+    vector_init(broadphase->pairs);
+}
+
+void broadphase_destroy(Broadphase *broadphase) {
+    vector_destroy(broadphase->boxes);
+    vector_destroy(broadphase->live);
+    vector_destroy(broadphase->free_proxies);
+    vector_destroy(broadphase->endpoints);
+    vector_destroy(broadphase->active);
+    vector_destroy(broadphase->active_index);
+    vector_destroy(broadphase->pairs);
+}
+
+uint32_t broadphase_add(Broadphase *broadphase, AABB const *box) {
+    uint32_t proxy;
+
+    if (!vector_empty(broadphase->free_proxies)) {
+        proxy = vector_pop_back(broadphase->free_proxies);
+        broadphase->boxes[proxy] = *box;
+        broadphase->live[proxy] = true;
+    } else {
+        proxy = vector_size(broadphase->boxes);
+        vector_append(broadphase->boxes, *box);
+        vector_append(broadphase->live, true);
+        vector_append(broadphase->active_index, 0);
+    }
+
+    // sorted into place by the next `broadphase_find_pairs`
+    size_t axis = broadphase->axis;
+    SapEndpoint min_end = {.value = box->min[axis], .data = proxy << 1};
+    SapEndpoint max_end = {
+            .value = box->max[axis],
+            .data = proxy << 1 | 1,
+    };
+
+    vector_append(broadphase->endpoints, min_end);
+    vector_append(broadphase->endpoints, max_end);
+
+    return proxy;
+}
+
+void broadphase_remove(Broadphase *broadphase, uint32_t proxy) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i < vector_size(broadphase->endpoints); i++) {
+        SapEndpoint endpoint = broadphase->endpoints[i];
+
+        if (endpoint_proxy(endpoint) != proxy) {
+            broadphase->endpoints[kept++] = endpoint;
+        }
+    }
+
+    vector_resize(broadphase->endpoints, kept);
+
+    broadphase->live[proxy] = false;
+    vector_append(broadphase->free_proxies, proxy);
+}
+
+void broadphase_update(
+        Broadphase *broadphase, uint32_t proxy, AABB const *box) {
+    broadphase->boxes[proxy] = *box;
+}
+
+/// axis along which the box centers vary the most
+static size_t broadphase_pick_axis(Broadphase const *broadphase) {
+    float sum[3] = {0};
+    float sum_squared[3] = {0};
+    size_t count = 0;
+
+    for (size_t i = 0; i < vector_size(broadphase->boxes); i++) {
+        AABB const *box = &broadphase->boxes[i];
+
+        if (!broadphase->live[i]) {
+            continue;
+        }
+
+        for (size_t axis = 0; axis < 3; axis++) {
+            float center = 0.5f * (box->min[axis] + box->max[axis]);
+
+            sum[axis] += center;
+            sum_squared[axis] += center * center;
+        }
+
+        count++;
+    }
+
+    if (count == 0) {
+        return broadphase->axis;
+    }
+
+    float variance[3];
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        float mean = sum[axis] / count;
+        variance[axis] = sum_squared[axis] / count - mean * mean;
+    }
+
+    size_t best = broadphase->axis;
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        if (variance[axis]
+                > variance[best] * BROADPHASE_AXIS_HYSTERESIS) {
+            best = axis;
+        }
+    }
+
+    return best;
+}
+
+static void broadphase_sort(Broadphase *broadphase) {
+    size_t axis = broadphase_pick_axis(broadphase);
+    bool axis_changed = axis != broadphase->axis;
+
+    broadphase->axis = axis;
+
+    SapEndpoint *endpoints = broadphase->endpoints;
+    size_t num_endpoints = vector_size(endpoints);
+
+    for (size_t i = 0; i < num_endpoints; i++) {
+        AABB const *box = &broadphase->boxes[endpoint_proxy(endpoints[i])];
+
+        endpoints[i].value = endpoint_is_max(endpoints[i])
+                ? box->max[axis]
+                : box->min[axis];
+    }
+
+    // the order along another axis says nothing about this one
+    if (axis_changed) {
+        qsort(endpoints,
+                num_endpoints,
+                sizeof(SapEndpoint),
+                compare_endpoints);
+        return;
+    }
+
+    for (size_t i = 1; i < num_endpoints; i++) {
+        SapEndpoint endpoint = endpoints[i];
+        size_t j = i;
+
+        while (j > 0 && endpoint_less(endpoint, endpoints[j - 1])) {
+            endpoints[j] = endpoints[j - 1];
+            j--;
+        }
+
+        endpoints[j] = endpoint;
+    }
+}
+
+static bool boxes_overlap(AABB const *a, AABB const *b, size_t skip_axis) {
+    for (size_t axis = 0; axis < 3; axis++) {
+        if (axis != skip_axis
+                && (a->max[axis] < b->min[axis]
+                        || a->min[axis] > b->max[axis])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void broadphase_find_pairs(Broadphase *broadphase) {
+    broadphase_sort(broadphase);
+
+    vector_clear(broadphase->pairs);
+    vector_clear(broadphase->active);
+
+    for (size_t i = 0; i < vector_size(broadphase->endpoints); i++) {
+        SapEndpoint endpoint = broadphase->endpoints[i];
+        uint32_t proxy = endpoint_proxy(endpoint);
+
+        if (endpoint_is_max(endpoint)) {
+            uint32_t index = broadphase->active_index[proxy];
+            uint32_t last = vector_pop_back(broadphase->active);
+
+            broadphase->active[index] = last;
+            broadphase->active_index[last] = index;
+            continue;
+        }
+
+        AABB const *box = &broadphase->boxes[proxy];
+
+        // every active box overlaps this one along the sweep axis
+        for (size_t j = 0; j < vector_size(broadphase->active); j++) {
+            uint32_t other = broadphase->active[j];
+
+            if (boxes_overlap(
+                        box, &broadphase->boxes[other], broadphase->axis)) {
+                BroadphasePair pair = {
+                        .a = min(proxy, other),
+                        .b = max(proxy, other),
+                };
+
+                vector_append(broadphase->pairs, pair);
+            }
+        }
+
+        broadphase->active_index[proxy] = vector_size(broadphase->active);
+        vector_append(broadphase->active, proxy);
+    }
+}
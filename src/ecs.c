@@ -4,294 +4,2509 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "sunset/bitmask.h"
+#ifdef SUNSET_ECS_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
+#include "internal/math.h"
+#include "internal/utils.h"
+#include "sunset/crc64.h"
+#include "sunset/errors.h"
+#include "sunset/io.h"
+#include "sunset/map.h"
+#include "sunset/thread_pool.h"
 #include "sunset/vector.h"
+#include "sunset/vfs.h"
 
 #include "sunset/ecs.h"
 
-static size_t archetype_num_columns(Archetype const *archetype) {
-    return bitmask_popcount(&archetype->mask);
+#define ARCHETYPE_LOOKUP_INITIAL_SIZE 64
+
+#define WORLD_FILE_MAGIC 0x44574e53 // "SNWD"
+#define WORLD_FILE_VERSION 4
+/// alignment of every column blob in a world file, so that its pages can
+/// be used in place
+#define WORLD_FILE_ALIGNMENT ECS_PAGE_ALIGNMENT
+
+static size_t archetype_lookup_probe(World const *world,
+        ComponentMask const *mask,
+        uint64_t hash,
+        size_t *slot_out) {
+    size_t slot_mask = vector_size(world->archetype_lookup) - 1;
+    size_t slot = hash & slot_mask;
+
+    while (true) {
+        ArchetypeSlot const *entry = &world->archetype_lookup[slot];
+
+        if (entry->index == 0) {
+            *slot_out = slot;
+            return SIZE_MAX;
+        }
+
+        if (entry->hash == hash
+                && cmask_is_eql(
+                        &world->archetypes[entry->index - 1].mask, mask)) {
+            *slot_out = slot;
+            return entry->index - 1;
+        }
+
+        slot = (slot + 1) & slot_mask;
+    }
 }
 
-static Archetype *get_archetype(World *world, Bitmask const *mask) {
-    for (size_t i = 0; i < vector_size(world->archetypes); i++) {
-        Archetype *archetype = &world->archetypes[i];
-        if (bitmask_is_eql(&archetype->mask, mask)) {
-            return archetype;
+static void archetype_lookup_grow(World *world) {
+    vector(ArchetypeSlot) old_lookup = world->archetype_lookup;
+    size_t new_size = vector_size(old_lookup) * 2;
+
+    vector_init(world->archetype_lookup);
+    vector_resize(world->archetype_lookup, new_size);
+
+    for (size_t i = 0; i < vector_size(old_lookup); i++) {
+        ArchetypeSlot entry = old_lookup[i];
+
+        if (entry.index == 0) {
+            continue;
         }
+
+        size_t slot = entry.hash & (new_size - 1);
+        while (world->archetype_lookup[slot].index != 0) {
+            slot = (slot + 1) & (new_size - 1);
+        }
+
+        world->archetype_lookup[slot] = entry;
     }
 
-    return NULL;
+    vector_destroy(old_lookup);
 }
 
-static void iterator_advance_archetype(WorldIterator *iterator) {
-    while (iterator->current_archetype
-            < vector_size(iterator->world->archetypes)) {
-        Archetype *archetype =
-                &iterator->world->archetypes[iterator->current_archetype];
+static void archetype_lookup_insert(
+        World *world, size_t archetype_index, uint64_t hash) {
+    // keep the load factor under 1/2 so probe sequences stay short
+    if ((vector_size(world->archetypes) + 1) * 2
+            > vector_size(world->archetype_lookup)) {
+        archetype_lookup_grow(world);
+    }
 
-        if (!bitmask_is_superset(&archetype->mask, &iterator->mask)) {
-            iterator->current_archetype++;
-        } else {
-            break;
-        }
+    size_t slot;
+    size_t existing = archetype_lookup_probe(
+            world, &world->archetypes[archetype_index].mask, hash, &slot);
+    assert(existing == SIZE_MAX);
+    unused(existing);
+
+    world->archetype_lookup[slot] = (ArchetypeSlot){
+            .hash = hash,
+            .index = archetype_index + 1,
+    };
+}
+
+/// returns the index of the archetype with exactly `mask`, or `SIZE_MAX`
+static size_t get_archetype(
+        World const *world, ComponentMask const *mask) {
+    size_t slot;
+    return archetype_lookup_probe(world, mask, cmask_hash(mask), &slot);
+}
+
+static Column *archetype_get_column(
+        Archetype const *archetype, size_t component_id) {
+    assert(component_id < ECS_MAX_COMPONENTS);
+
+    uint16_t column_index = archetype->column_index[component_id];
+
+    if (column_index == ECS_COLUMN_NONE) {
+        return NULL;
     }
+
+    return &archetype->columns[column_index];
 }
 
-size_t _ecs_register_component(World *world,
-        size_t component_size,
-        [[maybe_unused]] char const *component_name) {
-    assert(vector_size(world->component_sizes) < ECS_MAX_COMPONENTS);
+static inline void *column_get_row(Column const *column, size_t row) {
+    return column->pages[row / ECS_PAGE_ROWS]
+            + (row % ECS_PAGE_ROWS) * column->element_size;
+}
 
-#ifdef SUNSET_REFLECTION
-    vector_append(world->component_names, component_name);
-#endif
+static_assert(ECS_PAGE_ROWS % ECS_PAGE_ALIGNMENT == 0
+                && (ECS_PAGE_ROWS & (ECS_PAGE_ROWS - 1)) == 0,
+        "ECS_PAGE_ROWS has to be a power of two multiple of 64");
 
-    vector_append(world->component_sizes, component_size);
-    return vector_size(world->component_sizes) - 1;
+static size_t column_page_size(Column const *column) {
+    return max(ECS_PAGE_ROWS * column->element_size,
+            (size_t)ECS_PAGE_ALIGNMENT);
 }
 
-void ecs_init(World *world) {
-    vector_init(world->archetypes);
-    vector_init(world->component_sizes);
-    vector_init(world->entity_ptrs);
-    vector_init(world->free_ids);
+static uint8_t *column_alloc_page(Column const *column) {
+    size_t page_size = column_page_size(column);
+
+#ifdef SUNSET_ECS_HUGE_PAGES
+    if (page_size >= ECS_HUGE_PAGE_SIZE) {
+        page_size = (page_size + ECS_HUGE_PAGE_SIZE - 1)
+                & ~(size_t)(ECS_HUGE_PAGE_SIZE - 1);
+
+        uint8_t *page =
+                sunset_memory(aligned_alloc, ECS_HUGE_PAGE_SIZE, page_size);
+        // only a hint, the page works the same without it
+        madvise(page, page_size, MADV_HUGEPAGE);
+
+        return page;
+    }
+#endif
+
+    return sunset_memory(aligned_alloc, ECS_PAGE_ALIGNMENT, page_size);
 }
 
-void ecs_destroy(World *world) {
-    for (size_t i = 0; i < vector_size(world->archetypes); i++) {
-        Archetype *archetype = &world->archetypes[i];
-        bitmask_destroy(&archetype->mask);
-        for (size_t j = 0; j < vector_size(archetype->columns); j++) {
-            vector_destroy(archetype->columns[j].data);
+/// drops every page past the first `num_pages`, pages borrowed from a save
+/// file mapping are just forgotten
+static void column_truncate_pages(Column *column, size_t num_pages) {
+    for (size_t i = num_pages; i < vector_size(column->pages); i++) {
+        if (i >= column->num_borrowed_pages) {
+            free(column->pages[i]);
         }
-        vector_destroy(archetype->columns);
     }
-    vector_destroy(world->archetypes);
-    vector_destroy(world->component_sizes);
-    vector_destroy(world->entity_ptrs);
-    vector_destroy(world->free_ids);
+
+    if (num_pages < vector_size(column->pages)) {
+        vector_resize(column->pages, num_pages);
+    }
+
+    column->num_borrowed_pages = min(column->num_borrowed_pages, num_pages);
+    vector_shrink_to_fit(column->pages);
 }
 
-WorldIterator worldit_create(World const *world, Bitmask mask) {
-    WorldIterator iterator = {
-            .world = world,
-            .mask = mask,
-            .current_archetype = 0,
-            .current_element = 0,
-    };
-    iterator_advance_archetype(&iterator);
-    return iterator;
+static void column_destroy(Column *column) {
+    column_truncate_pages(column, 0);
+    vector_destroy(column->pages);
+    vector_destroy(column->row_ticks);
 }
 
-void worldit_advance(WorldIterator *iterator) {
-    if (iterator->current_element + 1
-            < iterator->world->archetypes[iterator->current_archetype]
-                    .num_elements) {
-        iterator->current_element++;
-    } else {
-        iterator->current_archetype++;
-        iterator->current_element = 0;
-        iterator_advance_archetype(iterator);
+static void sparse_set_init(SparseSet *set, size_t element_size) {
+    set->element_size = element_size;
+    vector_init(set->sparse);
+    vector_init(set->entities);
+    vector_init(set->data);
+    vector_init(set->ticks);
+    set->changed_tick = 0;
+}
+
+static void sparse_set_destroy(SparseSet *set) {
+    vector_destroy(set->sparse);
+    vector_destroy(set->entities);
+    vector_destroy(set->data);
+    vector_destroy(set->ticks);
+}
+
+/// returns the entity's position in `set->entities`, or `SIZE_MAX`; the
+/// sets of table components are never set up and hold nothing
+static size_t sparse_set_find(SparseSet const *set, Index entity_id) {
+    if (!set->sparse || entity_id >= vector_size(set->sparse)) {
+        return SIZE_MAX;
     }
+
+    return (size_t)set->sparse[entity_id] - 1;
 }
 
-bool worldit_is_valid(WorldIterator const *iterator) {
-    return iterator->current_archetype
-            < vector_size(iterator->world->archetypes);
+static void *sparse_set_get(SparseSet const *set, Index entity_id) {
+    size_t position = sparse_set_find(set, entity_id);
+
+    if (position == SIZE_MAX) {
+        return NULL;
+    }
+
+    return set->data + position * set->element_size;
 }
 
-void *worldit_get_component(WorldIterator *iterator, Index component_id) {
-    Archetype *archetype =
-            &iterator->world->archetypes[iterator->current_archetype];
+/// adds a zeroed element stamped with `tick` unless the entity already
+/// has one, and returns the entity's element
+static void *sparse_set_insert(
+        SparseSet *set, Index entity_id, uint32_t tick) {
+    void *existing = sparse_set_get(set, entity_id);
 
-    size_t column_index = SIZE_MAX;
-    size_t num_columns = archetype_num_columns(archetype);
-    for (size_t i = 0; i < num_columns; i++) {
-        if (bitmask_is_set(&archetype->columns[i].mask, component_id)) {
-            column_index = i;
-            break;
-        }
+    if (existing) {
+        return existing;
     }
 
-    if (column_index == SIZE_MAX) {
-        return NULL;
+    // grown geometrically, `vector_resize` alone reallocates every time.
+    // new slots and elements are zeroed by the resize
+    if (entity_id >= vector_size(set->sparse)) {
+        size_t sparse_size = entity_id + 1;
+        size_t sparse_capacity =
+                max(sparse_size, vector_capacity(set->sparse) * 2);
+
+        vector_reserve(set->sparse, sparse_capacity);
+        vector_resize(set->sparse, sparse_size);
+    }
+
+    size_t position = vector_size(set->entities);
+    size_t data_size = (position + 1) * set->element_size;
+
+    if (data_size > vector_capacity(set->data)) {
+        size_t data_capacity =
+                max(data_size, vector_capacity(set->data) * 2);
+        vector_reserve(set->data, data_capacity);
     }
 
-    Column *column = &archetype->columns[column_index];
+    vector_append(set->entities, entity_id);
+    vector_append(set->ticks, tick);
+    vector_resize(set->data, data_size);
 
-    return &column->data[iterator->current_element * column->element_size];
+    set->sparse[entity_id] = position + 1;
+    set->changed_tick = tick;
+
+    return set->data + position * set->element_size;
 }
 
-EntityPtr worldit_get_entityptr(WorldIterator *iterator) {
-    return (EntityPtr){.archetype = iterator->current_archetype,
-            .element = iterator->current_element};
+static void sparse_set_remove(SparseSet *set, Index entity_id) {
+    size_t position = sparse_set_find(set, entity_id);
+
+    if (position == SIZE_MAX) {
+        return;
+    }
+
+    size_t last = vector_size(set->entities) - 1;
+
+    if (position != last) {
+        Index moved = set->entities[last];
+
+        memcpy(set->data + position * set->element_size,
+                set->data + last * set->element_size,
+                set->element_size);
+        set->entities[position] = moved;
+        set->ticks[position] = set->ticks[last];
+        set->sparse[moved] = position + 1;
+    }
+
+    size_t data_size = last * set->element_size;
+
+    vector_pop_back(set->entities);
+    vector_pop_back(set->ticks);
+    vector_resize(set->data, data_size);
+
+    set->sparse[entity_id] = 0;
 }
 
-void worldit_destroy(WorldIterator *iterator) {
-    bitmask_destroy(&iterator->mask);
+static Order compare_shared_keys(void const *a, void const *b) {
+    SharedKey const *key_a = a;
+    SharedKey const *key_b = b;
+
+    if (key_a->hash < key_b->hash) {
+        return ORDER_LESS_THAN;
+    }
+
+    if (key_a->hash > key_b->hash) {
+        return ORDER_GREATER_THAN;
+    }
+
+    return ORDER_EQUAL;
 }
 
-void archetype_init(World *world, Bitmask mask, Archetype *archetype_out) {
-    archetype_out->mask = mask;
-    archetype_out->num_elements = 0;
+static void *shared_table_get(SharedTable const *table, SharedRef ref) {
+    return table->values + (size_t)ref * table->element_size;
+}
 
-    vector_init(archetype_out->columns);
-    // a bitmask might be better if we expect many additions/deletions
-    vector_init(archetype_out->free_elems);
+static void shared_table_init(SharedTable *table, size_t element_size) {
+    table->element_size = element_size;
+    vector_init(table->values);
+    vector_init(table->refcounts);
+    vector_init(table->free_refs);
+    map_init(table->lookup);
 
-    for (size_t i = 0; i < ECS_MAX_COMPONENTS; i++) {
-        if (bitmask_is_set(&mask, i)) {
-            vector_resize(archetype_out->columns,
-                    vector_size(archetype_out->columns) + 1);
+    // `SHARED_REF_ZERO`, zeroed by the resize
+    vector_resize(table->values, element_size);
+    vector_append(table->refcounts, 0);
 
-            Column *column = vector_back(archetype_out->columns);
+    SharedKey key = {
+            .hash = crc64(table->values, element_size),
+            .ref = SHARED_REF_ZERO,
+    };
+    map_insert(table->lookup, key, compare_shared_keys);
+}
 
-            bitmask_init_empty(ECS_MAX_COMPONENTS, &column->mask);
-            bitmask_set(&column->mask, i);
+static void shared_table_destroy(SharedTable *table) {
+    vector_destroy(table->values);
+    vector_destroy(table->refcounts);
+    vector_destroy(table->free_refs);
+    vector_destroy(table->lookup);
+}
+
+/// returns the handle of the value equal to `value`, adding it if there
+/// is none, and counts one more reference to it
+static SharedRef shared_table_intern(
+        SharedTable *table, void const *value) {
+    SharedKey key = {.hash = crc64(value, table->element_size)};
+    SharedKey *existing =
+            map_get(table->lookup, key, compare_shared_keys);
 
-            column->element_size = world->component_sizes[i];
-            vector_init(column->data);
+    if (existing
+            && memcmp(shared_table_get(table, existing->ref),
+                       value,
+                       table->element_size)
+                    == 0) {
+        if (existing->ref != SHARED_REF_ZERO) {
+            table->refcounts[existing->ref]++;
         }
+
+        return existing->ref;
     }
-}
 
-Index ecs_add_entity(World *world, Bitmask mask) {
-    uint32_t entity_id = vector_size(world->free_ids) > 0
-            ? vector_pop_back(world->free_ids)
-            : vector_size(world->entity_ptrs);
+    SharedRef ref;
 
-    Archetype *archetype = get_archetype(world, &mask);
+    if (!vector_empty(table->free_refs)) {
+        ref = vector_pop_back(table->free_refs);
+    } else {
+        ref = vector_size(table->refcounts);
+        size_t values_size = ((size_t)ref + 1) * table->element_size;
+
+        if (values_size > vector_capacity(table->values)) {
+            size_t values_capacity =
+                    max(values_size, vector_capacity(table->values) * 2);
+            vector_reserve(table->values, values_capacity);
+        }
 
-    if (!archetype) {
-        vector_resize(
-                world->archetypes, vector_size(world->archetypes) + 1);
-        archetype = vector_back(world->archetypes);
-        archetype_init(world, mask, archetype);
+        vector_resize(table->values, values_size);
+        vector_append(table->refcounts, 0);
     }
 
-    size_t element_index = vector_empty(archetype->free_elems)
-            ? archetype->num_elements++
-            : vector_pop_back(archetype->free_elems);
+    memcpy(shared_table_get(table, ref), value, table->element_size);
+    table->refcounts[ref] = 1;
 
-    if (entity_id >= vector_size(world->entity_ptrs)) {
-        vector_resize(world->entity_ptrs, entity_id + 1);
+    if (!existing) {
+        key.ref = ref;
+        map_insert(table->lookup, key, compare_shared_keys);
     }
 
-    world->entity_ptrs[entity_id] = (EntityPtr){
-            .archetype = archetype - world->archetypes,
-            .element = element_index,
+    return ref;
+}
+
+static void shared_table_release(SharedTable *table, SharedRef ref) {
+    if (ref == SHARED_REF_ZERO || --table->refcounts[ref] > 0) {
+        return;
+    }
+
+    SharedKey key = {
+            .hash = crc64(
+                    shared_table_get(table, ref), table->element_size),
     };
+    SharedKey *entry = map_get(table->lookup, key, compare_shared_keys);
 
-    for (size_t i = 0; i < vector_size(archetype->columns); i++) {
-        Column *column = &archetype->columns[i];
-        vector_resize(column->data,
-                archetype->num_elements * column->element_size);
+    if (entry && entry->ref == ref) {
+        map_remove(table->lookup, key, compare_shared_keys);
     }
 
-    return entity_id;
+    vector_append(table->free_refs, ref);
 }
 
-void ecs_remove_entity(World *world, uint32_t entity_id) {
-    EntityPtr *eptr = &world->entity_ptrs[entity_id];
+/// rebuilds the free list and lookup of a table whose values and
+/// reference counts were loaded
+static void shared_table_rebuild(SharedTable *table) {
+    vector_clear(table->free_refs);
+    vector_clear(table->lookup);
 
-    vector_append(
-            world->archetypes[eptr->archetype].free_elems, eptr->element);
+    for (SharedRef ref = 0; ref < vector_size(table->refcounts); ref++) {
+        if (ref != SHARED_REF_ZERO && table->refcounts[ref] == 0) {
+            vector_append(table->free_refs, ref);
+            continue;
+        }
 
-    world->entity_ptrs[entity_id].element = -1;
-    world->entity_ptrs[entity_id].archetype = -1;
+        SharedKey key = {
+                .hash = crc64(
+                        shared_table_get(table, ref), table->element_size),
+                .ref = ref,
+        };
 
-    vector_append(world->free_ids, entity_id);
+        if (!map_get(table->lookup, key, compare_shared_keys)) {
+            map_insert(table->lookup, key, compare_shared_keys);
+        }
+    }
 }
 
-void entity_builder_init(EntityBuilder *builder, World *world) {
-    builder->world = world;
-    bitmask_init_empty(ECS_MAX_COMPONENTS, &builder->mask);
-    vector_init(builder->components);
-    vector_init(builder->component_ids);
+static bool component_is_sparse(World const *world, Index component_id) {
+    return cmask_is_set(&world->sparse_components, component_id);
 }
 
-void entity_builder_destroy(EntityBuilder *builder) {
-    bitmask_destroy(&builder->mask);
-    for (size_t i = 0; i < vector_size(builder->components); i++) {
-        free(builder->components[i]);
+static bool component_is_shared(World const *world, Index component_id) {
+    return cmask_is_set(&world->shared_components, component_id);
+}
+
+/// size of a row of the component's columns
+static size_t column_element_size(World const *world, Index component_id) {
+    return component_is_shared(world, component_id)
+            ? sizeof(SharedRef)
+            : world->component_sizes[component_id];
+}
+
+/// a row's component, resolving the handles of shared components
+static void *column_get_component(
+        World const *world, Column const *column, size_t row) {
+    void *element = column_get_row(column, row);
+
+    if (!component_is_shared(world, column->component_id)) {
+        return element;
     }
-    vector_destroy(builder->components);
-    vector_destroy(builder->component_ids);
+
+    return shared_table_get(&world->shared_tables[column->component_id],
+            *(SharedRef *)element);
 }
 
-void entity_builder_add(
-        EntityBuilder *builder, size_t id, void *component) {
-    bitmask_set(&builder->mask, id);
+/// drops the references of the row's shared components, except those in
+/// `keep`
+static void row_release_shared(World *world,
+        Archetype const *archetype,
+        size_t row,
+        ComponentMask const *keep) {
+    ComponentMask shared =
+            cmask_and(&archetype->mask, &world->shared_components);
+    ComponentMask released = cmask_without(&shared, keep);
+
+    for (size_t id = cmask_next(&released, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(&released, id + 1)) {
+        Column *column = archetype_get_column(archetype, id);
 
-    void *component_copy =
-            sunset_malloc(builder->world->component_sizes[id]);
-    memcpy(component_copy, component, builder->world->component_sizes[id]);
+        shared_table_release(&world->shared_tables[id],
+                *(SharedRef *)column_get_row(column, row));
+    }
+}
 
-    vector_append(builder->components, component_copy);
-    vector_append(builder->component_ids, id);
+static bool mask_has_sparse(World const *world, ComponentMask const *mask) {
+    return cmask_intersects(mask, &world->sparse_components);
 }
 
-Index entity_builder_finish(EntityBuilder *builder) {
-    Index entity_id = ecs_add_entity(builder->world, builder->mask);
+/// whether an archetype has every table component of `mask`, sparse
+/// components have to be checked per entity with `entity_has_sparse`
+static bool archetype_matches(World const *world,
+        Archetype const *archetype,
+        ComponentMask const *mask) {
+    ComponentMask table = cmask_without(mask, &world->sparse_components);
 
-    EntityPtr *eptr = &builder->world->entity_ptrs[entity_id];
-    Archetype *archetype = &builder->world->archetypes[eptr->archetype];
+    return cmask_is_superset(&archetype->mask, &table);
+}
 
-    for (size_t i = 0; i < vector_size(builder->components); i++) {
-        size_t component_id = builder->component_ids[i];
-        void *component_data = builder->components[i];
+/// whether the entity has every sparse component of `mask`
+static bool entity_has_sparse(
+        World const *world, ComponentMask const *mask, Index entity_id) {
+    ComponentMask sparse = cmask_and(mask, &world->sparse_components);
 
-        Column *column = NULL;
-        for (size_t j = 0; j < vector_size(archetype->columns); ++j) {
-            if (bitmask_is_set(&archetype->columns[j].mask, component_id)) {
-                column = &archetype->columns[j];
-                break;
-            }
+    for (size_t id = cmask_next(&sparse, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(&sparse, id + 1)) {
+        if (sparse_set_find(&world->sparse_sets[id], entity_id)
+                == SIZE_MAX) {
+            return false;
         }
+    }
+
+    return true;
+}
 
-        assert(column && "columns should've been added earlier");
+/// whether the entity has any sparse component of `mask`
+static bool entity_has_any_sparse(
+        World const *world, ComponentMask const *mask, Index entity_id) {
+    ComponentMask sparse = cmask_and(mask, &world->sparse_components);
 
-        memcpy(&column->data[eptr->element * column->element_size],
-                component_data,
-                column->element_size);
+    for (size_t id = cmask_next(&sparse, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(&sparse, id + 1)) {
+        if (sparse_set_find(&world->sparse_sets[id], entity_id)
+                != SIZE_MAX) {
+            return true;
+        }
     }
 
-    vector_destroy(builder->components);
-    vector_destroy(builder->component_ids);
+    return false;
+}
+
+/// whether an archetype may have rows matched by `query`. terms on
+/// sparse components can't rule it out, see `query_row_matches`
+static bool archetype_matches_query(World const *world,
+        Archetype const *archetype,
+        Query const *query) {
+    ComponentMask without =
+            cmask_without(&query->without, &world->sparse_components);
 
-    return entity_id;
+    return archetype_matches(world, archetype, &query->mask)
+            && !cmask_intersects(&archetype->mask, &without)
+            && (cmask_is_zero(&query->any_of)
+                    || cmask_intersects(&archetype->mask, &query->any_of)
+                    || mask_has_sparse(world, &query->any_of));
 }
 
-void *ecs_component_from_ptr(
-        World *world, EntityPtr eptr, Index component_id) {
-    Archetype *archetype = &world->archetypes[eptr.archetype];
+/// whether rows of a matched archetype still have to be checked one by
+/// one with `query_row_matches`
+static bool query_has_row_terms(World const *world,
+        Archetype const *archetype,
+        Query const *query) {
+    return mask_has_sparse(world, &query->mask)
+            || mask_has_sparse(world, &query->without)
+            || (!cmask_is_zero(&query->any_of)
+                    && !cmask_intersects(
+                            &archetype->mask, &query->any_of));
+}
 
-    if (!bitmask_is_set(&archetype->mask, component_id)) {
-        return NULL;
+static bool query_row_matches(World const *world,
+        Archetype const *archetype,
+        Query const *query,
+        Index entity_id) {
+    if (!entity_has_sparse(world, &query->mask, entity_id)
+            || entity_has_any_sparse(world, &query->without, entity_id)) {
+        return false;
     }
 
-    for (size_t i = 0; i < vector_size(archetype->columns); i++) {
-        if (bitmask_is_set(&archetype->columns[i].mask, component_id)) {
-            Column *column = &archetype->columns[i];
-            return column->data + eptr.element * column->element_size;
+    return cmask_is_zero(&query->any_of)
+            || cmask_intersects(&archetype->mask, &query->any_of)
+            || entity_has_any_sparse(world, &query->any_of, entity_id);
+}
+
+/// adds a zeroed element of every sparse component in `mask`
+static void entity_add_sparse(
+        World *world, ComponentMask const *mask, Index entity_id) {
+    ComponentMask sparse = cmask_and(mask, &world->sparse_components);
+
+    for (size_t id = cmask_next(&sparse, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(&sparse, id + 1)) {
+        sparse_set_insert(
+                &world->sparse_sets[id], entity_id, world->change_tick);
+    }
+}
+
+static void iterator_advance_archetype(WorldIterator *iterator) {
+    if (iterator->query) {
+        Query const *query = iterator->query;
+
+        while (iterator->current_match < vector_size(query->archetypes)) {
+            size_t archetype_index =
+                    query->archetypes[iterator->current_match];
+
+            if (iterator->world->archetypes[archetype_index].num_elements
+                    > 0) {
+                iterator->current_archetype = archetype_index;
+                return;
+            }
+
+            iterator->current_match++;
         }
+
+        iterator->current_archetype = SIZE_MAX;
+        return;
     }
 
-    return NULL;
+    while (iterator->current_archetype
+            < vector_size(iterator->world->archetypes)) {
+        Archetype *archetype =
+                &iterator->world->archetypes[iterator->current_archetype];
+
+        if (archetype->num_elements == 0
+                || !archetype_matches(
+                        iterator->world, archetype, &iterator->mask)) {
+            iterator->current_archetype++;
+        } else {
+            break;
+        }
+    }
 }
 
-void *ecs_get_component(
-        World *world, uint32_t entity_id, uint32_t component_id) {
-    if (entity_id >= vector_size(world->entity_ptrs)) {
-        return NULL;
+size_t _ecs_register_component(World *world,
+        size_t component_size,
+        [[maybe_unused]] char const *component_name,
+        ComponentStorage storage) {
+    assert(vector_size(world->component_sizes) < ECS_MAX_COMPONENTS);
+
+#ifdef SUNSET_REFLECTION
+    vector_append(world->component_names, component_name);
+#endif
+
+    size_t component_id = vector_size(world->component_sizes);
+    size_t num_components = component_id + 1;
+
+    vector_append(world->component_sizes, component_size);
+    // indexed by component id, only the entries of sparse and shared
+    // components are set up
+    vector_resize(world->sparse_sets, num_components);
+    vector_resize(world->shared_tables, num_components);
+
+    if (storage == COMPONENT_STORAGE_SPARSE) {
+        sparse_set_init(&world->sparse_sets[component_id], component_size);
+        cmask_set(&world->sparse_components, component_id);
+    } else if (storage == COMPONENT_STORAGE_SHARED) {
+        shared_table_init(
+                &world->shared_tables[component_id], component_size);
+        cmask_set(&world->shared_components, component_id);
     }
 
-    EntityPtr eptr = world->entity_ptrs[entity_id];
+    return component_id;
+}
 
-    return ecs_component_from_ptr(world, eptr, component_id);
+void ecs_init(World *world) {
+    vector_init(world->archetypes);
+    vector_init(world->archetype_lookup);
+    vector_resize(world->archetype_lookup, ARCHETYPE_LOOKUP_INITIAL_SIZE);
+    vector_init(world->component_sizes);
+    vector_init(world->entity_ptrs);
+    vector_init(world->generations);
+    vector_init(world->free_ids);
+    vector_init(world->sparse_sets);
+    world->sparse_components = cmask_empty();
+    vector_init(world->shared_tables);
+    world->shared_components = cmask_empty();
+    blob_arena_init(&world->blobs);
+    // queries start out with a last run of 0, so everything that exists
+    // before their first run counts as changed
+    world->change_tick = 1;
+    world->mapping = NULL;
+    world->mapping_size = 0;
+}
+
+void ecs_destroy(World *world) {
+    for (size_t i = 0; i < vector_size(world->archetypes); i++) {
+        Archetype *archetype = &world->archetypes[i];
+        for (size_t j = 0; j < vector_size(archetype->columns); j++) {
+            column_destroy(&archetype->columns[j]);
+        }
+        vector_destroy(archetype->columns);
+        vector_destroy(archetype->entities);
+        vector_destroy(archetype->edges);
+    }
+    vector_destroy(world->archetypes);
+    vector_destroy(world->archetype_lookup);
+    vector_destroy(world->component_sizes);
+    vector_destroy(world->entity_ptrs);
+    vector_destroy(world->generations);
+    vector_destroy(world->free_ids);
+
+    ComponentMask const *sparse = &world->sparse_components;
+
+    for (size_t id = cmask_next(sparse, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(sparse, id + 1)) {
+        sparse_set_destroy(&world->sparse_sets[id]);
+    }
+    vector_destroy(world->sparse_sets);
+
+    ComponentMask const *shared = &world->shared_components;
+
+    for (size_t id = cmask_next(shared, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(shared, id + 1)) {
+        shared_table_destroy(&world->shared_tables[id]);
+    }
+    vector_destroy(world->shared_tables);
+    blob_arena_destroy(&world->blobs);
+
+    if (world->mapping) {
+        vfs_munmap(world->mapping, world->mapping_size);
+        world->mapping = NULL;
+    }
+}
+
+void query_init(Query *query, ComponentMask mask) {
+    query->mask = mask;
+    query->without = cmask_empty();
+    query->any_of = cmask_empty();
+    query->optional = cmask_empty();
+    query->num_archetypes_seen = 0;
+    vector_init(query->archetypes);
+    vector_init(query->changed_filter);
+    query->last_run_tick = 0;
+}
+
+void query_destroy(Query *query) {
+    vector_destroy(query->archetypes);
+    vector_destroy(query->changed_filter);
+}
+
+void query_filter_changed(Query *query, Index component_id) {
+    vector_append(query->changed_filter, component_id);
+}
+
+void query_without(Query *query, Index component_id) {
+    assert(query->num_archetypes_seen == 0);
+    cmask_set(&query->without, component_id);
+}
+
+void query_any_of(Query *query, Index component_id) {
+    assert(query->num_archetypes_seen == 0);
+    cmask_set(&query->any_of, component_id);
+}
+
+void query_optional(Query *query, Index component_id) {
+    assert(query->num_archetypes_seen == 0);
+    cmask_set(&query->optional, component_id);
+}
+
+void query_update(Query *query, World const *world) {
+    assert(!mask_has_sparse(world, &query->optional)
+            && "optional terms have to be table components");
+
+    for (; query->num_archetypes_seen < vector_size(world->archetypes);
+            query->num_archetypes_seen++) {
+        Archetype const *archetype =
+                &world->archetypes[query->num_archetypes_seen];
+
+        if (archetype_matches_query(world, archetype, query)) {
+            vector_append(query->archetypes, query->num_archetypes_seen);
+        }
+    }
+}
+
+static void iterator_step(WorldIterator *iterator) {
+    if (iterator->current_element + 1
+            < iterator->world->archetypes[iterator->current_archetype]
+                    .num_elements) {
+        iterator->current_element++;
+    } else {
+        if (iterator->query) {
+            iterator->current_match++;
+        } else {
+            iterator->current_archetype++;
+        }
+        iterator->current_element = 0;
+        iterator_advance_archetype(iterator);
+    }
+}
+
+/// moves past rows not matched because of terms on sparse components
+static void iterator_skip_unmatched(WorldIterator *iterator) {
+    World const *world = iterator->world;
+    Query const *query = iterator->query;
+
+    while (worldit_is_valid(iterator)) {
+        Archetype const *archetype =
+                &world->archetypes[iterator->current_archetype];
+        Index entity_id = archetype->entities[iterator->current_element];
+
+        if (query && !query_has_row_terms(world, archetype, query)) {
+            return;
+        }
+
+        if (query ? query_row_matches(world, archetype, query, entity_id)
+                  : entity_has_sparse(world, &iterator->mask, entity_id)) {
+            return;
+        }
+
+        iterator_step(iterator);
+    }
+}
+
+WorldIterator worldit_create(World const *world, ComponentMask mask) {
+    WorldIterator iterator = {
+            .world = world,
+            .mask = mask,
+            .query = NULL,
+            .current_archetype = 0,
+            .current_element = 0,
+    };
+    iterator_advance_archetype(&iterator);
+    iterator_skip_unmatched(&iterator);
+    return iterator;
+}
+
+WorldIterator worldit_from_query(World const *world, Query *query) {
+    query_update(query, world);
+
+    WorldIterator iterator = {
+            .world = world,
+            .mask = cmask_empty(),
+            .query = query,
+            .current_match = 0,
+            .current_element = 0,
+    };
+    iterator_advance_archetype(&iterator);
+    iterator_skip_unmatched(&iterator);
+    return iterator;
+}
+
+bool worldit_is_valid(WorldIterator const *iterator) {
+    return iterator->current_archetype
+            < vector_size(iterator->world->archetypes);
+}
+
+void worldit_advance(WorldIterator *iterator) {
+    iterator_step(iterator);
+    iterator_skip_unmatched(iterator);
+}
+
+void *worldit_get_component(WorldIterator *iterator, Index component_id) {
+    Archetype *archetype =
+            &iterator->world->archetypes[iterator->current_archetype];
+
+    Column *column = archetype_get_column(archetype, component_id);
+
+    if (!column) {
+        return sparse_set_get(&iterator->world->sparse_sets[component_id],
+                archetype->entities[iterator->current_element]);
+    }
+
+    return column_get_component(
+            iterator->world, column, iterator->current_element);
+}
+
+EntityPtr worldit_get_entityptr(WorldIterator *iterator) {
+    return (EntityPtr){.archetype = iterator->current_archetype,
+            .element = iterator->current_element};
+}
+
+Entity worldit_get_entity(WorldIterator *iterator) {
+    Archetype *archetype =
+            &iterator->world->archetypes[iterator->current_archetype];
+    Index index = archetype->entities[iterator->current_element];
+
+    return entity_make(index, iterator->world->generations[index]);
+}
+
+SpanIterator spanit_create(World *world, Query *query) {
+    query_update(query, world);
+
+    uint32_t changed_since = 0;
+
+    if (!vector_empty(query->changed_filter)) {
+        changed_since = query->last_run_tick;
+        query->last_run_tick = ecs_advance_tick(world);
+    }
+
+    return (SpanIterator){
+            .world = world,
+            .query = query,
+            .current_match = 0,
+            .changed_since = changed_since,
+            .row_terms = false,
+            .archetype_index = 0,
+            .next_row = 0,
+            .end_row = 0,
+    };
+}
+
+static bool archetype_changed_since(World const *world,
+        Archetype const *archetype,
+        Query const *query,
+        uint32_t since) {
+    if (vector_empty(query->changed_filter)) {
+        return true;
+    }
+
+    for (size_t i = 0; i < vector_size(query->changed_filter); i++) {
+        Index component_id = query->changed_filter[i];
+        Column const *column =
+                archetype_get_column(archetype, component_id);
+        // sparse components aren't tracked per archetype, any write to
+        // one makes every archetype count as changed
+        uint32_t changed_tick = column
+                ? column->changed_tick
+                : world->sparse_sets[component_id].changed_tick;
+
+        if ((column || component_is_sparse(world, component_id))
+                && ecs_tick_newer(changed_tick, since)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool spanit_next(SpanIterator *iterator, ArchetypeSpan *span_out) {
+    Query const *query = iterator->query;
+    World const *world = iterator->world;
+    size_t begin, end;
+
+    do {
+        while (iterator->next_row == iterator->end_row) {
+            if (!query
+                    || iterator->current_match
+                            == vector_size(query->archetypes)) {
+                return false;
+            }
+
+            size_t archetype_index =
+                    query->archetypes[iterator->current_match++];
+            Archetype *archetype = &world->archetypes[archetype_index];
+
+            if (!archetype_changed_since(world,
+                        archetype,
+                        query,
+                        iterator->changed_since)) {
+                continue;
+            }
+
+            iterator->archetype_index = archetype_index;
+            iterator->row_terms =
+                    query_has_row_terms(world, archetype, query);
+            iterator->next_row = 0;
+            iterator->end_row = archetype->num_elements;
+        }
+
+        begin = iterator->next_row;
+        size_t page_end = (begin / ECS_PAGE_ROWS + 1) * ECS_PAGE_ROWS;
+        end = min(page_end, iterator->end_row);
+
+        if (iterator->row_terms) {
+            // unmatched rows split the page into runs of matching rows
+            Archetype const *archetype =
+                    &world->archetypes[iterator->archetype_index];
+            Index const *entities = archetype->entities;
+
+            while (begin < end
+                    && !query_row_matches(
+                            world, archetype, query, entities[begin])) {
+                begin++;
+            }
+
+            size_t run_end = begin;
+            while (run_end < end
+                    && query_row_matches(
+                            world, archetype, query, entities[run_end])) {
+                run_end++;
+            }
+
+            end = run_end;
+        }
+
+        iterator->next_row = end;
+    } while (begin == end);
+
+    *span_out = (ArchetypeSpan){
+            .archetype =
+                    &iterator->world->archetypes[iterator->archetype_index],
+            .archetype_index = iterator->archetype_index,
+            .begin = begin,
+            .count = end - begin,
+            .changed_since = iterator->changed_since,
+    };
+
+    return true;
+}
+
+void *span_get_column(ArchetypeSpan const *span, Index component_id) {
+    Column *column = archetype_get_column(span->archetype, component_id);
+
+    if (!column) {
+        return NULL;
+    }
+
+    return column_get_row(column, span->begin);
+}
+
+void *span_get_component(World const *world,
+        ArchetypeSpan const *span,
+        Index component_id,
+        size_t i) {
+    Column *column = archetype_get_column(span->archetype, component_id);
+
+    if (!column) {
+        return sparse_set_get(&world->sparse_sets[component_id],
+                span->archetype->entities[span->begin + i]);
+    }
+
+    return column_get_component(world, column, span->begin + i);
+}
+
+EntityPtr span_get_entityptr(ArchetypeSpan const *span, size_t i) {
+    return (EntityPtr){
+            .archetype = span->archetype_index,
+            .element = span->begin + i,
+    };
+}
+
+Entity span_get_entity(
+        World const *world, ArchetypeSpan const *span, size_t i) {
+    Index index = span->archetype->entities[span->begin + i];
+
+    return entity_make(index, world->generations[index]);
+}
+
+void span_mark_changed(
+        World const *world, ArchetypeSpan const *span, Index component_id) {
+    Column *column = archetype_get_column(span->archetype, component_id);
+
+    if (!column) {
+        if (!component_is_sparse(world, component_id)) {
+            return;
+        }
+
+        SparseSet *set = &world->sparse_sets[component_id];
+
+        for (size_t i = 0; i < span->count; i++) {
+            size_t position = sparse_set_find(
+                    set, span->archetype->entities[span->begin + i]);
+
+            if (position != SIZE_MAX) {
+                set->ticks[position] = world->change_tick;
+            }
+        }
+
+        atomic_store_explicit(&set->changed_tick,
+                world->change_tick,
+                memory_order_relaxed);
+        return;
+    }
+
+    for (size_t i = 0; i < span->count; i++) {
+        column->row_ticks[span->begin + i] = world->change_tick;
+    }
+
+    atomic_store_explicit(&column->changed_tick,
+            world->change_tick,
+            memory_order_relaxed);
+}
+
+bool span_row_changed(
+        ArchetypeSpan const *span, Index component_id, size_t i) {
+    Column const *column =
+            archetype_get_column(span->archetype, component_id);
+
+    return column
+            && ecs_tick_newer(column->row_ticks[span->begin + i],
+                    span->changed_since);
+}
+
+typedef struct ParForContext {
+    World *world;
+    vector(ArchetypeSpan) spans;
+    SpanFn fn;
+    void *ctx;
+} ParForContext;
+
+static void par_for_task(
+        void *ctx, size_t task_index, size_t worker_index) {
+    ParForContext *par_for = ctx;
+
+    par_for->fn(par_for->world,
+            &par_for->spans[task_index],
+            worker_index,
+            par_for->ctx);
+}
+
+void ecs_par_for(World *world,
+        Query *query,
+        ThreadPool *pool,
+        size_t grain_size,
+        SpanFn fn,
+        void *ctx) {
+    if (grain_size == 0) {
+        grain_size = ECS_DEFAULT_GRAIN_SIZE;
+    }
+
+    ParForContext par_for = {.world = world, .fn = fn, .ctx = ctx};
+    vector_init(par_for.spans);
+
+    SpanIterator it = spanit_create(world, query);
+    ArchetypeSpan span;
+    while (spanit_next(&it, &span)) {
+        for (size_t begin = 0; begin < span.count; begin += grain_size) {
+            ArchetypeSpan part = span;
+            part.begin = span.begin + begin;
+            part.count = min(grain_size, span.count - begin);
+
+            vector_append(par_for.spans, part);
+        }
+    }
+
+    thread_pool_run(
+            pool, vector_size(par_for.spans), par_for_task, &par_for);
+
+    vector_destroy(par_for.spans);
+}
+
+void archetype_init(
+        World *world, ComponentMask mask, Archetype *archetype_out) {
+    archetype_out->mask = mask;
+    archetype_out->num_elements = 0;
+
+    vector_init(archetype_out->columns);
+    vector_init(archetype_out->entities);
+    map_init(archetype_out->edges);
+
+    for (size_t i = 0; i < ECS_MAX_COMPONENTS; i++) {
+        archetype_out->column_index[i] = ECS_COLUMN_NONE;
+
+        if (cmask_is_set(&mask, i)) {
+            archetype_out->column_index[i] =
+                    vector_size(archetype_out->columns);
+
+            vector_resize(archetype_out->columns,
+                    vector_size(archetype_out->columns) + 1);
+
+            Column *column = vector_back(archetype_out->columns);
+
+            column->component_id = i;
+            column->element_size = column_element_size(world, i);
+            vector_init(column->pages);
+            column->num_borrowed_pages = 0;
+            column->changed_tick = 0;
+            vector_init(column->row_ticks);
+        }
+    }
+}
+
+static size_t archetype_create(World *world, ComponentMask const *mask) {
+    size_t archetype_index = vector_size(world->archetypes);
+
+    vector_resize(world->archetypes, archetype_index + 1);
+    archetype_init(world, *mask, &world->archetypes[archetype_index]);
+
+    archetype_lookup_insert(world, archetype_index, cmask_hash(mask));
+
+    return archetype_index;
+}
+
+static size_t get_or_create_archetype(
+        World *world, ComponentMask const *mask) {
+    size_t archetype_index = get_archetype(world, mask);
+
+    if (archetype_index == SIZE_MAX) {
+        archetype_index = archetype_create(world, mask);
+    }
+
+    return archetype_index;
+}
+
+/// resizes every column to `num_elements` rows. pages are only ever
+/// appended, a shrunk column keeps its pages around for reuse until
+/// `ecs_compress`. added rows are zeroed and stamped with `tick`.
+static void archetype_resize(
+        Archetype *archetype, size_t num_elements, uint32_t tick) {
+    size_t num_pages = (num_elements + ECS_PAGE_ROWS - 1) / ECS_PAGE_ROWS;
+
+    for (size_t i = 0; i < vector_size(archetype->columns); i++) {
+        Column *column = &archetype->columns[i];
+
+        while (vector_size(column->pages) < num_pages) {
+            uint8_t *page = column_alloc_page(column);
+            vector_append(column->pages, page);
+        }
+
+        for (size_t row = archetype->num_elements; row < num_elements;) {
+            size_t page_end = (row / ECS_PAGE_ROWS + 1) * ECS_PAGE_ROWS;
+            size_t end = min(page_end, num_elements);
+
+            memset(column_get_row(column, row),
+                    0,
+                    (end - row) * column->element_size);
+            row = end;
+        }
+
+        if (num_elements > vector_capacity(column->row_ticks)) {
+            size_t new_ticks_capacity = max(
+                    num_elements, vector_capacity(column->row_ticks) * 2);
+            vector_reserve(column->row_ticks, new_ticks_capacity);
+        }
+
+        vector_resize(column->row_ticks, num_elements);
+
+        for (size_t row = archetype->num_elements; row < num_elements;
+                row++) {
+            column->row_ticks[row] = tick;
+        }
+
+        if (num_elements > archetype->num_elements) {
+            column->changed_tick = tick;
+        }
+    }
+
+    archetype->num_elements = num_elements;
+}
+
+static Index allocate_entity_id(World *world) {
+    if (!vector_empty(world->free_ids)) {
+        return vector_pop_back(world->free_ids);
+    }
+
+    Index entity_id = vector_size(world->entity_ptrs);
+    vector_append(world->entity_ptrs, ENTITY_PTR_INVALID);
+    vector_append(world->generations, 0);
+
+    return entity_id;
+}
+
+bool ecs_is_alive(World const *world, Entity entity) {
+    Index index = entity_index(entity);
+
+    return index < vector_size(world->generations)
+            && world->generations[index] == entity_generation(entity)
+            && !eptr_eql(world->entity_ptrs[index], ENTITY_PTR_INVALID);
+}
+
+EntityPtr ecs_entity_ptr(World const *world, Entity entity) {
+    if (!ecs_is_alive(world, entity)) {
+        return ENTITY_PTR_INVALID;
+    }
+
+    return world->entity_ptrs[entity_index(entity)];
+}
+
+Entity ecs_ptr_entity(World const *world, EntityPtr eptr) {
+    if (eptr_eql(eptr, ENTITY_PTR_INVALID)) {
+        return ENTITY_INVALID;
+    }
+
+    Index index = world->archetypes[eptr.archetype].entities[eptr.element];
+
+    return entity_make(index, world->generations[index]);
+}
+
+Entity ecs_add_entity(World *world, ComponentMask mask) {
+    if (mask_has_sparse(world, &mask)) {
+        Entity entity = ecs_add_entity(
+                world, cmask_without(&mask, &world->sparse_components));
+
+        entity_add_sparse(world, &mask, entity_index(entity));
+
+        return entity;
+    }
+
+    Index entity_id = allocate_entity_id(world);
+
+    size_t archetype_index = get_or_create_archetype(world, &mask);
+    Archetype *archetype = &world->archetypes[archetype_index];
+
+    size_t element_index = archetype->num_elements;
+    archetype_resize(archetype, element_index + 1, world->change_tick);
+    vector_append(archetype->entities, entity_id);
+
+    world->entity_ptrs[entity_id] = (EntityPtr){
+            .archetype = archetype_index,
+            .element = element_index,
+    };
+
+    return entity_make(entity_id, world->generations[entity_id]);
+}
+
+SpanIterator ecs_spawn_batch(World *world,
+        ComponentMask mask,
+        size_t count,
+        Entity *entities_out) {
+    if (mask_has_sparse(world, &mask)) {
+        ComponentMask table =
+                cmask_without(&mask, &world->sparse_components);
+        SpanIterator it =
+                ecs_spawn_batch(world, table, count, entities_out);
+
+        Index const *entities =
+                world->archetypes[it.archetype_index].entities;
+
+        for (size_t i = it.next_row; i < it.end_row; i++) {
+            entity_add_sparse(world, &mask, entities[i]);
+        }
+
+        return it;
+    }
+
+    size_t archetype_index = get_or_create_archetype(world, &mask);
+    Archetype *archetype = &world->archetypes[archetype_index];
+
+    size_t first_element = archetype->num_elements;
+    archetype_resize(
+            archetype, first_element + count, world->change_tick);
+
+    size_t entities_capacity = first_element + count;
+    vector_reserve(archetype->entities, entities_capacity);
+
+    size_t num_new_ids = count > vector_size(world->free_ids)
+            ? count - vector_size(world->free_ids)
+            : 0;
+    size_t entity_capacity = vector_size(world->entity_ptrs) + num_new_ids;
+    vector_reserve(world->entity_ptrs, entity_capacity);
+    vector_reserve(world->generations, entity_capacity);
+
+    for (size_t i = 0; i < count; i++) {
+        Index entity_id = allocate_entity_id(world);
+
+        world->entity_ptrs[entity_id] = (EntityPtr){
+                .archetype = archetype_index,
+                .element = first_element + i,
+        };
+        vector_append(archetype->entities, entity_id);
+
+        if (entities_out) {
+            entities_out[i] =
+                    entity_make(entity_id, world->generations[entity_id]);
+        }
+    }
+
+    return (SpanIterator){
+            .world = world,
+            .query = NULL,
+            .current_match = 0,
+            .changed_since = world->change_tick - 1,
+            .archetype_index = archetype_index,
+            .next_row = first_element,
+            .end_row = first_element + count,
+    };
+}
+
+/// fills `element` with the archetype's last row and drops the last row
+static void archetype_swap_remove(
+        World *world, Archetype *archetype, size_t element) {
+    size_t last = archetype->num_elements - 1;
+
+    if (element != last) {
+        for (size_t i = 0; i < vector_size(archetype->columns); i++) {
+            Column *column = &archetype->columns[i];
+
+            memcpy(column_get_row(column, element),
+                    column_get_row(column, last),
+                    column->element_size);
+            column->row_ticks[element] = column->row_ticks[last];
+        }
+
+        Index moved = archetype->entities[last];
+        archetype->entities[element] = moved;
+        world->entity_ptrs[moved].element = element;
+    }
+
+    vector_pop_back(archetype->entities);
+    archetype_resize(archetype, last, world->change_tick);
+}
+
+void ecs_remove_entity(World *world, Entity entity) {
+    if (!ecs_is_alive(world, entity)) {
+        return;
+    }
+
+    Index entity_id = entity_index(entity);
+    EntityPtr eptr = world->entity_ptrs[entity_id];
+
+    Archetype *archetype = &world->archetypes[eptr.archetype];
+    ComponentMask keep = cmask_empty();
+
+    row_release_shared(world, archetype, eptr.element, &keep);
+    archetype_swap_remove(world, archetype, eptr.element);
+
+    ComponentMask const *sparse = &world->sparse_components;
+
+    for (size_t id = cmask_next(sparse, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(sparse, id + 1)) {
+        sparse_set_remove(&world->sparse_sets[id], entity_id);
+    }
+
+    blob_arena_free_owner(&world->blobs, entity_id);
+
+    world->entity_ptrs[entity_id] = ENTITY_PTR_INVALID;
+    // every handle to the old occupant of this slot is stale from now on
+    world->generations[entity_id]++;
+
+    vector_append(world->free_ids, entity_id);
+}
+
+void ecs_compress(World *world) {
+    for (size_t i = 0; i < vector_size(world->archetypes); i++) {
+        Archetype *archetype = &world->archetypes[i];
+
+        size_t num_pages = (archetype->num_elements + ECS_PAGE_ROWS - 1)
+                / ECS_PAGE_ROWS;
+
+        for (size_t j = 0; j < vector_size(archetype->columns); j++) {
+            column_truncate_pages(&archetype->columns[j], num_pages);
+            vector_shrink_to_fit(archetype->columns[j].row_ticks);
+        }
+
+        vector_shrink_to_fit(archetype->entities);
+    }
+
+    ComponentMask const *sparse = &world->sparse_components;
+
+    for (size_t id = cmask_next(sparse, 0); id < ECS_MAX_COMPONENTS;
+            id = cmask_next(sparse, id + 1)) {
+        SparseSet *set = &world->sparse_sets[id];
+
+        vector_shrink_to_fit(set->entities);
+        vector_shrink_to_fit(set->data);
+        vector_shrink_to_fit(set->ticks);
+    }
+
+    blob_arena_compact(&world->blobs);
+    vector_shrink_to_fit(world->blobs.slots);
+
+    // the entity table itself can't be trimmed, a freed slot has to keep
+    // its generation so stale handles stay stale
+    vector_shrink_to_fit(world->entity_ptrs);
+    vector_shrink_to_fit(world->generations);
+    vector_shrink_to_fit(world->free_ids);
+}
+
+static Order compare_edges(void const *a, void const *b) {
+    ArchetypeEdge const *edge_a = a;
+    ArchetypeEdge const *edge_b = b;
+
+    if (edge_a->component_id < edge_b->component_id) {
+        return ORDER_LESS_THAN;
+    }
+
+    if (edge_a->component_id > edge_b->component_id) {
+        return ORDER_GREATER_THAN;
+    }
+
+    return ORDER_EQUAL;
+}
+
+static ArchetypeEdge *archetype_get_edge(
+        Archetype *archetype, Index component_id) {
+    ArchetypeEdge edge = {
+            .component_id = component_id,
+            .add = SIZE_MAX,
+            .remove = SIZE_MAX,
+    };
+
+    ArchetypeEdge *existing =
+            map_get(archetype->edges, edge, compare_edges);
+
+    if (existing) {
+        return existing;
+    }
+
+    map_insert(archetype->edges, edge, compare_edges);
+
+    return map_get(archetype->edges, edge, compare_edges);
+}
+
+/// returns the archetype reached from `archetype_index` by adding (or
+/// removing) `component_id`, caching the edge in both directions
+static size_t archetype_transition(World *world,
+        size_t archetype_index,
+        Index component_id,
+        bool add) {
+    ArchetypeEdge *edge = archetype_get_edge(
+            &world->archetypes[archetype_index], component_id);
+    size_t target = add ? edge->add : edge->remove;
+
+    if (target != SIZE_MAX) {
+        return target;
+    }
+
+    ComponentMask mask = world->archetypes[archetype_index].mask;
+
+    if (add) {
+        cmask_set(&mask, component_id);
+    } else {
+        cmask_unset(&mask, component_id);
+    }
+
+    // may grow `world->archetypes`, so edges are looked up again below
+    target = get_or_create_archetype(world, &mask);
+
+    ArchetypeEdge *source_edge = archetype_get_edge(
+            &world->archetypes[archetype_index], component_id);
+    ArchetypeEdge *target_edge =
+            archetype_get_edge(&world->archetypes[target], component_id);
+
+    if (add) {
+        source_edge->add = target;
+        target_edge->remove = archetype_index;
+    } else {
+        source_edge->remove = target;
+        target_edge->add = archetype_index;
+    }
+
+    return target;
+}
+
+/// moves an entity's row to `target_index`, carrying over every column the
+/// two archetypes share. columns only the target has are zeroed.
+static void entity_move_archetype(
+        World *world, Index entity_id, size_t target_index) {
+    EntityPtr eptr = world->entity_ptrs[entity_id];
+    Archetype *source = &world->archetypes[eptr.archetype];
+    Archetype *target = &world->archetypes[target_index];
+
+    size_t new_element = target->num_elements;
+    archetype_resize(target, new_element + 1, world->change_tick);
+    vector_append(target->entities, entity_id);
+
+    for (size_t i = 0; i < vector_size(target->columns); i++) {
+        Column *target_column = &target->columns[i];
+        Column *source_column =
+                archetype_get_column(source, target_column->component_id);
+
+        if (!source_column) {
+            continue;
+        }
+
+        memcpy(column_get_row(target_column, new_element),
+                column_get_row(source_column, eptr.element),
+                target_column->element_size);
+
+        // moving doesn't count as a write
+        target_column->row_ticks[new_element] =
+                source_column->row_ticks[eptr.element];
+    }
+
+    // shared values the entity keeps are carried over with the handles
+    row_release_shared(world, source, eptr.element, &target->mask);
+    archetype_swap_remove(world, source, eptr.element);
+
+    world->entity_ptrs[entity_id] = (EntityPtr){
+            .archetype = target_index,
+            .element = new_element,
+    };
+}
+
+void ecs_add_component(World *world,
+        Entity entity,
+        Index component_id,
+        void const *component) {
+    if (!ecs_is_alive(world, entity)) {
+        return;
+    }
+
+    Index entity_id = entity_index(entity);
+    EntityPtr eptr = world->entity_ptrs[entity_id];
+
+    if (component_is_sparse(world, component_id)) {
+        SparseSet *set = &world->sparse_sets[component_id];
+        void *element =
+                sparse_set_insert(set, entity_id, world->change_tick);
+
+        if (component) {
+            memcpy(element, component, set->element_size);
+            ecs_mark_changed(world, eptr, component_id);
+        }
+
+        return;
+    }
+
+    if (!cmask_is_set(
+                &world->archetypes[eptr.archetype].mask, component_id)) {
+        size_t target = archetype_transition(
+                world, eptr.archetype, component_id, true);
+        entity_move_archetype(world, entity_id, target);
+        eptr = world->entity_ptrs[entity_id];
+    }
+
+    if (component) {
+        ecs_write_component(world, eptr, component_id, component);
+    }
+}
+
+void ecs_remove_component(
+        World *world, Entity entity, Index component_id) {
+    if (!ecs_is_alive(world, entity)) {
+        return;
+    }
+
+    Index entity_id = entity_index(entity);
+    EntityPtr eptr = world->entity_ptrs[entity_id];
+
+    if (component_is_sparse(world, component_id)) {
+        sparse_set_remove(&world->sparse_sets[component_id], entity_id);
+        return;
+    }
+
+    if (!cmask_is_set(
+                &world->archetypes[eptr.archetype].mask, component_id)) {
+        return;
+    }
+
+    size_t target = archetype_transition(
+            world, eptr.archetype, component_id, false);
+    entity_move_archetype(world, entity_id, target);
+}
+
+static uint8_t *entity_builder_storage(EntityBuilder *builder) {
+    return builder->heap_storage ? builder->heap_storage
+                                 : builder->inline_storage;
+}
+
+void entity_builder_init(EntityBuilder *builder, World *world) {
+    builder->world = world;
+    builder->mask = cmask_empty();
+    builder->num_components = 0;
+    builder->storage_size = 0;
+    builder->storage_capacity = ENTITY_BUILDER_INLINE_SIZE;
+    builder->heap_storage = NULL;
+}
+
+void entity_builder_destroy(EntityBuilder *builder) {
+    free(builder->heap_storage);
+    builder->heap_storage = NULL;
+    builder->num_components = 0;
+}
+
+void entity_builder_add(
+        EntityBuilder *builder, size_t id, void *component) {
+    assert(!cmask_is_set(&builder->mask, id)
+            && "component added twice");
+
+    cmask_set(&builder->mask, id);
+
+    size_t component_size = builder->world->component_sizes[id];
+    size_t offset = (builder->storage_size + ENTITY_BUILDER_ALIGNMENT - 1)
+            & ~(size_t)(ENTITY_BUILDER_ALIGNMENT - 1);
+
+    if (offset + component_size > builder->storage_capacity) {
+        size_t new_capacity = max(
+                builder->storage_capacity * 2, offset + component_size);
+        uint8_t *new_storage = sunset_malloc(new_capacity);
+
+        memcpy(new_storage,
+                entity_builder_storage(builder),
+                builder->storage_size);
+        free(builder->heap_storage);
+
+        builder->heap_storage = new_storage;
+        builder->storage_capacity = new_capacity;
+    }
+
+    memcpy(entity_builder_storage(builder) + offset,
+            component,
+            component_size);
+
+    builder->storage_size = offset + component_size;
+    builder->component_ids[builder->num_components] = id;
+    builder->component_offsets[builder->num_components] = offset;
+    builder->num_components++;
+}
+
+Entity entity_builder_finish(EntityBuilder *builder) {
+    Entity entity = ecs_add_entity(builder->world, builder->mask);
+
+    EntityPtr eptr = builder->world->entity_ptrs[entity_index(entity)];
+    uint8_t *storage = entity_builder_storage(builder);
+
+    for (size_t i = 0; i < builder->num_components; i++) {
+        Index component_id = builder->component_ids[i];
+
+        ecs_write_component(builder->world,
+                eptr,
+                component_id,
+                storage + builder->component_offsets[i]);
+    }
+
+    entity_builder_destroy(builder);
+
+    return entity;
+}
+
+void *ecs_component_from_ptr(
+        World *world, EntityPtr eptr, Index component_id) {
+    Archetype *archetype = &world->archetypes[eptr.archetype];
+    Column *column = archetype_get_column(archetype, component_id);
+
+    if (!column) {
+        return sparse_set_get(&world->sparse_sets[component_id],
+                archetype->entities[eptr.element]);
+    }
+
+    return column_get_component(world, column, eptr.element);
+}
+
+void ecs_write_component(World *world,
+        EntityPtr eptr,
+        Index component_id,
+        void const *component) {
+    if (!component_is_shared(world, component_id)) {
+        void *element = ecs_component_from_ptr(world, eptr, component_id);
+        assert(element && "the entity doesn't have the component");
+
+        memcpy(element, component, world->component_sizes[component_id]);
+        ecs_mark_changed(world, eptr, component_id);
+        return;
+    }
+
+    Column *column = archetype_get_column(
+            &world->archetypes[eptr.archetype], component_id);
+    assert(column && "the entity doesn't have the component");
+
+    SharedTable *table = &world->shared_tables[component_id];
+    SharedRef *ref = column_get_row(column, eptr.element);
+    SharedRef old_ref = *ref;
+
+    // interned before releasing, so writing back an unchanged value never
+    // frees it in between
+    *ref = shared_table_intern(table, component);
+    shared_table_release(table, old_ref);
+
+    ecs_mark_changed(world, eptr, component_id);
+}
+
+BlobRef ecs_blob_alloc(World *world, EntityPtr owner, size_t size) {
+    uint32_t owner_id = BLOB_OWNER_NONE;
+
+    if (!eptr_eql(owner, ENTITY_PTR_INVALID)) {
+        Archetype const *archetype = &world->archetypes[owner.archetype];
+        owner_id = archetype->entities[owner.element];
+    }
+
+    return blob_arena_alloc(&world->blobs, size, owner_id);
+}
+
+void const *ecs_shared_value(
+        World const *world, Index component_id, SharedRef ref) {
+    return shared_table_get(&world->shared_tables[component_id], ref);
+}
+
+void *ecs_get_component(World *world, Entity entity, Index component_id) {
+    if (!ecs_is_alive(world, entity)) {
+        return NULL;
+    }
+
+    EntityPtr eptr = world->entity_ptrs[entity_index(entity)];
+
+    return ecs_component_from_ptr(world, eptr, component_id);
+}
+
+uint32_t ecs_advance_tick(World *world) {
+    return atomic_fetch_add(&world->change_tick, 1);
+}
+
+void ecs_mark_changed(World *world, EntityPtr eptr, Index component_id) {
+    Archetype *archetype = &world->archetypes[eptr.archetype];
+    Column *column = archetype_get_column(archetype, component_id);
+
+    if (!column) {
+        SparseSet *set = &world->sparse_sets[component_id];
+        size_t position =
+                sparse_set_find(set, archetype->entities[eptr.element]);
+
+        if (position != SIZE_MAX) {
+            set->ticks[position] = world->change_tick;
+            set->changed_tick = world->change_tick;
+        }
+
+        return;
+    }
+
+    column->row_ticks[eptr.element] = world->change_tick;
+    column->changed_tick = world->change_tick;
+}
+
+bool ecs_changed_since(World const *world,
+        EntityPtr eptr,
+        Index component_id,
+        uint32_t since) {
+    Archetype const *archetype = &world->archetypes[eptr.archetype];
+    Column const *column = archetype_get_column(archetype, component_id);
+
+    if (!column) {
+        SparseSet const *set = &world->sparse_sets[component_id];
+        size_t position =
+                sparse_set_find(set, archetype->entities[eptr.element]);
+
+        return position != SIZE_MAX
+                && ecs_tick_newer(set->ticks[position], since);
+    }
+
+    return ecs_tick_newer(column->row_ticks[eptr.element], since);
+}
+
+typedef struct WorldFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_components;
+    uint32_t num_archetypes;
+    /// `ECS_PAGE_ROWS` of the saving build, pages are loaded in place
+    uint32_t page_rows;
+    uint32_t num_sparse_sets;
+    uint32_t num_shared_tables;
+    uint32_t reserved;
+    uint64_t num_entities;
+    uint64_t num_free_ids;
+} WorldFileHeader;
+
+/// follows the entities, followed by the values. handles in the columns
+/// index them directly, reference counts are recounted on load.
+typedef struct WorldFileSharedTable {
+    uint64_t num_values;
+    uint32_t component_id;
+    uint32_t reserved;
+} WorldFileSharedTable;
+
+/// followed by the component id of every column and the entity slot of
+/// every row, then by the pages of every column. each page is written
+/// whole and aligned, so that the loader can use it where it is mapped.
+typedef struct WorldFileArchetype {
+    uint64_t num_elements;
+    uint32_t num_columns;
+    uint32_t reserved;
+} WorldFileArchetype;
+
+/// follows the archetypes, followed by the entity slot of every element
+/// and then the elements. sparse sets are copied on load, they change too
+/// often to be worth keeping in the mapping.
+typedef struct WorldFileSparseSet {
+    uint64_t num_elements;
+    uint32_t component_id;
+    uint32_t reserved;
+} WorldFileSparseSet;
+
+/// follows the sparse sets, followed by the arena's data and its slots.
+/// the owner and free lists are linked again on load.
+typedef struct WorldFileBlobs {
+    uint64_t data_size;
+    uint32_t num_slots;
+    uint32_t reserved;
+} WorldFileBlobs;
+
+typedef struct SaveStream {
+    Writer *writer;
+    size_t offset;
+} SaveStream;
+
+static int save_write(SaveStream *stream, void const *buf, size_t count) {
+    uint8_t const *bytes = buf;
+
+    while (count > 0) {
+        ssize_t written = writer_write(stream->writer, bytes, count);
+
+        if (written <= 0) {
+            return -ERROR_IO;
+        }
+
+        bytes += written;
+        count -= written;
+        stream->offset += written;
+    }
+
+    return 0;
+}
+
+static int save_zeroes(SaveStream *stream, size_t count) {
+    static uint8_t const zeroes[WORLD_FILE_ALIGNMENT] = {0};
+
+    int retval = 0;
+
+    while (!retval && count > 0) {
+        size_t chunk = min(count, sizeof(zeroes));
+
+        retval = save_write(stream, zeroes, chunk);
+        count -= chunk;
+    }
+
+    return retval;
+}
+
+static int save_align(SaveStream *stream) {
+    return save_zeroes(
+            stream, -stream->offset & (WORLD_FILE_ALIGNMENT - 1));
+}
+
+int ecs_save(World const *world, Writer *writer) {
+    int retval = 0;
+    SaveStream stream = {.writer = writer, .offset = 0};
+
+    WorldFileHeader header = {
+            .magic = WORLD_FILE_MAGIC,
+            .version = WORLD_FILE_VERSION,
+            .num_components = vector_size(world->component_sizes),
+            .num_archetypes = vector_size(world->archetypes),
+            .page_rows = ECS_PAGE_ROWS,
+            .num_sparse_sets = cmask_popcount(&world->sparse_components),
+            .num_shared_tables =
+                    cmask_popcount(&world->shared_components),
+            .reserved = 0,
+            .num_entities = vector_size(world->entity_ptrs),
+            .num_free_ids = vector_size(world->free_ids),
+    };
+
+    if ((retval = save_write(&stream, &header, sizeof(header)))) {
+        return retval;
+    }
+
+    for (size_t i = 0; i < header.num_components; i++) {
+        uint64_t component_size = world->component_sizes[i];
+
+        if ((retval = save_write(
+                     &stream, &component_size, sizeof(component_size)))) {
+            return retval;
+        }
+    }
+
+    if ((retval = save_write(&stream,
+                 world->entity_ptrs,
+                 header.num_entities * sizeof(EntityPtr)))
+            || (retval = save_write(&stream,
+                        world->generations,
+                        header.num_entities * sizeof(uint32_t)))
+            || (retval = save_write(&stream,
+                        world->free_ids,
+                        header.num_free_ids * sizeof(Index)))
+            || (retval = save_align(&stream))) {
+        return retval;
+    }
+
+    for (size_t i = 0; i < header.num_components; i++) {
+        SharedTable const *table = &world->shared_tables[i];
+
+        if (!component_is_shared(world, i)) {
+            continue;
+        }
+
+        WorldFileSharedTable file_table = {
+                .num_values = vector_size(table->refcounts),
+                .component_id = i,
+                .reserved = 0,
+        };
+
+        if ((retval = save_write(
+                     &stream, &file_table, sizeof(file_table)))
+                || (retval = save_write(&stream,
+                            table->values,
+                            file_table.num_values * table->element_size))
+                || (retval = save_align(&stream))) {
+            return retval;
+        }
+    }
+
+    for (size_t i = 0; i < header.num_archetypes; i++) {
+        Archetype const *archetype = &world->archetypes[i];
+
+        WorldFileArchetype file_archetype = {
+                .num_elements = archetype->num_elements,
+                .num_columns = vector_size(archetype->columns),
+                .reserved = 0,
+        };
+
+        if ((retval = save_write(
+                     &stream, &file_archetype, sizeof(file_archetype)))) {
+            return retval;
+        }
+
+        for (size_t j = 0; j < file_archetype.num_columns; j++) {
+            Index component_id = archetype->columns[j].component_id;
+
+            if ((retval = save_write(
+                         &stream, &component_id, sizeof(component_id)))) {
+                return retval;
+            }
+        }
+
+        if ((retval = save_write(&stream,
+                     archetype->entities,
+                     file_archetype.num_elements * sizeof(Index)))
+                || (retval = save_align(&stream))) {
+            return retval;
+        }
+
+        for (size_t j = 0; j < file_archetype.num_columns; j++) {
+            Column const *column = &archetype->columns[j];
+            size_t page_size = column_page_size(column);
+
+            for (size_t row = 0; row < archetype->num_elements;
+                    row += ECS_PAGE_ROWS) {
+                size_t rows = min((size_t)ECS_PAGE_ROWS,
+                        archetype->num_elements - row);
+                size_t data_size = rows * column->element_size;
+
+                // page sizes are multiples of the alignment, so pages
+                // follow each other without padding
+                if ((retval = save_write(&stream,
+                             column_get_row(column, row),
+                             data_size))
+                        || (retval = save_zeroes(
+                                    &stream, page_size - data_size))) {
+                    return retval;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < header.num_components; i++) {
+        SparseSet const *set = &world->sparse_sets[i];
+
+        if (!component_is_sparse(world, i)) {
+            continue;
+        }
+
+        WorldFileSparseSet file_set = {
+                .num_elements = vector_size(set->entities),
+                .component_id = i,
+                .reserved = 0,
+        };
+
+        if ((retval = save_write(&stream, &file_set, sizeof(file_set)))
+                || (retval = save_write(&stream,
+                            set->entities,
+                            file_set.num_elements * sizeof(Index)))
+                || (retval = save_align(&stream))
+                || (retval = save_write(&stream,
+                            set->data,
+                            file_set.num_elements * set->element_size))
+                || (retval = save_align(&stream))) {
+            return retval;
+        }
+    }
+
+    BlobArena const *blobs = &world->blobs;
+
+    WorldFileBlobs file_blobs = {
+            .data_size = vector_size(blobs->data),
+            .num_slots = vector_size(blobs->slots),
+            .reserved = 0,
+    };
+
+    if ((retval = save_write(&stream, &file_blobs, sizeof(file_blobs)))
+            || (retval = save_write(
+                        &stream, blobs->data, file_blobs.data_size))
+            || (retval = save_align(&stream))
+            || (retval = save_write(&stream,
+                        blobs->slots,
+                        file_blobs.num_slots * sizeof(BlobSlot)))
+            || (retval = save_align(&stream))) {
+        return retval;
+    }
+
+    return 0;
+}
+
+typedef struct LoadCursor {
+    uint8_t *data;
+    size_t size;
+    size_t offset;
+} LoadCursor;
+
+/// returns NULL if the file is too short
+static void *load_take(
+        LoadCursor *cursor, size_t count, size_t element_size) {
+    if (element_size > 0
+            && count > (cursor->size - cursor->offset) / element_size) {
+        return NULL;
+    }
+
+    void *ptr = cursor->data + cursor->offset;
+    cursor->offset += count * element_size;
+
+    return ptr;
+}
+
+static void load_align(LoadCursor *cursor) {
+    size_t padding = -cursor->offset & (WORLD_FILE_ALIGNMENT - 1);
+
+    cursor->offset = min(cursor->offset + padding, cursor->size);
+}
+
+static int compare_masks(void const *a, void const *b) {
+    ComponentMask const *mask_a = a;
+    ComponentMask const *mask_b = b;
+
+    return memcmp(mask_a->words, mask_b->words, sizeof(mask_a->words));
+}
+
+/// walks the whole file. with `apply` unset it only checks that the file
+/// is well formed, so a bad file never leaves `world` half loaded.
+static int load_world(World *world, LoadCursor cursor, bool apply) {
+    WorldFileHeader const *header = load_take(&cursor, 1, sizeof(*header));
+
+    if (!header || header->magic != WORLD_FILE_MAGIC) {
+        return -ERROR_INVALID_FORMAT;
+    }
+
+    if (header->version != WORLD_FILE_VERSION) {
+        return -ERROR_UNSUPPORTED;
+    }
+
+    if (header->num_components != vector_size(world->component_sizes)
+            || header->page_rows != ECS_PAGE_ROWS) {
+        return -ERROR_INVALID_FORMAT;
+    }
+
+    uint64_t const *component_sizes =
+            load_take(&cursor, header->num_components, sizeof(uint64_t));
+
+    if (!component_sizes) {
+        return -ERROR_INVALID_FORMAT;
+    }
+
+    for (size_t i = 0; i < header->num_components; i++) {
+        if (component_sizes[i] != world->component_sizes[i]) {
+            return -ERROR_INVALID_FORMAT;
+        }
+    }
+
+    size_t num_entities = header->num_entities;
+    EntityPtr const *entity_ptrs =
+            load_take(&cursor, num_entities, sizeof(EntityPtr));
+    uint32_t const *generations =
+            load_take(&cursor, num_entities, sizeof(uint32_t));
+    Index const *free_ids =
+            load_take(&cursor, header->num_free_ids, sizeof(Index));
+    load_align(&cursor);
+
+    if (!entity_ptrs || !generations || !free_ids) {
+        return -ERROR_INVALID_FORMAT;
+    }
+
+    // the world's index of every archetype in the file when applying,
+    // its number of rows when validating
+    vector(size_t) archetype_info;
+    vector_init(archetype_info);
+    // only gathered when validating, every archetype's mask and rows
+    vector(ComponentMask) archetype_masks;
+    vector_init(archetype_masks);
+    vector(Index const *) archetype_entities;
+    vector_init(archetype_entities);
+
+    // values of every shared table in the file, handles in the columns
+    // are checked against them
+    size_t num_components = header->num_components;
+    vector(size_t) num_shared_values;
+    vector_init(num_shared_values);
+    vector_resize(num_shared_values, num_components);
+
+    int retval = 0;
+
+    for (size_t i = 0; i < header->num_shared_tables; i++) {
+        WorldFileSharedTable const *file_table =
+                load_take(&cursor, 1, sizeof(*file_table));
+
+        if (!file_table
+                || file_table->component_id >= header->num_components
+                || !component_is_shared(world, file_table->component_id)
+                || file_table->num_values == 0
+                || file_table->num_values > UINT32_MAX) {
+            retval = -ERROR_INVALID_FORMAT;
+            break;
+        }
+
+        Index component_id = file_table->component_id;
+        SharedTable *table = &world->shared_tables[component_id];
+        size_t num_values = file_table->num_values;
+
+        uint8_t const *values =
+                load_take(&cursor, num_values, table->element_size);
+        load_align(&cursor);
+
+        // zeroed rows refer to the first value
+        if (!values
+                || memcmp(values,
+                           shared_table_get(table, SHARED_REF_ZERO),
+                           table->element_size)
+                        != 0) {
+            retval = -ERROR_INVALID_FORMAT;
+            break;
+        }
+
+        num_shared_values[component_id] = num_values;
+
+        if (apply) {
+            size_t values_size = num_values * table->element_size;
+            vector_resize(table->values, values_size);
+            memcpy(table->values, values, values_size);
+
+            // counted again from the columns
+            vector_resize(table->refcounts, num_values);
+            memset(table->refcounts, 0, num_values * sizeof(uint32_t));
+        }
+    }
+
+    for (size_t i = 0; !retval && i < header->num_archetypes; i++) {
+        WorldFileArchetype const *file_archetype =
+                load_take(&cursor, 1, sizeof(*file_archetype));
+
+        if (!file_archetype
+                || file_archetype->num_columns > ECS_MAX_COMPONENTS) {
+            retval = -ERROR_INVALID_FORMAT;
+            break;
+        }
+
+        size_t num_elements = file_archetype->num_elements;
+        Index const *component_ids = load_take(
+                &cursor, file_archetype->num_columns, sizeof(Index));
+        Index const *entities =
+                load_take(&cursor, num_elements, sizeof(Index));
+        load_align(&cursor);
+
+        if (!component_ids || !entities) {
+            retval = -ERROR_INVALID_FORMAT;
+            break;
+        }
+
+        ComponentMask mask = cmask_empty();
+
+        for (size_t j = 0; j < file_archetype->num_columns; j++) {
+            if (component_ids[j] >= header->num_components
+                    || component_is_sparse(world, component_ids[j])
+                    || cmask_is_set(&mask, component_ids[j])) {
+                retval = -ERROR_INVALID_FORMAT;
+                break;
+            }
+
+            cmask_set(&mask, component_ids[j]);
+        }
+
+        // every row belongs to the entity slot that points back at it
+        for (size_t j = 0; !apply && j < num_elements; j++) {
+            if (entities[j] >= num_entities
+                    || !eptr_eql(entity_ptrs[entities[j]],
+                            (EntityPtr){.archetype = i, .element = j})) {
+                retval = -ERROR_INVALID_FORMAT;
+                break;
+            }
+        }
+
+        if (!apply) {
+            vector_append(archetype_masks, mask);
+            vector_append(archetype_entities, entities);
+        }
+
+        Archetype *archetype = NULL;
+
+        if (apply && !retval) {
+            size_t archetype_index = get_or_create_archetype(world, &mask);
+            archetype = &world->archetypes[archetype_index];
+            vector_append(archetype_info, archetype_index);
+
+            archetype->num_elements = num_elements;
+            vector_resize(archetype->entities, num_elements);
+            memcpy(archetype->entities,
+                    entities,
+                    num_elements * sizeof(Index));
+        } else {
+            vector_append(archetype_info, num_elements);
+        }
+
+        size_t num_pages =
+                (num_elements + ECS_PAGE_ROWS - 1) / ECS_PAGE_ROWS;
+
+        for (size_t j = 0; !retval && j < file_archetype->num_columns;
+                j++) {
+            Column page_layout = {
+                    .element_size =
+                            column_element_size(world, component_ids[j]),
+            };
+            size_t page_size = column_page_size(&page_layout);
+
+            uint8_t *data = load_take(&cursor, num_pages, page_size);
+            load_align(&cursor);
+
+            if (!data) {
+                retval = -ERROR_INVALID_FORMAT;
+                break;
+            }
+
+            if (component_is_shared(world, component_ids[j])) {
+                SharedTable *table =
+                        &world->shared_tables[component_ids[j]];
+                // handle pages are a whole number of alignments, so the
+                // handles of all rows follow each other
+                SharedRef const *refs = (SharedRef const *)data;
+
+                for (size_t row = 0; row < num_elements; row++) {
+                    if (refs[row]
+                            >= num_shared_values[component_ids[j]]) {
+                        retval = -ERROR_INVALID_FORMAT;
+                        break;
+                    }
+
+                    if (apply && refs[row] != SHARED_REF_ZERO) {
+                        table->refcounts[refs[row]]++;
+                    }
+                }
+            }
+
+            if (retval || !apply) {
+                continue;
+            }
+
+            Column *column =
+                    archetype_get_column(archetype, component_ids[j]);
+
+            column_truncate_pages(column, 0);
+            vector_resize(column->pages, num_pages);
+            for (size_t page = 0; page < num_pages; page++) {
+                column->pages[page] = data + page * page_size;
+            }
+            column->num_borrowed_pages = num_pages;
+
+            vector_resize(column->row_ticks, num_elements);
+            for (size_t row = 0; row < num_elements; row++) {
+                column->row_ticks[row] = world->change_tick;
+            }
+            column->changed_tick = world->change_tick;
+        }
+
+        if (retval) {
+            break;
+        }
+    }
+
+    // two archetypes of the same mask would be loaded into one
+    if (!apply && !retval) {
+        qsort(archetype_masks,
+                vector_size(archetype_masks),
+                sizeof(ComponentMask),
+                compare_masks);
+
+        for (size_t i = 1; i < vector_size(archetype_masks); i++) {
+            if (cmask_is_eql(
+                        &archetype_masks[i - 1], &archetype_masks[i])) {
+                retval = -ERROR_INVALID_FORMAT;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; !retval && i < header->num_sparse_sets; i++) {
+        WorldFileSparseSet const *file_set =
+                load_take(&cursor, 1, sizeof(*file_set));
+
+        if (!file_set || file_set->component_id >= header->num_components
+                || !component_is_sparse(world, file_set->component_id)) {
+            retval = -ERROR_INVALID_FORMAT;
+            break;
+        }
+
+        SparseSet *set = &world->sparse_sets[file_set->component_id];
+        size_t num_elements = file_set->num_elements;
+
+        Index const *entities =
+                load_take(&cursor, num_elements, sizeof(Index));
+        load_align(&cursor);
+        uint8_t const *data =
+                load_take(&cursor, num_elements, set->element_size);
+        load_align(&cursor);
+
+        if (!entities || !data) {
+            retval = -ERROR_INVALID_FORMAT;
+            break;
+        }
+
+        for (size_t j = 0; j < num_elements; j++) {
+            if (!apply) {
+                if (entities[j] >= num_entities
+                        || eptr_eql(entity_ptrs[entities[j]],
+                                ENTITY_PTR_INVALID)) {
+                    retval = -ERROR_INVALID_FORMAT;
+                    break;
+                }
+
+                continue;
+            }
+
+            memcpy(sparse_set_insert(set, entities[j], world->change_tick),
+                    data + j * set->element_size,
+                    set->element_size);
+        }
+    }
+
+    WorldFileBlobs const *file_blobs =
+            retval ? NULL : load_take(&cursor, 1, sizeof(*file_blobs));
+    uint8_t const *blob_data = NULL;
+    BlobSlot const *blob_slots = NULL;
+
+    if (file_blobs) {
+        blob_data = load_take(&cursor, file_blobs->data_size, 1);
+        load_align(&cursor);
+        blob_slots = load_take(
+                &cursor, file_blobs->num_slots, sizeof(BlobSlot));
+        load_align(&cursor);
+    }
+
+    if (!retval
+            && (!blob_data || !blob_slots || file_blobs->num_slots == 0)) {
+        retval = -ERROR_INVALID_FORMAT;
+    }
+
+    // live blobs have to lie within the data and belong to an entity
+    // slot, their capacities are summed to rule out overlaps adding up
+    // to more than the data
+    uint64_t blobs_capacity = 0;
+
+    for (size_t i = 1; !apply && !retval && i < file_blobs->num_slots;
+            i++) {
+        BlobSlot const *slot = &blob_slots[i];
+
+        if (slot->offset == BLOB_OFFSET_FREE) {
+            continue;
+        }
+
+        blobs_capacity += slot->capacity;
+
+        if (slot->size > slot->capacity
+                || slot->capacity > file_blobs->data_size
+                || slot->offset > file_blobs->data_size - slot->capacity
+                || blobs_capacity > file_blobs->data_size
+                || (slot->owner != BLOB_OWNER_NONE
+                        && slot->owner >= num_entities)) {
+            retval = -ERROR_INVALID_FORMAT;
+        }
+    }
+
+    for (size_t i = 0; !apply && !retval && i < num_entities; i++) {
+        EntityPtr eptr = entity_ptrs[i];
+
+        if (eptr_eql(eptr, ENTITY_PTR_INVALID)) {
+            continue;
+        }
+
+        if (eptr.archetype >= header->num_archetypes
+                || eptr.element >= archetype_info[eptr.archetype]
+                || archetype_entities[eptr.archetype][eptr.element] != i) {
+            retval = -ERROR_INVALID_FORMAT;
+        }
+    }
+
+    for (size_t i = 0; !apply && !retval && i < header->num_free_ids;
+            i++) {
+        if (free_ids[i] >= num_entities) {
+            retval = -ERROR_INVALID_FORMAT;
+        }
+    }
+
+    if (apply && !retval) {
+        vector_resize(world->entity_ptrs, num_entities);
+        vector_resize(world->generations, num_entities);
+
+        for (size_t i = 0; i < num_entities; i++) {
+            EntityPtr eptr = entity_ptrs[i];
+
+            if (!eptr_eql(eptr, ENTITY_PTR_INVALID)) {
+                eptr.archetype = archetype_info[eptr.archetype];
+            }
+
+            world->entity_ptrs[i] = eptr;
+            world->generations[i] = generations[i];
+        }
+
+        size_t num_free_ids = header->num_free_ids;
+        vector_resize(world->free_ids, num_free_ids);
+        memcpy(world->free_ids, free_ids, num_free_ids * sizeof(Index));
+
+        // blobs are copied like sparse sets, they are resized in place
+        BlobArena *blobs = &world->blobs;
+        size_t data_size = file_blobs->data_size;
+        size_t num_slots = file_blobs->num_slots;
+
+        vector_resize(blobs->data, data_size);
+        memcpy(blobs->data, blob_data, data_size);
+        vector_resize(blobs->slots, num_slots);
+        memcpy(blobs->slots, blob_slots, num_slots * sizeof(BlobSlot));
+        blob_arena_relink(blobs);
+
+        ComponentMask const *shared = &world->shared_components;
+
+        for (size_t id = cmask_next(shared, 0); id < ECS_MAX_COMPONENTS;
+                id = cmask_next(shared, id + 1)) {
+            shared_table_rebuild(&world->shared_tables[id]);
+        }
+    }
+
+    vector_destroy(archetype_info);
+    vector_destroy(archetype_masks);
+    vector_destroy(archetype_entities);
+    vector_destroy(num_shared_values);
+
+    return retval;
+}
+
+int ecs_load(World *world, VfsFile *file) {
+    int retval = 0;
+
+    if (!vector_empty(world->entity_ptrs) || world->mapping) {
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    void *data;
+    size_t size;
+
+    // private and writable, so that writes to adopted columns never reach
+    // the file
+    if ((retval = vfs_map_file(file,
+                 VFS_MAP_PROT_READ | VFS_MAP_PROT_WRITE,
+                 VFS_MAP_PRIVATE,
+                 &data,
+                 &size))) {
+        return retval;
+    }
+
+    LoadCursor cursor = {.data = data, .size = size, .offset = 0};
+
+    if ((retval = load_world(world, cursor, false))) {
+        vfs_munmap(data, size);
+        return retval;
+    }
+
+    load_world(world, cursor, true);
+
+    world->mapping = data;
+    world->mapping_size = size;
+
+    return 0;
 }
-//
-// void ecs_save(World *world, Writer *writer) {
-//
-// }
@@ -0,0 +1,358 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/math.h"
+#include "internal/utils.h"
+#include "sunset/component_mask.h"
+#include "sunset/ecs.h"
+#include "sunset/vector.h"
+
+#include "sunset/ecs_commands.h"
+
+typedef struct SpawnRef {
+    uint64_t hash;
+    EcsCommandBuffer const *cmdbuf;
+    EcsCommand const *command;
+    /// position across all flushed buffers, keeps the sort stable
+    size_t order;
+} SpawnRef;
+
+typedef struct CommandRef {
+    /// where the target was when the flush started
+    EntityPtr eptr;
+    /// the target was already gone when the flush started
+    bool stale;
+    EcsCommandBuffer const *cmdbuf;
+    EcsCommand const *command;
+    size_t order;
+} CommandRef;
+
+void ecs_cmdbuf_init(EcsCommandBuffer *cmdbuf, World const *world) {
+    cmdbuf->world = world;
+    vector_init(cmdbuf->commands);
+    vector_init(cmdbuf->components);
+    vector_init(cmdbuf->data);
+}
+
+static void cmdbuf_clear(EcsCommandBuffer *cmdbuf) {
+    vector_clear(cmdbuf->commands);
+    vector_clear(cmdbuf->components);
+    vector_clear(cmdbuf->data);
+}
+
+void ecs_cmdbuf_destroy(EcsCommandBuffer *cmdbuf) {
+    cmdbuf_clear(cmdbuf);
+
+    vector_destroy(cmdbuf->commands);
+    vector_destroy(cmdbuf->components);
+    vector_destroy(cmdbuf->data);
+}
+
+static size_t cmdbuf_push_data(
+        EcsCommandBuffer *cmdbuf, void const *bytes, size_t size) {
+    size_t offset = vector_size(cmdbuf->data);
+    size_t new_size = offset + size;
+
+    if (new_size > vector_capacity(cmdbuf->data)) {
+        size_t capacity =
+                max(new_size, vector_capacity(cmdbuf->data) * 2);
+        vector_reserve(cmdbuf->data, capacity);
+    }
+
+    vector_resize(cmdbuf->data, new_size);
+    memcpy(cmdbuf->data + offset, bytes, size);
+
+    return offset;
+}
+
+void ecs_cmdbuf_spawn(EcsCommandBuffer *cmdbuf,
+        EntityBuilder *builder,
+        Entity *entity_out) {
+    uint8_t *storage = builder->heap_storage ? builder->heap_storage
+                                             : builder->inline_storage;
+
+    EcsCommand command = {
+            .type = ECS_COMMAND_SPAWN,
+            .entity = ENTITY_INVALID,
+            .mask = builder->mask,
+            .entity_out = entity_out,
+            .first_component = vector_size(cmdbuf->components),
+            .num_components = builder->num_components,
+    };
+
+    for (size_t i = 0; i < builder->num_components; i++) {
+        Index component_id = builder->component_ids[i];
+
+        EcsCommandComponent component = {
+                .component_id = component_id,
+                .offset = cmdbuf_push_data(cmdbuf,
+                        storage + builder->component_offsets[i],
+                        cmdbuf->world->component_sizes[component_id]),
+        };
+
+        vector_append(cmdbuf->components, component);
+    }
+
+    vector_append(cmdbuf->commands, command);
+    entity_builder_destroy(builder);
+}
+
+void ecs_cmdbuf_despawn(EcsCommandBuffer *cmdbuf, Entity entity) {
+    EcsCommand command = {
+            .type = ECS_COMMAND_DESPAWN,
+            .entity = entity,
+    };
+
+    vector_append(cmdbuf->commands, command);
+}
+
+void ecs_cmdbuf_add_component(EcsCommandBuffer *cmdbuf,
+        Entity entity,
+        Index component_id,
+        void const *component) {
+    EcsCommandComponent command_component = {
+            .component_id = component_id,
+            .offset = SIZE_MAX,
+    };
+
+    if (component) {
+        command_component.offset = cmdbuf_push_data(cmdbuf,
+                component,
+                cmdbuf->world->component_sizes[component_id]);
+    }
+
+    EcsCommand command = {
+            .type = ECS_COMMAND_ADD_COMPONENT,
+            .entity = entity,
+            .first_component = vector_size(cmdbuf->components),
+            .num_components = 1,
+    };
+
+    vector_append(cmdbuf->components, command_component);
+    vector_append(cmdbuf->commands, command);
+}
+
+void ecs_cmdbuf_remove_component(
+        EcsCommandBuffer *cmdbuf, Entity entity, Index component_id) {
+    EcsCommandComponent command_component = {
+            .component_id = component_id,
+            .offset = SIZE_MAX,
+    };
+
+    EcsCommand command = {
+            .type = ECS_COMMAND_REMOVE_COMPONENT,
+            .entity = entity,
+            .first_component = vector_size(cmdbuf->components),
+            .num_components = 1,
+    };
+
+    vector_append(cmdbuf->components, command_component);
+    vector_append(cmdbuf->commands, command);
+}
+
+static int compare_spawn_refs(void const *a, void const *b) {
+    SpawnRef const *ref_a = a;
+    SpawnRef const *ref_b = b;
+
+    if (ref_a->hash != ref_b->hash) {
+        return ref_a->hash < ref_b->hash ? -1 : 1;
+    }
+
+    ComponentMask const *mask_a = &ref_a->command->mask;
+    ComponentMask const *mask_b = &ref_b->command->mask;
+
+    // equal hashes almost always mean equal masks, but a collision still
+    // has to end up in its own group
+    for (size_t i = 0; i < COMPONENT_MASK_WORDS; i++) {
+        if (mask_a->words[i] != mask_b->words[i]) {
+            return mask_a->words[i] < mask_b->words[i] ? -1 : 1;
+        }
+    }
+
+    return ref_a->order < ref_b->order ? -1 : ref_a->order > ref_b->order;
+}
+
+static void flush_spawn_group(
+        World *world, SpawnRef const *group, size_t count) {
+    Entity *entities = sunset_malloc(count * sizeof(Entity));
+
+    SpanIterator it = ecs_spawn_batch(
+            world, group[0].command->mask, count, entities);
+    ArchetypeSpan span;
+    size_t spawned = 0;
+
+    while (spanit_next(&it, &span)) {
+        for (size_t i = 0; i < span.count; i++) {
+            EcsCommandBuffer const *cmdbuf = group[spawned + i].cmdbuf;
+            EcsCommand const *command = group[spawned + i].command;
+
+            for (size_t j = 0; j < command->num_components; j++) {
+                EcsCommandComponent const *component =
+                        &cmdbuf->components[command->first_component + j];
+
+                ecs_write_component(world,
+                        span_get_entityptr(&span, i),
+                        component->component_id,
+                        cmdbuf->data + component->offset);
+            }
+
+            if (command->entity_out) {
+                *command->entity_out = entities[spawned + i];
+            }
+        }
+
+        spawned += span.count;
+    }
+
+    free(entities);
+}
+
+static void flush_spawns(
+        EcsCommandBuffer *cmdbufs, size_t num_cmdbufs, World *world) {
+    vector(SpawnRef) spawns;
+    vector_init(spawns);
+
+    for (size_t i = 0; i < num_cmdbufs; i++) {
+        EcsCommandBuffer const *cmdbuf = &cmdbufs[i];
+
+        for (size_t j = 0; j < vector_size(cmdbuf->commands); j++) {
+            EcsCommand const *command = &cmdbuf->commands[j];
+
+            if (command->type != ECS_COMMAND_SPAWN) {
+                continue;
+            }
+
+            SpawnRef ref = {
+                    .hash = cmask_hash(&command->mask),
+                    .cmdbuf = cmdbuf,
+                    .command = command,
+                    .order = vector_size(spawns),
+            };
+
+            vector_append(spawns, ref);
+        }
+    }
+
+    qsort(spawns,
+            vector_size(spawns),
+            sizeof(SpawnRef),
+            compare_spawn_refs);
+
+    size_t group_begin = 0;
+
+    for (size_t i = 1; i <= vector_size(spawns); i++) {
+        if (i < vector_size(spawns)
+                && spawns[i].hash == spawns[group_begin].hash
+                && cmask_is_eql(&spawns[i].command->mask,
+                        &spawns[group_begin].command->mask)) {
+            continue;
+        }
+
+        flush_spawn_group(world, &spawns[group_begin], i - group_begin);
+        group_begin = i;
+    }
+
+    vector_destroy(spawns);
+}
+
+/// groups by archetype, highest row first. a swap remove then only ever
+/// moves a row that stays, and every target's own commands keep the
+/// order they were recorded in. stale targets go last, applying their
+/// commands does nothing.
+static int compare_command_refs(void const *a, void const *b) {
+    CommandRef const *ref_a = a;
+    CommandRef const *ref_b = b;
+
+    if (ref_a->stale != ref_b->stale) {
+        return ref_a->stale ? 1 : -1;
+    }
+
+    if (ref_a->eptr.archetype != ref_b->eptr.archetype) {
+        return ref_a->eptr.archetype < ref_b->eptr.archetype ? -1 : 1;
+    }
+
+    if (ref_a->eptr.element != ref_b->eptr.element) {
+        return ref_a->eptr.element > ref_b->eptr.element ? -1 : 1;
+    }
+
+    return ref_a->order < ref_b->order ? -1 : ref_a->order > ref_b->order;
+}
+
+static void apply_command(World *world,
+        EcsCommandBuffer const *cmdbuf,
+        EcsCommand const *command) {
+    // only meaningful for component commands
+    EcsCommandComponent const *component =
+            cmdbuf->components + command->first_component;
+
+    switch (command->type) {
+        case ECS_COMMAND_SPAWN:
+            break;
+        case ECS_COMMAND_DESPAWN:
+            ecs_remove_entity(world, command->entity);
+            break;
+        case ECS_COMMAND_ADD_COMPONENT:
+            ecs_add_component(world,
+                    command->entity,
+                    component->component_id,
+                    component->offset == SIZE_MAX
+                            ? NULL
+                            : cmdbuf->data + component->offset);
+            break;
+        case ECS_COMMAND_REMOVE_COMPONENT:
+            ecs_remove_component(
+                    world, command->entity, component->component_id);
+            break;
+    }
+}
+
+void ecs_cmdbuf_flush(
+        EcsCommandBuffer *cmdbufs, size_t num_cmdbufs, World *world) {
+    flush_spawns(cmdbufs, num_cmdbufs, world);
+
+    vector(CommandRef) refs;
+    vector_init(refs);
+
+    for (size_t i = 0; i < num_cmdbufs; i++) {
+        EcsCommandBuffer const *cmdbuf = &cmdbufs[i];
+
+        for (size_t j = 0; j < vector_size(cmdbuf->commands); j++) {
+            EcsCommand const *command = &cmdbuf->commands[j];
+
+            if (command->type == ECS_COMMAND_SPAWN) {
+                continue;
+            }
+
+            // a target despawned by an earlier command of the same
+            // flush keeps its place, the commands after the despawn find
+            // it gone
+            EntityPtr eptr = ecs_entity_ptr(world, command->entity);
+            CommandRef ref = {
+                    .eptr = eptr,
+                    .stale = eptr_eql(eptr, ENTITY_PTR_INVALID),
+                    .cmdbuf = cmdbuf,
+                    .command = command,
+                    .order = vector_size(refs),
+            };
+
+            vector_append(refs, ref);
+        }
+    }
+
+    qsort(refs,
+            vector_size(refs),
+            sizeof(CommandRef),
+            compare_command_refs);
+
+    for (size_t i = 0; i < vector_size(refs); i++) {
+        apply_command(world, refs[i].cmdbuf, refs[i].command);
+    }
+
+    vector_destroy(refs);
+
+    for (size_t i = 0; i < num_cmdbufs; i++) {
+        cmdbuf_clear(&cmdbufs[i]);
+    }
+}
@@ -15,9 +15,13 @@
 #include "sunset/ecs.h"
 #include "sunset/errors.h"
 #include "sunset/events.h"
+#include "sunset/fixed_step.h"
 #include "sunset/input.h"
+#include "sunset/physics_system.h"
 #include "sunset/render.h"
 #include "sunset/rman.h"
+#include "sunset/scheduler.h"
+#include "sunset/thread_pool.h"
 #include "sunset/ui.h"
 #include "sunset/vector.h"
 
@@ -78,6 +82,15 @@ static int engine_setup(EngineContext *context,
     rman_init(&context->rman);
     ecs_init(&context->world);
 
+    if ((err = thread_pool_init(&context->thread_pool,
+                 thread_pool_default_num_threads()))) {
+        log_error("Could not start worker threads");
+        return err;
+    }
+
+    scheduler_init(
+            &context->scheduler, &context->world, &context->thread_pool);
+
     // backend setup
 
     cmdbuf_init(&context->cmdbuf, COMMAND_BUFFER_DEFAULT);
@@ -108,13 +121,23 @@ static int engine_setup(EngineContext *context,
 
     render_setup(context);
 
+    physics_world_init(
+            &context->physics, &context->world, &context->event_queue);
+    physics_add_system(&context->physics, &context->scheduler);
+
     // engine setup
 
     ui_setup(context);
 
     input_setup(context);
 
-    context->dt = FRAME_TIME_S;
+    float tick_rate = game->tick_rate > 0.0f
+            ? game->tick_rate
+            : ENGINE_DEFAULT_TICK_RATE;
+
+    context->dt = 1.0f / tick_rate;
+    fixed_step_init(
+            &context->fixed_step, context->dt, FIXED_STEP_MAX_SUBSTEPS);
 
     vector_init(context->loaded_plugins);
     vector_resize(context->loaded_plugins, vector_size(game->plugins));
@@ -130,14 +153,15 @@ static int engine_setup(EngineContext *context,
     return 0;
 }
 
+/// advances the simulation by `context->dt`
 static int engine_tick(EngineContext *context) {
     event_queue_process_one(context,
             &context->event_queue,
             (Event){.event_id = SYSTEM_EVENT_TICK});
 
-    backend_generate_input_events(&context->render_context);
+    scheduler_run(&context->scheduler, context->dt);
 
-    event_queue_process(&context->event_queue, context);
+    transform_propagate(&context->world, &context->thread_pool);
 
     return 0;
 }
@@ -171,15 +195,37 @@ int engine_run(RenderConfig render_config, Game const *game) {
             (EventHandler){.handler_fn = camera_viewport_handler,
                     .local_context = &context.camera});
 
+    Time last_frame = get_time();
+
     while (!backend_should_stop(&context.render_context)) {
         Time start = get_time();
 
-        if ((retval = engine_tick(&context))) {
-            goto cleanup;
+        // measured from the start of the previous frame, so it includes
+        // the time spent drawing and sleeping
+        float elapsed = time_since_s(last_frame);
+        last_frame = start;
+
+        size_t num_ticks =
+                fixed_step_advance(&context.fixed_step, elapsed);
+
+        for (size_t i = 0; i < num_ticks; i++) {
+            if ((retval = engine_tick(&context))) {
+                goto cleanup;
+            }
         }
 
+        backend_generate_input_events(&context.render_context);
+
+        event_queue_process(&context.event_queue, &context);
+
+        // handlers may have moved entities, on frames without a tick too
+        transform_propagate_frame(&context.world, &context.thread_pool);
+
         // TODO: multi camera support
-        render_world(&context.world, &context.camera, &context.cmdbuf);
+        render_world(&context.world,
+                &context.camera,
+                fixed_step_alpha(&context.fixed_step),
+                &context.cmdbuf);
 
         float frame_time = time_since_s(start);
 
@@ -205,7 +251,12 @@ int engine_run(RenderConfig render_config, Game const *game) {
     }
 
 cleanup:
+    engine_destroy(&context);
+    render_destroy();
+    physics_world_destroy(&context.physics);
     backend_destroy(&context.render_context);
+    scheduler_destroy(&context.scheduler);
+    thread_pool_destroy(&context.thread_pool);
 
     return retval;
 }
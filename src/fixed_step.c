@@ -0,0 +1,35 @@
+#include <stddef.h>
+
+#include "internal/math.h"
+
+#include "sunset/fixed_step.h"
+
+void fixed_step_init(
+        FixedStep *fixed_step, float step, size_t max_substeps) {
+    fixed_step->step = step;
+    fixed_step->accumulator = 0.0f;
+    fixed_step->max_substeps = max_substeps;
+}
+
+size_t fixed_step_advance(FixedStep *fixed_step, float frame_time) {
+    fixed_step->accumulator += max(frame_time, 0.0f);
+
+    size_t num_steps = 0;
+
+    while (fixed_step->accumulator >= fixed_step->step
+            && num_steps < fixed_step->max_substeps) {
+        fixed_step->accumulator -= fixed_step->step;
+        num_steps++;
+    }
+
+    // whatever couldn't be caught up on is dropped, but the blend
+    // between the last two ticks keeps going
+    float step = fixed_step->step;
+    fixed_step->accumulator = min(fixed_step->accumulator, step);
+
+    return num_steps;
+}
+
+float fixed_step_alpha(FixedStep const *fixed_step) {
+    return min(fixed_step->accumulator / fixed_step->step, 1.0f);
+}
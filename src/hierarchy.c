@@ -0,0 +1,311 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "internal/math.h"
+#include "internal/utils.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+#include "sunset/hierarchy.h"
+
+typedef struct PropagateContext {
+    Hierarchy *hierarchy;
+    /// range of `hierarchy->dirty_roots` of every task, followed by the
+    /// number of dirty roots
+    vector(uint32_t) task_offsets;
+    HierarchyFn fn;
+    void *ctx;
+} PropagateContext;
+
+void hierarchy_init(Hierarchy *hierarchy) {
+    vector_init(hierarchy->entity_parents);
+    hierarchy->num_entities = 0;
+
+    vector_init(hierarchy->entities);
+    vector_init(hierarchy->parents);
+    vector_init(hierarchy->entity_nodes);
+    vector_init(hierarchy->root_offsets);
+    vector_init(hierarchy->node_roots);
+    vector_init(hierarchy->dirty);
+    vector_init(hierarchy->root_dirty);
+    vector_init(hierarchy->dirty_roots);
+    hierarchy->layout_dirty = false;
+
+    vector_append(hierarchy->root_offsets, 0);
+}
+
+void hierarchy_destroy(Hierarchy *hierarchy) {
+    vector_destroy(hierarchy->entity_parents);
+    vector_destroy(hierarchy->entities);
+    vector_destroy(hierarchy->parents);
+    vector_destroy(hierarchy->entity_nodes);
+    vector_destroy(hierarchy->root_offsets);
+    vector_destroy(hierarchy->node_roots);
+    vector_destroy(hierarchy->dirty);
+    vector_destroy(hierarchy->root_dirty);
+    vector_destroy(hierarchy->dirty_roots);
+}
+
+void hierarchy_set_parent(
+        Hierarchy *hierarchy, Index entity, Index parent) {
+    size_t num_slots = vector_size(hierarchy->entity_parents);
+
+    if (entity >= num_slots) {
+        size_t new_num_slots = max((size_t)entity + 1, num_slots * 2);
+
+        vector_resize(hierarchy->entity_parents, new_num_slots);
+
+        for (size_t i = num_slots; i < new_num_slots; i++) {
+            hierarchy->entity_parents[i] = HIERARCHY_ABSENT;
+        }
+    }
+
+    Index *current = &hierarchy->entity_parents[entity];
+
+    if (*current == parent) {
+        return;
+    }
+
+    if (*current == HIERARCHY_ABSENT) {
+        hierarchy->num_entities++;
+    }
+
+    *current = parent;
+    hierarchy->layout_dirty = true;
+}
+
+void hierarchy_remove(Hierarchy *hierarchy, Index entity) {
+    if (!hierarchy_contains(hierarchy, entity)) {
+        return;
+    }
+
+    hierarchy->entity_parents[entity] = HIERARCHY_ABSENT;
+    hierarchy->num_entities--;
+    hierarchy->layout_dirty = true;
+}
+
+void hierarchy_detach_children(Hierarchy *hierarchy, Index entity) {
+    for (size_t i = 0; i < vector_size(hierarchy->entity_parents); i++) {
+        if (hierarchy->entity_parents[i] == entity) {
+            hierarchy->entity_parents[i] = HIERARCHY_ROOT;
+            hierarchy->layout_dirty = true;
+        }
+    }
+}
+
+bool hierarchy_contains(Hierarchy const *hierarchy, Index entity) {
+    return entity < vector_size(hierarchy->entity_parents)
+            && hierarchy->entity_parents[entity] != HIERARCHY_ABSENT;
+}
+
+void hierarchy_mark_dirty(Hierarchy *hierarchy, Index entity) {
+    // every node is visited after a relayout anyway
+    if (hierarchy->layout_dirty
+            || entity >= vector_size(hierarchy->entity_nodes)) {
+        return;
+    }
+
+    uint32_t node = hierarchy->entity_nodes[entity];
+
+    if (node == HIERARCHY_ABSENT) {
+        return;
+    }
+
+    hierarchy->dirty[node] = true;
+
+    uint32_t root = hierarchy->node_roots[node];
+
+    if (!hierarchy->root_dirty[root]) {
+        hierarchy->root_dirty[root] = true;
+        vector_append(hierarchy->dirty_roots, root);
+    }
+}
+
+static bool entity_is_root(Hierarchy const *hierarchy, Index entity) {
+    Index parent = hierarchy->entity_parents[entity];
+
+    return parent == HIERARCHY_ROOT
+            || parent >= vector_size(hierarchy->entity_parents)
+            || hierarchy->entity_parents[parent] == HIERARCHY_ABSENT;
+}
+
+/// lays out every root followed by its descendants in breadth first
+/// order, which sorts them by depth
+static void hierarchy_layout(Hierarchy *hierarchy) {
+    size_t num_slots = vector_size(hierarchy->entity_parents);
+    Index const *entity_parents = hierarchy->entity_parents;
+
+    // children of every entity slot, packed
+    vector(uint32_t) child_offsets;
+    vector_init(child_offsets);
+    vector_resize(child_offsets, num_slots + 1);
+
+    for (size_t i = 0; i < num_slots; i++) {
+        if (entity_parents[i] != HIERARCHY_ABSENT
+                && !entity_is_root(hierarchy, i)) {
+            child_offsets[entity_parents[i] + 1]++;
+        }
+    }
+
+    for (size_t i = 0; i < num_slots; i++) {
+        child_offsets[i + 1] += child_offsets[i];
+    }
+
+    size_t num_children = child_offsets[num_slots];
+
+    vector(Index) children;
+    vector_init(children);
+    vector_resize(children, num_children);
+
+    vector(uint32_t) next_child;
+    vector_init(next_child);
+    vector_resize(next_child, num_slots);
+    memcpy(next_child, child_offsets, num_slots * sizeof(uint32_t));
+
+    for (size_t i = 0; i < num_slots; i++) {
+        if (entity_parents[i] != HIERARCHY_ABSENT
+                && !entity_is_root(hierarchy, i)) {
+            children[next_child[entity_parents[i]]++] = i;
+        }
+    }
+
+    vector_clear(hierarchy->entities);
+    vector_clear(hierarchy->parents);
+    vector_clear(hierarchy->node_roots);
+    vector_clear(hierarchy->root_offsets);
+
+    vector_resize(hierarchy->entity_nodes, num_slots);
+    for (size_t i = 0; i < num_slots; i++) {
+        hierarchy->entity_nodes[i] = HIERARCHY_ABSENT;
+    }
+
+    for (size_t i = 0; i < num_slots; i++) {
+        if (entity_parents[i] == HIERARCHY_ABSENT
+                || !entity_is_root(hierarchy, i)) {
+            continue;
+        }
+
+        uint32_t root = vector_size(hierarchy->root_offsets);
+        uint32_t first = vector_size(hierarchy->entities);
+
+        vector_append(hierarchy->root_offsets, first);
+        vector_append(hierarchy->entities, i);
+        vector_append(hierarchy->parents, HIERARCHY_ROOT);
+
+        // the nodes appended so far double as the breadth first queue
+        for (uint32_t node = first;
+                node < vector_size(hierarchy->entities);
+                node++) {
+            Index entity = hierarchy->entities[node];
+
+            hierarchy->entity_nodes[entity] = node;
+            vector_append(hierarchy->node_roots, root);
+
+            for (size_t j = child_offsets[entity];
+                    j < child_offsets[entity + 1];
+                    j++) {
+                vector_append(hierarchy->entities, children[j]);
+                vector_append(hierarchy->parents, node);
+            }
+        }
+    }
+
+    size_t num_nodes = vector_size(hierarchy->entities);
+    size_t num_roots = vector_size(hierarchy->root_offsets);
+
+    vector_append(hierarchy->root_offsets, num_nodes);
+
+    vector_resize(hierarchy->dirty, num_nodes);
+    memset(hierarchy->dirty, true, num_nodes * sizeof(bool));
+
+    vector_resize(hierarchy->root_dirty, num_roots);
+    memset(hierarchy->root_dirty, true, num_roots * sizeof(bool));
+
+    vector_resize(hierarchy->dirty_roots, num_roots);
+    for (size_t i = 0; i < num_roots; i++) {
+        hierarchy->dirty_roots[i] = i;
+    }
+
+    hierarchy->layout_dirty = false;
+
+    vector_destroy(child_offsets);
+    vector_destroy(children);
+    vector_destroy(next_child);
+}
+
+static void propagate_task(
+        void *ctx, size_t task_index, size_t worker_index) {
+    unused(worker_index);
+
+    PropagateContext *propagate = ctx;
+    Hierarchy *hierarchy = propagate->hierarchy;
+
+    for (size_t i = propagate->task_offsets[task_index];
+            i < propagate->task_offsets[task_index + 1];
+            i++) {
+        uint32_t root = hierarchy->dirty_roots[i];
+        uint32_t begin = hierarchy->root_offsets[root];
+        uint32_t end = hierarchy->root_offsets[root + 1];
+
+        // parents come first, so their flag is final by the time their
+        // children are reached
+        for (uint32_t node = begin; node < end; node++) {
+            uint32_t parent = hierarchy->parents[node];
+
+            if (parent != HIERARCHY_ROOT && hierarchy->dirty[parent]) {
+                hierarchy->dirty[node] = true;
+            }
+
+            if (hierarchy->dirty[node]) {
+                propagate->fn(hierarchy, node, propagate->ctx);
+            }
+        }
+
+        memset(hierarchy->dirty + begin,
+                false,
+                (end - begin) * sizeof(bool));
+        hierarchy->root_dirty[root] = false;
+    }
+}
+
+void hierarchy_propagate(Hierarchy *hierarchy,
+        ThreadPool *pool,
+        HierarchyFn fn,
+        void *ctx) {
+    if (hierarchy->layout_dirty) {
+        hierarchy_layout(hierarchy);
+    }
+
+    PropagateContext propagate = {
+            .hierarchy = hierarchy,
+            .fn = fn,
+            .ctx = ctx,
+    };
+    vector_init(propagate.task_offsets);
+
+    // small roots are batched so that a task is worth handing out
+    size_t task_nodes = HIERARCHY_GRAIN_SIZE;
+
+    for (size_t i = 0; i < vector_size(hierarchy->dirty_roots); i++) {
+        uint32_t root = hierarchy->dirty_roots[i];
+
+        if (task_nodes >= HIERARCHY_GRAIN_SIZE) {
+            vector_append(propagate.task_offsets, i);
+            task_nodes = 0;
+        }
+
+        task_nodes += hierarchy->root_offsets[root + 1]
+                - hierarchy->root_offsets[root];
+    }
+
+    size_t num_tasks = vector_size(propagate.task_offsets);
+    vector_append(propagate.task_offsets,
+            vector_size(hierarchy->dirty_roots));
+
+    thread_pool_run(pool, num_tasks, propagate_task, &propagate);
+
+    vector_clear(hierarchy->dirty_roots);
+    vector_destroy(propagate.task_offsets);
+}
@@ -0,0 +1,78 @@
+#include <stddef.h>
+
+#include "internal/math.h"
+
+#include "sunset/integrate.h"
+
+void integrate_batch_scalar(IntegrateBatch *batch, size_t count, float dt) {
+    for (size_t lane = 0; lane < count; lane++) {
+        float damping = max(1.0f - batch->damping[lane] * dt, 0.0f);
+
+        for (size_t axis = 0; axis < 3; axis++) {
+            float velocity = batch->velocity[axis][lane]
+                    + batch->acceleration[axis][lane] * dt;
+
+            velocity *= damping;
+
+            batch->velocity[axis][lane] = velocity;
+            batch->position[axis][lane] += velocity * dt;
+        }
+    }
+}
+
+#if defined(INTEGRATE_AVX)
+
+void integrate_batch(IntegrateBatch *batch, float dt) {
+    __m256 step = _mm256_set1_ps(dt);
+    __m256 damping = _mm256_sub_ps(_mm256_set1_ps(1.0f),
+            _mm256_mul_ps(_mm256_load_ps(batch->damping), step));
+    damping = _mm256_max_ps(damping, _mm256_setzero_ps());
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        __m256 acceleration = _mm256_load_ps(batch->acceleration[axis]);
+        __m256 velocity = _mm256_load_ps(batch->velocity[axis]);
+        __m256 position = _mm256_load_ps(batch->position[axis]);
+
+        velocity = _mm256_add_ps(
+                velocity, _mm256_mul_ps(acceleration, step));
+        velocity = _mm256_mul_ps(velocity, damping);
+        position = _mm256_add_ps(position, _mm256_mul_ps(velocity, step));
+
+        _mm256_store_ps(batch->velocity[axis], velocity);
+        _mm256_store_ps(batch->position[axis], position);
+    }
+}
+
+#elif defined(INTEGRATE_SSE)
+
+void integrate_batch(IntegrateBatch *batch, float dt) {
+    __m128 step = _mm_set1_ps(dt);
+
+    for (size_t lane = 0; lane < INTEGRATE_LANES; lane += 4) {
+        __m128 damping = _mm_sub_ps(_mm_set1_ps(1.0f),
+                _mm_mul_ps(_mm_load_ps(&batch->damping[lane]), step));
+        damping = _mm_max_ps(damping, _mm_setzero_ps());
+
+        for (size_t axis = 0; axis < 3; axis++) {
+            __m128 acceleration =
+                    _mm_load_ps(&batch->acceleration[axis][lane]);
+            __m128 velocity = _mm_load_ps(&batch->velocity[axis][lane]);
+            __m128 position = _mm_load_ps(&batch->position[axis][lane]);
+
+            velocity = _mm_add_ps(velocity, _mm_mul_ps(acceleration, step));
+            velocity = _mm_mul_ps(velocity, damping);
+            position = _mm_add_ps(position, _mm_mul_ps(velocity, step));
+
+            _mm_store_ps(&batch->velocity[axis][lane], velocity);
+            _mm_store_ps(&batch->position[axis][lane], position);
+        }
+    }
+}
+
+#else
+
+void integrate_batch(IntegrateBatch *batch, float dt) {
+    integrate_batch_scalar(batch, INTEGRATE_LANES, dt);
+}
+
+#endif
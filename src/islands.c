@@ -0,0 +1,187 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/utils.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+#include "sunset/islands.h"
+
+#define ISLAND_NONE UINT32_MAX
+
+typedef struct IslandsContext {
+    ContactIslands *islands;
+    ContactIslandFn fn;
+    void *ctx;
+} IslandsContext;
+
+void contact_islands_init(ContactIslands *islands) {
+    vector_init(islands->parents);
+    vector_init(islands->body_islands);
+    vector_init(islands->island_offsets);
+    vector_init(islands->island_pairs);
+    vector_init(islands->task_offsets);
+}
+
+void contact_islands_destroy(ContactIslands *islands) {
+    vector_destroy(islands->parents);
+    vector_destroy(islands->body_islands);
+    vector_destroy(islands->island_offsets);
+    vector_destroy(islands->island_pairs);
+    vector_destroy(islands->task_offsets);
+}
+
+static uint32_t island_find(ContactIslands *islands, uint32_t body) {
+    uint32_t *parents = islands->parents;
+
+    while (parents[body] != body) {
+        // path halving
+        parents[body] = parents[parents[body]];
+        body = parents[body];
+    }
+
+    return body;
+}
+
+/// the lower root wins, which keeps the forest independent of how the
+/// unions happened to be ordered
+static void island_union(ContactIslands *islands, uint32_t a, uint32_t b) {
+    a = island_find(islands, a);
+    b = island_find(islands, b);
+
+    if (a < b) {
+        islands->parents[b] = a;
+    } else if (b < a) {
+        islands->parents[a] = b;
+    }
+}
+
+/// body whose root is the island of the pair, or `ISLAND_NONE` if both
+/// are fixed
+static uint32_t pair_body(bool const *fixed, BroadphasePair pair) {
+    if (!fixed[pair.a]) {
+        return pair.a;
+    }
+
+    return fixed[pair.b] ? ISLAND_NONE : pair.b;
+}
+
+void contact_islands_build(ContactIslands *islands,
+        size_t num_bodies,
+        bool const *fixed,
+        BroadphasePair const *pairs,
+        size_t num_pairs) {
+    vector_resize(islands->parents, num_bodies);
+    vector_resize(islands->body_islands, num_bodies);
+
+    for (size_t i = 0; i < num_bodies; i++) {
+        islands->parents[i] = i;
+        islands->body_islands[i] = ISLAND_NONE;
+    }
+
+    for (size_t i = 0; i < num_pairs; i++) {
+        if (!fixed[pairs[i].a] && !fixed[pairs[i].b]) {
+            island_union(islands, pairs[i].a, pairs[i].b);
+        }
+    }
+
+    // counts pairs per island first, `island_offsets` is shifted by one
+    // so that the prefix sum below leaves the first pair of every island
+    vector_clear(islands->island_offsets);
+    vector_append(islands->island_offsets, 0);
+
+    for (size_t i = 0; i < num_pairs; i++) {
+        uint32_t body = pair_body(fixed, pairs[i]);
+
+        if (body == ISLAND_NONE) {
+            continue;
+        }
+
+        uint32_t root = island_find(islands, body);
+
+        if (islands->body_islands[root] == ISLAND_NONE) {
+            islands->body_islands[root] =
+                    vector_size(islands->island_offsets) - 1;
+            vector_append(islands->island_offsets, 0);
+        }
+
+        islands->island_offsets[islands->body_islands[root] + 1]++;
+    }
+
+    size_t num_islands = vector_size(islands->island_offsets) - 1;
+
+    for (size_t i = 0; i < num_islands; i++) {
+        islands->island_offsets[i + 1] += islands->island_offsets[i];
+    }
+
+    size_t num_island_pairs = islands->island_offsets[num_islands];
+    vector_resize(islands->island_pairs, num_island_pairs);
+
+    // `task_offsets` doubles as the fill position of every island
+    vector_resize(islands->task_offsets, num_islands);
+    for (size_t i = 0; i < num_islands; i++) {
+        islands->task_offsets[i] = islands->island_offsets[i];
+    }
+
+    for (size_t i = 0; i < num_pairs; i++) {
+        uint32_t body = pair_body(fixed, pairs[i]);
+
+        if (body == ISLAND_NONE) {
+            continue;
+        }
+
+        uint32_t island =
+                islands->body_islands[island_find(islands, body)];
+        islands->island_pairs[islands->task_offsets[island]++] = i;
+    }
+}
+
+size_t contact_islands_count(ContactIslands const *islands) {
+    size_t num_offsets = vector_size(islands->island_offsets);
+    return num_offsets > 0 ? num_offsets - 1 : 0;
+}
+
+static void islands_task(
+        void *ctx, size_t task_index, size_t worker_index) {
+    IslandsContext *context = ctx;
+    ContactIslands *islands = context->islands;
+
+    for (uint32_t island = islands->task_offsets[task_index];
+            island < islands->task_offsets[task_index + 1];
+            island++) {
+        context->fn(islands, island, worker_index, context->ctx);
+    }
+}
+
+void contact_islands_run(ContactIslands *islands,
+        ThreadPool *pool,
+        ContactIslandFn fn,
+        void *ctx) {
+    size_t num_islands = contact_islands_count(islands);
+
+    // small islands are batched so that a task is worth handing out
+    vector_clear(islands->task_offsets);
+    size_t task_pairs = ISLAND_GRAIN_SIZE;
+
+    for (size_t i = 0; i < num_islands; i++) {
+        if (task_pairs >= ISLAND_GRAIN_SIZE) {
+            vector_append(islands->task_offsets, i);
+            task_pairs = 0;
+        }
+
+        task_pairs +=
+                islands->island_offsets[i + 1] - islands->island_offsets[i];
+    }
+
+    size_t num_tasks = vector_size(islands->task_offsets);
+    vector_append(islands->task_offsets, num_islands);
+
+    IslandsContext context = {
+            .islands = islands,
+            .fn = fn,
+            .ctx = ctx,
+    };
+
+    thread_pool_run(pool, num_tasks, islands_task, &context);
+}
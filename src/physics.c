@@ -546,27 +546,3 @@ void physics_step(struct physics *physics,
     vector_destroy(physics->collision_pairs);
     physics->collision_pairs = new_collisions;
 }
-
-DECLARE_COMPONENT_ID(PhysicsState);
-
-void physics_callback(EngineContext *engine_context,
-        void *physics,
-        struct event /* engine tick */) {
-    Bitmask bitmask;
-    bitmask_init_empty(ECS_MAX_COMPONENTS, &bitmask);
-
-    bitmask_set(&bitmask, COMPONENT_ID(PhysicsState));
-    bitmask_set(&bitmask, COMPONENT_ID(Transform));
-
-    WorldIterator it = worldit_create(&engine_context->world, bitmask);
-
-    while (worldit_is_valid(&it)) {
-        PhysicsState *ps =
-                worldit_get_component(&it, COMPONENT_ID(PhysicsState));
-        Transform *t = worldit_get_component(&it, COMPONENT_ID(Transform));
-
-        // TODO: use these
-
-        worldit_advance(&it);
-    }
-}
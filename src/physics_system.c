@@ -0,0 +1,583 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <cglm/vec3.h>
+
+#include "internal/math.h"
+#include "internal/utils.h"
+#include "sunset/broadphase.h"
+#include "sunset/ecs.h"
+#include "sunset/events.h"
+#include "sunset/geometry.h"
+#include "sunset/integrate.h"
+#include "sunset/islands.h"
+#include "sunset/map.h"
+#include "sunset/render.h"
+#include "sunset/scheduler.h"
+#include "sunset/vector.h"
+
+#include "sunset/physics_system.h"
+
+#define VELOCITY_EPSILON 0.1
+
+DECLARE_COMPONENT_ID(PhysicsState);
+
+void physics_world_init(
+        PhysicsWorld *physics, World *world, EventQueue *event_queue) {
+    REGISTER_COMPONENT(world, PhysicsState);
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(PhysicsState));
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Bounds));
+
+    query_init(&physics->body_query, mask);
+    vector_init(physics->body_offsets);
+
+    broadphase_init(&physics->broadphase);
+    vector_init(physics->body_proxies);
+    vector_init(physics->proxy_bodies);
+    vector_init(physics->proxy_steps);
+    vector_init(physics->proxy_fixed);
+    physics->step = 0;
+
+    contact_islands_init(&physics->islands);
+    vector_init(physics->contacts);
+    physics->solver_iterations = PHYSICS_SOLVER_ITERATIONS;
+    map_init(physics->contact_cache);
+
+    physics->event_queue = event_queue;
+    physics->pool = NULL;
+}
+
+void physics_world_destroy(PhysicsWorld *physics) {
+    query_destroy(&physics->body_query);
+    vector_destroy(physics->body_offsets);
+
+    broadphase_destroy(&physics->broadphase);
+    vector_destroy(physics->body_proxies);
+    vector_destroy(physics->proxy_bodies);
+    vector_destroy(physics->proxy_steps);
+    vector_destroy(physics->proxy_fixed);
+
+    contact_islands_destroy(&physics->islands);
+    vector_destroy(physics->contacts);
+    vector_destroy(physics->contact_cache);
+}
+
+static struct physics_material combine_materials(
+        struct physics_material a, struct physics_material b) {
+    return (struct physics_material){
+            .friction = a.friction * b.friction,
+            .restitution = a.restitution * b.restitution,
+    };
+}
+
+static void physics_sync_proxies(PhysicsWorld *physics, World *world) {
+    uint32_t step = ++physics->step;
+    Broadphase *broadphase = &physics->broadphase;
+
+    WorldIterator it = worldit_from_query(world, &physics->body_query);
+
+    while (worldit_is_valid(&it)) {
+        Entity entity = worldit_get_entity(&it);
+        Index slot = entity_index(entity);
+        PhysicsState const *state =
+                worldit_get_component(&it, COMPONENT_ID(PhysicsState));
+        Bounds *bounds = worldit_get_component(&it, COMPONENT_ID(Bounds));
+
+        // the bounds only catch up with the integrated position on the
+        // next `transform_propagate`
+        AABB box = bounds->box;
+        aabb_translate(&box, physics->body_offsets[slot]);
+
+        size_t num_slots = vector_size(physics->body_proxies);
+
+        if (slot >= num_slots) {
+            size_t new_num_slots = max((size_t)slot + 1, num_slots * 2);
+
+            vector_resize(physics->body_proxies, new_num_slots);
+
+            for (size_t i = num_slots; i < new_num_slots; i++) {
+                physics->body_proxies[i] = BROADPHASE_PROXY_NONE;
+            }
+        }
+
+        uint32_t proxy = physics->body_proxies[slot];
+
+        if (proxy == BROADPHASE_PROXY_NONE) {
+            proxy = broadphase_add(broadphase, &box);
+            physics->body_proxies[slot] = proxy;
+
+            if (proxy >= vector_size(physics->proxy_bodies)) {
+                vector_append(physics->proxy_bodies, entity);
+                vector_append(physics->proxy_steps, step);
+                vector_append(physics->proxy_fixed, false);
+            }
+        } else {
+            broadphase_update(broadphase, proxy, &box);
+        }
+
+        // the slot may have been taken over by a new entity since the
+        // last step, which then inherits the proxy
+        physics->proxy_bodies[proxy] = entity;
+        physics->proxy_steps[proxy] = step;
+        physics->proxy_fixed[proxy] =
+                state->type == PHYSICS_OBJECT_INFINITE;
+
+        worldit_advance(&it);
+    }
+
+    for (size_t proxy = 0; proxy < vector_size(broadphase->live); proxy++) {
+        if (broadphase->live[proxy]
+                && physics->proxy_steps[proxy] != step) {
+            broadphase_remove(broadphase, proxy);
+            Index slot = entity_index(physics->proxy_bodies[proxy]);
+            physics->body_proxies[slot] = BROADPHASE_PROXY_NONE;
+        }
+    }
+}
+
+static float inverse_mass(PhysicsState const *state) {
+    if (state->type == PHYSICS_OBJECT_INFINITE || state->mass <= 0.0f) {
+        return 0.0f;
+    }
+
+    return 1.0f / state->mass;
+}
+
+typedef struct IntegrateContext {
+    vec3 *body_offsets;
+    float dt;
+} IntegrateContext;
+
+/// stages up to `INTEGRATE_LANES` rows starting at `begin`, runs the
+/// kernel and writes them back along with how far they moved
+static void integrate_rows(IntegrateContext const *integrate,
+        ArchetypeSpan const *span,
+        PhysicsState *states,
+        Position *positions,
+        size_t begin,
+        size_t count) {
+    IntegrateBatch batch;
+
+    for (size_t lane = 0; lane < count; lane++) {
+        PhysicsState const *state = &states[begin + lane];
+        float const *position = positions[begin + lane].value;
+
+        for (size_t axis = 0; axis < 3; axis++) {
+            batch.position[axis][lane] = position[axis];
+            batch.velocity[axis][lane] = state->velocity[axis];
+            batch.acceleration[axis][lane] = state->acceleration[axis];
+        }
+
+        if (state->flags & PHYSICS_FLAGS_APPLY_GRAVITY) {
+            batch.acceleration[1][lane] -= PHYSICS_GRAVITY;
+        }
+
+        batch.damping[lane] = state->damping;
+    }
+
+    if (count == INTEGRATE_LANES) {
+        integrate_batch(&batch, integrate->dt);
+    } else {
+        integrate_batch_scalar(&batch, count, integrate->dt);
+    }
+
+    for (size_t lane = 0; lane < count; lane++) {
+        PhysicsState *state = &states[begin + lane];
+        float *position = positions[begin + lane].value;
+        Index slot = span->archetype->entities[span->begin + begin + lane];
+        float *offset = integrate->body_offsets[slot];
+
+        // the lane was integrated along with the others, but nothing
+        // moves a body of infinite mass
+        if (inverse_mass(state) == 0.0f) {
+            glm_vec3_zero(offset);
+            continue;
+        }
+
+        for (size_t axis = 0; axis < 3; axis++) {
+            offset[axis] = batch.position[axis][lane] - position[axis];
+            position[axis] = batch.position[axis][lane];
+            state->velocity[axis] = batch.velocity[axis][lane];
+        }
+    }
+}
+
+static void integrate_span(World *world,
+        ArchetypeSpan const *span,
+        size_t worker_index,
+        void *ctx) {
+    unused(worker_index);
+
+    IntegrateContext const *integrate = ctx;
+    PhysicsState *states = span_column(span, PhysicsState);
+    Position *positions = span_column(span, Position);
+
+    for (size_t i = 0; i < span->count; i += INTEGRATE_LANES) {
+        size_t count = min(span->count - i, (size_t)INTEGRATE_LANES);
+        integrate_rows(integrate, span, states, positions, i, count);
+    }
+
+    span_mark_changed(world, span, COMPONENT_ID(PhysicsState));
+    span_mark_changed(world, span, COMPONENT_ID(Position));
+}
+
+void physics_integrate(PhysicsWorld *physics,
+        World *world,
+        ThreadPool *pool,
+        float dt) {
+    // sized up front, spans write the slots of their rows concurrently
+    vector_resize(physics->body_offsets, vector_size(world->entity_ptrs));
+
+    IntegrateContext integrate = {
+            .body_offsets = physics->body_offsets,
+            .dt = dt,
+    };
+
+    ecs_par_for(world,
+            &physics->body_query,
+            pool,
+            0,
+            integrate_span,
+            &integrate);
+}
+
+typedef struct SolveContext {
+    PhysicsWorld *physics;
+    World *world;
+    float dt;
+} SolveContext;
+
+/// boxes touch when they overlap on every axis, the contact normal is the
+/// axis of least overlap
+static Contact contact_from_boxes(
+        uint32_t a, uint32_t b, AABB const *box_a, AABB const *box_b) {
+    Contact contact = {.a = a, .b = b, .depth = INFINITY};
+    size_t normal_axis = 0;
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        float overlap = min(box_a->max[axis], box_b->max[axis])
+                - max(box_a->min[axis], box_b->min[axis]);
+
+        if (overlap < 0.0f) {
+            return (Contact){.a = a, .b = b};
+        }
+
+        if (overlap < contact.depth) {
+            contact.depth = overlap;
+            normal_axis = axis;
+        }
+    }
+
+    float center_a = box_a->min[normal_axis] + box_a->max[normal_axis];
+    float center_b = box_b->min[normal_axis] + box_b->max[normal_axis];
+
+    contact.normal[normal_axis] = center_b >= center_a ? 1.0f : -1.0f;
+    contact.touching = true;
+
+    return contact;
+}
+
+static Order compare_cached_contacts(void const *a, void const *b) {
+    CachedContact const *contact_a = a;
+    CachedContact const *contact_b = b;
+
+    if (contact_a->a != contact_b->a) {
+        return contact_a->a < contact_b->a ? ORDER_LESS_THAN
+                                           : ORDER_GREATER_THAN;
+    }
+
+    if (contact_a->b != contact_b->b) {
+        return contact_a->b < contact_b->b ? ORDER_LESS_THAN
+                                           : ORDER_GREATER_THAN;
+    }
+
+    return ORDER_EQUAL;
+}
+
+static int sort_cached_contacts(void const *a, void const *b) {
+    return compare_cached_contacts(a, b);
+}
+
+/// bodies of infinite mass are left untouched, they may be part of
+/// islands solved concurrently
+static void contact_apply_impulse(Contact const *contact, float impulse) {
+    vec3 normal;
+    glm_vec3_copy((float *)contact->normal, normal);
+
+    if (contact->inverse_mass_a > 0.0f) {
+        glm_vec3_muladds(normal,
+                -impulse * contact->inverse_mass_a,
+                contact->body_a->velocity);
+    }
+
+    if (contact->inverse_mass_b > 0.0f) {
+        glm_vec3_muladds(normal,
+                impulse * contact->inverse_mass_b,
+                contact->body_b->velocity);
+    }
+}
+
+static float contact_normal_velocity(Contact const *contact) {
+    vec3 relative_velocity;
+    glm_vec3_sub(contact->body_b->velocity,
+            contact->body_a->velocity,
+            relative_velocity);
+
+    return glm_vec3_dot(relative_velocity, (float *)contact->normal);
+}
+
+/// looks up the bodies and the velocity to aim for, and picks up the
+/// impulse the same contact ended the previous tick with. contacts the
+/// bodies don't respond to keep `body_a` NULL.
+static void contact_prepare(PhysicsWorld const *physics,
+        World *world,
+        Contact *contact,
+        float dt) {
+    Entity entity_a = physics->proxy_bodies[contact->a];
+    Entity entity_b = physics->proxy_bodies[contact->b];
+    PhysicsState *a = ecs_get_component(
+            world, entity_a, COMPONENT_ID(PhysicsState));
+    PhysicsState *b = ecs_get_component(
+            world, entity_b, COMPONENT_ID(PhysicsState));
+
+    if (one_matches(PHYSICS_OBJECT_COLLIDER, a->type, b->type)) {
+        return;
+    }
+
+    contact->inverse_mass_a = inverse_mass(a);
+    contact->inverse_mass_b = inverse_mass(b);
+
+    if (contact->inverse_mass_a + contact->inverse_mass_b == 0.0f) {
+        return;
+    }
+
+    contact->body_a = a;
+    contact->body_b = b;
+
+    // bodies approaching fast enough bounce off, and penetration is
+    // worked off over the following ticks
+    float normal_velocity = contact_normal_velocity(contact);
+    float restitution = combine_materials(a->material, b->material)
+                                .restitution;
+
+    contact->velocity_bias = PHYSICS_BAUMGARTE / dt
+            * max(contact->depth - PHYSICS_PENETRATION_SLOP, 0.0f);
+
+    if (normal_velocity < -VELOCITY_EPSILON) {
+        contact->velocity_bias += -restitution * normal_velocity;
+    }
+
+    // the cache is only read while islands are solved, so concurrent
+    // lookups are fine
+    CachedContact key = {.a = entity_a, .b = entity_b};
+    CachedContact const *cached = map_get(
+            physics->contact_cache, key, compare_cached_contacts);
+
+    contact->impulse = 0.0f;
+
+    if (!cached) {
+        return;
+    }
+
+    vec3 cached_normal;
+    glm_vec3_copy((float *)cached->normal, cached_normal);
+
+    // a contact that flipped its normal starts over
+    if (glm_vec3_dot(cached_normal, contact->normal) > 0.0f) {
+        contact->impulse = cached->impulse;
+    }
+}
+
+/// one sequential impulse step, clamping the accumulated impulse so that
+/// contacts only ever push
+static void contact_solve(Contact *contact) {
+    float inverse_sum = contact->inverse_mass_a + contact->inverse_mass_b;
+    float normal_velocity = contact_normal_velocity(contact);
+
+    float delta =
+            (contact->velocity_bias - normal_velocity) / inverse_sum;
+    float impulse = max(contact->impulse + delta, 0.0f);
+
+    contact_apply_impulse(contact, impulse - contact->impulse);
+    contact->impulse = impulse;
+}
+
+/// contacts of an island are generated in pair order and solved by
+/// `solver_iterations` passes over all of them, only touching rows of
+/// the island's bodies
+static void solve_island(ContactIslands const *islands,
+        uint32_t island,
+        size_t worker_index,
+        void *ctx) {
+    unused(worker_index);
+
+    SolveContext *solve = ctx;
+    PhysicsWorld *physics = solve->physics;
+    Broadphase const *broadphase = &physics->broadphase;
+
+    uint32_t begin = islands->island_offsets[island];
+    uint32_t end = islands->island_offsets[island + 1];
+
+    for (uint32_t i = begin; i < end; i++) {
+        BroadphasePair pair = broadphase->pairs[islands->island_pairs[i]];
+        Contact *contact = &physics->contacts[i];
+
+        *contact = contact_from_boxes(pair.a,
+                pair.b,
+                &broadphase->boxes[pair.a],
+                &broadphase->boxes[pair.b]);
+
+        if (contact->touching) {
+            contact_prepare(physics, solve->world, contact, solve->dt);
+        }
+    }
+
+    // warm started once every bias is known, it was computed from the
+    // velocities the bodies came in with
+    for (uint32_t i = begin; i < end; i++) {
+        Contact *contact = &physics->contacts[i];
+
+        if (contact->body_a) {
+            contact_apply_impulse(contact, contact->impulse);
+        }
+    }
+
+    for (size_t iteration = 0; iteration < physics->solver_iterations;
+            iteration++) {
+        for (uint32_t i = begin; i < end; i++) {
+            Contact *contact = &physics->contacts[i];
+
+            if (contact->body_a) {
+                contact_solve(contact);
+            }
+        }
+    }
+}
+
+static void mark_body_changed(
+        PhysicsWorld const *physics, World *world, uint32_t proxy) {
+    if (physics->proxy_fixed[proxy]) {
+        return;
+    }
+
+    EntityPtr eptr = ecs_entity_ptr(world, physics->proxy_bodies[proxy]);
+    ecs_mark_changed(world, eptr, COMPONENT_ID(PhysicsState));
+}
+
+/// partitions the candidate pairs into islands and solves them across
+/// `pool`. events are pushed afterwards, in island and pair order, and
+/// the impulses are kept for the next tick.
+static void physics_solve(PhysicsWorld *physics,
+        World *world,
+        ThreadPool *pool,
+        float dt) {
+    Broadphase const *broadphase = &physics->broadphase;
+
+    contact_islands_build(&physics->islands,
+            vector_size(broadphase->boxes),
+            physics->proxy_fixed,
+            broadphase->pairs,
+            vector_size(broadphase->pairs));
+
+    size_t num_contacts = vector_size(physics->islands.island_pairs);
+    vector_resize(physics->contacts, num_contacts);
+
+    SolveContext solve = {.physics = physics, .world = world, .dt = dt};
+    contact_islands_run(&physics->islands, pool, solve_island, &solve);
+
+    vector_clear(physics->contact_cache);
+
+    for (size_t i = 0; i < num_contacts; i++) {
+        Contact const *contact = &physics->contacts[i];
+
+        if (!contact->touching) {
+            continue;
+        }
+
+        Entity a = physics->proxy_bodies[contact->a];
+        Entity b = physics->proxy_bodies[contact->b];
+
+        if (contact->body_a) {
+            CachedContact cached = {
+                    .a = a,
+                    .b = b,
+                    .impulse = contact->impulse,
+            };
+            glm_vec3_copy((float *)contact->normal, cached.normal);
+
+            vector_append(physics->contact_cache, cached);
+
+            mark_body_changed(physics, world, contact->a);
+            mark_body_changed(physics, world, contact->b);
+        }
+
+        if (!physics->event_queue) {
+            continue;
+        }
+
+        PhysicsState const *state_a =
+                ecs_get_component(world, a, COMPONENT_ID(PhysicsState));
+        PhysicsState const *state_b =
+                ecs_get_component(world, b, COMPONENT_ID(PhysicsState));
+
+        struct collision_event collision = {
+                .type = COLLISION_REGULAR,
+                .a = a,
+                .b = b,
+        };
+        glm_vec3_copy((float *)state_a->velocity, collision.a_velocity);
+        glm_vec3_copy((float *)state_b->velocity, collision.b_velocity);
+
+        events_push(
+                physics->event_queue, SYSTEM_EVENT_COLLISION, collision);
+    }
+
+    // every pair shows up once per tick, so the keys are unique
+    qsort(physics->contact_cache,
+            vector_size(physics->contact_cache),
+            sizeof(CachedContact),
+            sort_cached_contacts);
+}
+
+void physics_world_step(PhysicsWorld *physics,
+        World *world,
+        ThreadPool *pool,
+        float dt) {
+    physics_integrate(physics, world, pool, dt);
+
+    physics_sync_proxies(physics, world);
+
+    // candidate pairs for the narrowphase, by proxy
+    broadphase_find_pairs(&physics->broadphase);
+
+    physics_solve(physics, world, pool, dt);
+}
+
+static void physics_system(SystemContext const *system_context, void *ctx) {
+    PhysicsWorld *physics = ctx;
+
+    physics_world_step(physics,
+            system_context->world,
+            physics->pool,
+            system_context->dt);
+}
+
+Index physics_add_system(PhysicsWorld *physics, Scheduler *scheduler) {
+    physics->pool = scheduler->pool;
+
+    // a system on a pool worker would solve the islands serially
+    Index system = scheduler_add_system(
+            scheduler, "physics", physics_system, physics);
+    scheduler_system_exclusive(scheduler, system);
+    scheduler_system_writes(scheduler, system, COMPONENT_ID(PhysicsState));
+    scheduler_system_writes(scheduler, system, COMPONENT_ID(Position));
+    scheduler_system_reads(scheduler, system, COMPONENT_ID(Bounds));
+
+    return system;
+}
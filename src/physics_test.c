@@ -0,0 +1,446 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <cmocka.h>
+// clang-format on
+
+#include "internal/utils.h"
+#include "sunset/broadphase.h"
+#include "sunset/ecs.h"
+#include "sunset/geometry.h"
+#include "sunset/integrate.h"
+#include "sunset/physics_system.h"
+#include "sunset/render.h"
+#include "sunset/scheduler.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+static void setup_world(World *world, PhysicsWorld *physics) {
+    ecs_init(world);
+
+    REGISTER_COMPONENT(world, Position);
+    REGISTER_COMPONENT(world, Bounds);
+
+    physics_world_init(physics, world, NULL);
+}
+
+/// a unit box with its lower corner at `x, y, z`
+static Entity spawn_body(
+        World *world, PhysicsState *state, float x, float y, float z) {
+    Position position = {.value = {x, y, z}};
+    Bounds bounds = {
+            .box = {.min = {x, y, z}, .max = {x + 1, y + 1, z + 1}},
+    };
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, world);
+    entity_builder_add(&builder, COMPONENT_ID(PhysicsState), state);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &position);
+    entity_builder_add(&builder, COMPONENT_ID(Bounds), &bounds);
+
+    return entity_builder_finish(&builder);
+}
+
+void test_physics_system(void **state) {
+    unused(state);
+
+    World world;
+    PhysicsWorld physics;
+    setup_world(&world, &physics);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    Scheduler scheduler;
+    scheduler_init(&scheduler, &world, &pool);
+
+    Index system = physics_add_system(&physics, &scheduler);
+    System const *physics_system = scheduler_get_system(&scheduler, system);
+
+    assert_true(cmask_is_set(
+            &physics_system->writes, COMPONENT_ID(PhysicsState)));
+    assert_true(
+            cmask_is_set(&physics_system->writes, COMPONENT_ID(Position)));
+    assert_true(cmask_is_set(&physics_system->reads, COMPONENT_ID(Bounds)));
+    assert_true(physics_system->exclusive);
+
+    // more than a batch, spaced so that none of them touch
+    size_t num_bodies = INTEGRATE_LANES * 2 + 3;
+    Entity bodies[INTEGRATE_LANES * 2 + 3];
+
+    for (size_t i = 0; i < num_bodies; i++) {
+        PhysicsState body = {
+                .type = PHYSICS_OBJECT_REGULAR,
+                .acceleration = {0.0f, -10.0f, 0.0f},
+                .velocity = {(float)i, 0.0f, 0.0f},
+                .mass = 1.0f,
+        };
+
+        bodies[i] = spawn_body(&world, &body, 0.0f, 0.0f, 4.0f * i);
+    }
+
+    float dt = 0.1f;
+
+    for (size_t run = 0; run < 2; run++) {
+        scheduler_run(&scheduler, dt);
+    }
+
+    // velocity is updated before position, two steps of 0.1s
+    for (size_t i = 0; i < num_bodies; i++) {
+        Position const *position = ecs_get_component(
+                &world, bodies[i], COMPONENT_ID(Position));
+        PhysicsState const *body = ecs_get_component(
+                &world, bodies[i], COMPONENT_ID(PhysicsState));
+
+        assert_float_equal(position->value[0], 0.2f * i, EPSILON);
+        assert_float_equal(position->value[1], -0.3f, EPSILON);
+        assert_float_equal(position->value[2], 4.0f * i, EPSILON);
+        assert_float_equal(body->velocity[1], -2.0f, EPSILON);
+    }
+
+    assert_int_equal(vector_size(physics.contact_cache), 0);
+
+    scheduler_destroy(&scheduler);
+    thread_pool_destroy(&pool);
+    physics_world_destroy(&physics);
+    ecs_destroy(&world);
+}
+
+void test_physics_gravity(void **state) {
+    unused(state);
+
+    World world;
+    PhysicsWorld physics;
+    setup_world(&world, &physics);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    PhysicsState falling_state = {
+            .type = PHYSICS_OBJECT_REGULAR,
+            .flags = PHYSICS_FLAGS_APPLY_GRAVITY,
+            .mass = 1.0f,
+    };
+    PhysicsState floating_state = {
+            .type = PHYSICS_OBJECT_REGULAR,
+            .mass = 1.0f,
+    };
+    PhysicsState fixed_state = {
+            .type = PHYSICS_OBJECT_INFINITE,
+            .flags = PHYSICS_FLAGS_APPLY_GRAVITY,
+            .velocity = {1.0f, 0.0f, 0.0f},
+    };
+    PhysicsState massless_state = {
+            .type = PHYSICS_OBJECT_REGULAR,
+            .flags = PHYSICS_FLAGS_APPLY_GRAVITY,
+            .velocity = {1.0f, 0.0f, 0.0f},
+    };
+
+    Entity falling = spawn_body(&world, &falling_state, 0.0f, 0.0f, 0.0f);
+    Entity floating =
+            spawn_body(&world, &floating_state, 0.0f, 0.0f, 4.0f);
+    Entity fixed = spawn_body(&world, &fixed_state, 0.0f, 0.0f, 8.0f);
+    Entity massless =
+            spawn_body(&world, &massless_state, 0.0f, 0.0f, 12.0f);
+
+    float dt = 0.1f;
+    physics_world_step(&physics, &world, &pool, dt);
+
+    PhysicsState const *falling_after = ecs_get_component(
+            &world, falling, COMPONENT_ID(PhysicsState));
+    Position const *falling_position =
+            ecs_get_component(&world, falling, COMPONENT_ID(Position));
+
+    assert_float_equal(
+            falling_after->velocity[1], -PHYSICS_GRAVITY * dt, EPSILON);
+    assert_float_equal(falling_position->value[1],
+            -PHYSICS_GRAVITY * dt * dt,
+            EPSILON);
+
+    Position const *floating_position =
+            ecs_get_component(&world, floating, COMPONENT_ID(Position));
+    assert_float_equal(floating_position->value[1], 0.0f, 0.0f);
+
+    // neither gravity nor their own velocity moves these
+    Entity unmoved[] = {fixed, massless};
+
+    for (size_t i = 0; i < 2; i++) {
+        PhysicsState const *body = ecs_get_component(
+                &world, unmoved[i], COMPONENT_ID(PhysicsState));
+        Position const *position = ecs_get_component(
+                &world, unmoved[i], COMPONENT_ID(Position));
+
+        assert_float_equal(body->velocity[0], 1.0f, 0.0f);
+        assert_float_equal(body->velocity[1], 0.0f, 0.0f);
+        assert_float_equal(position->value[0], 0.0f, 0.0f);
+        assert_float_equal(position->value[1], 0.0f, 0.0f);
+    }
+
+    thread_pool_destroy(&pool);
+    physics_world_destroy(&physics);
+    ecs_destroy(&world);
+}
+
+void test_physics_reused_slot(void **state) {
+    unused(state);
+
+    World world;
+    PhysicsWorld physics;
+    setup_world(&world, &physics);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    PhysicsState ground_state = {.type = PHYSICS_OBJECT_INFINITE};
+    PhysicsState body_state = {
+            .type = PHYSICS_OBJECT_REGULAR,
+            .mass = 1.0f,
+    };
+
+    Entity ground = spawn_body(&world, &ground_state, 0.0f, -1.0f, 0.0f);
+    Entity old = spawn_body(&world, &body_state, 0.0f, -0.1f, 0.0f);
+
+    float dt = 1.0f / 60.0f;
+    physics_world_step(&physics, &world, &pool, dt);
+
+    assert_int_equal(vector_size(physics.broadphase.pairs), 1);
+    assert_int_equal(vector_size(physics.contact_cache), 1);
+
+    // despawned and respawned in between two steps, the new body gets
+    // the slot and with it the old body's proxy
+    ecs_remove_entity(&world, old);
+    Entity reused = spawn_body(&world, &body_state, 0.0f, -0.1f, 0.0f);
+
+    assert_int_equal(entity_index(reused), entity_index(old));
+
+    physics_world_step(&physics, &world, &pool, dt);
+
+    uint32_t proxy = physics.body_proxies[entity_index(reused)];
+    assert_int_equal(physics.proxy_bodies[proxy], reused);
+    assert_int_equal(vector_size(physics.broadphase.pairs), 1);
+
+    // the contact is cached under the new body, not the old one
+    assert_int_equal(vector_size(physics.contact_cache), 1);
+    CachedContact const *cached = &physics.contact_cache[0];
+    assert_true(cached->a == reused || cached->b == reused);
+    assert_true(cached->a == ground || cached->b == ground);
+
+    // once the body is gone for good, so is its proxy
+    ecs_remove_entity(&world, reused);
+    physics_world_step(&physics, &world, &pool, dt);
+
+    assert_int_equal(physics.body_proxies[entity_index(reused)],
+            BROADPHASE_PROXY_NONE);
+    assert_false(physics.broadphase.live[proxy]);
+    assert_int_equal(vector_size(physics.broadphase.pairs), 0);
+    assert_int_equal(vector_size(physics.contact_cache), 0);
+
+    thread_pool_destroy(&pool);
+    physics_world_destroy(&physics);
+    ecs_destroy(&world);
+}
+
+void test_physics_contact(void **state) {
+    unused(state);
+
+    World world;
+    PhysicsWorld physics;
+    setup_world(&world, &physics);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    PhysicsState ground_state = {.type = PHYSICS_OBJECT_INFINITE};
+    PhysicsState body_state = {
+            .type = PHYSICS_OBJECT_REGULAR,
+            .velocity = {0.0f, -1.0f, 0.0f},
+            .mass = 1.0f,
+    };
+
+    Entity ground = spawn_body(&world, &ground_state, 0.0f, -1.0f, 0.0f);
+    Entity body = spawn_body(&world, &body_state, 0.0f, -0.1f, 0.0f);
+
+    physics_world_step(&physics, &world, &pool, 0.1f);
+
+    // the body stops moving into the ground, which isn't moved at all
+    PhysicsState const *body_after =
+            ecs_get_component(&world, body, COMPONENT_ID(PhysicsState));
+    PhysicsState const *ground_after = ecs_get_component(
+            &world, ground, COMPONENT_ID(PhysicsState));
+    Position const *ground_position =
+            ecs_get_component(&world, ground, COMPONENT_ID(Position));
+
+    assert_true(body_after->velocity[1] >= 0.0f);
+    assert_float_equal(ground_after->velocity[1], 0.0f, 0.0f);
+    assert_float_equal(ground_position->value[1], -1.0f, 0.0f);
+
+    thread_pool_destroy(&pool);
+    physics_world_destroy(&physics);
+    ecs_destroy(&world);
+}
+
+void test_physics_moved_bounds(void **state) {
+    unused(state);
+
+    World world;
+    PhysicsWorld physics;
+    setup_world(&world, &physics);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    PhysicsState ground_state = {.type = PHYSICS_OBJECT_INFINITE};
+    PhysicsState body_state = {
+            .type = PHYSICS_OBJECT_REGULAR,
+            .velocity = {0.0f, -6.0f, 0.0f},
+            .mass = 1.0f,
+    };
+
+    spawn_body(&world, &ground_state, 0.0f, -1.0f, 0.0f);
+    Entity body = spawn_body(&world, &body_state, 0.0f, 0.05f, 0.0f);
+
+    // the bounds are still above the ground, the body is integrated into
+    // it before contacts are found
+    physics_world_step(&physics, &world, &pool, 1.0f / 60.0f);
+
+    PhysicsState const *body_after =
+            ecs_get_component(&world, body, COMPONENT_ID(PhysicsState));
+
+    assert_int_equal(vector_size(physics.contact_cache), 1);
+    assert_true(body_after->velocity[1] >= 0.0f);
+
+    thread_pool_destroy(&pool);
+    physics_world_destroy(&physics);
+    ecs_destroy(&world);
+}
+
+/// moves the bounds along with the positions, as `transform_propagate`
+/// does after every tick
+static void follow_bounds(
+        World *world, Entity const *bodies, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Position const *position = ecs_get_component(
+                world, bodies[i], COMPONENT_ID(Position));
+        Bounds *bounds =
+                ecs_get_component(world, bodies[i], COMPONENT_ID(Bounds));
+
+        for (size_t axis = 0; axis < 3; axis++) {
+            bounds->box.min[axis] = position->value[axis];
+            bounds->box.max[axis] = position->value[axis] + 1.0f;
+        }
+    }
+}
+
+static CachedContact *find_cached_contact(
+        PhysicsWorld *physics, Entity a, Entity b) {
+    for (size_t i = 0; i < vector_size(physics->contact_cache); i++) {
+        CachedContact *cached = &physics->contact_cache[i];
+
+        if ((cached->a == a && cached->b == b)
+                || (cached->a == b && cached->b == a)) {
+            return cached;
+        }
+    }
+
+    return NULL;
+}
+
+void test_physics_warm_start(void **state) {
+    unused(state);
+
+    World world;
+    PhysicsWorld physics;
+    setup_world(&world, &physics);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    PhysicsState ground_state = {.type = PHYSICS_OBJECT_INFINITE};
+    PhysicsState box_state = {
+            .type = PHYSICS_OBJECT_REGULAR,
+            .acceleration = {0.0f, -10.0f, 0.0f},
+            .mass = 1.0f,
+    };
+
+    // two boxes stacked on the ground
+    Entity bodies[] = {
+            spawn_body(&world, &ground_state, 0.0f, -1.0f, 0.0f),
+            spawn_body(&world, &box_state, 0.0f, 0.0f, 0.0f),
+            spawn_body(&world, &box_state, 0.0f, 1.0f, 0.0f),
+    };
+    size_t num_bodies = sizeof(bodies) / sizeof(*bodies);
+
+    float dt = 1.0f / 60.0f;
+    float heights[2];
+
+    for (size_t tick = 0; tick < 240; tick++) {
+        physics_world_step(&physics, &world, &pool, dt);
+        follow_bounds(&world, bodies, num_bodies);
+
+        Position const *position = ecs_get_component(
+                &world, bodies[2], COMPONENT_ID(Position));
+        heights[tick % 2] = position->value[1];
+    }
+
+    // settled within the penetration slop, and no longer moving
+    assert_float_equal(heights[0], heights[1], 1e-5f);
+    assert_true(heights[1] > 1.0f - 4.0f * PHYSICS_PENETRATION_SLOP);
+
+    // the contacts hold up the weight of everything above them
+    CachedContact *bottom =
+            find_cached_contact(&physics, bodies[0], bodies[1]);
+    CachedContact *middle =
+            find_cached_contact(&physics, bodies[1], bodies[2]);
+
+    assert_non_null(bottom);
+    assert_non_null(middle);
+    assert_float_equal(bottom->impulse, 2.0f * 10.0f * dt, 1e-4f);
+    assert_float_equal(middle->impulse, 10.0f * dt, 1e-4f);
+
+    // without any solver passes, the impulses are only the warm start
+    float bottom_impulse = bottom->impulse;
+    float middle_impulse = middle->impulse;
+
+    physics.solver_iterations = 0;
+    physics_world_step(&physics, &world, &pool, dt);
+    follow_bounds(&world, bodies, num_bodies);
+
+    bottom = find_cached_contact(&physics, bodies[0], bodies[1]);
+    middle = find_cached_contact(&physics, bodies[1], bodies[2]);
+
+    assert_float_equal(bottom->impulse, bottom_impulse, 1e-6f);
+    assert_float_equal(middle->impulse, middle_impulse, 1e-6f);
+
+    // a contact whose normal flipped since starts over
+    bottom->normal[1] = -bottom->normal[1];
+
+    physics_world_step(&physics, &world, &pool, dt);
+
+    bottom = find_cached_contact(&physics, bodies[0], bodies[1]);
+    middle = find_cached_contact(&physics, bodies[1], bodies[2]);
+
+    assert_float_equal(bottom->impulse, 0.0f, 0.0f);
+    assert_float_equal(middle->impulse, middle_impulse, 1e-6f);
+
+    thread_pool_destroy(&pool);
+    physics_world_destroy(&physics);
+    ecs_destroy(&world);
+}
+
+int main(void) {
+    const struct CMUnitTest physics_tests[] = {
+            cmocka_unit_test(test_physics_system),
+            cmocka_unit_test(test_physics_gravity),
+            cmocka_unit_test(test_physics_reused_slot),
+            cmocka_unit_test(test_physics_contact),
+            cmocka_unit_test(test_physics_moved_bounds),
+            cmocka_unit_test(test_physics_warm_start),
+    };
+
+    return cmocka_run_group_tests(physics_tests, NULL, NULL);
+}
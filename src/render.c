@@ -1,8 +1,11 @@
 #include <cglm/affine.h>
 #include <cglm/mat4.h>
+#include <cglm/quat.h>
 #include <cglm/vec3.h>
+#include <cglm/vec4.h>
 
 #include "cglm/affine-pre.h"
+#include "internal/math.h"
 #include "internal/utils.h"
 #include "sunset/camera.h"
 #include "sunset/commands.h"
@@ -10,13 +13,181 @@
 #include "sunset/engine.h"
 #include "sunset/events.h"
 #include "sunset/geometry.h"
+#include "sunset/hierarchy.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
 
 #include "sunset/render.h"
 
-DECLARE_COMPONENT_ID(Transform);
+DECLARE_COMPONENT_ID(Position);
+DECLARE_COMPONENT_ID(Rotation);
+DECLARE_COMPONENT_ID(Scale);
+DECLARE_COMPONENT_ID(TransformLinks);
+DECLARE_COMPONENT_ID(WorldTransform);
+DECLARE_COMPONENT_ID(Bounds);
+
+static Query renderable_query;
+/// only visits transforms written since the last propagation
+static Query transform_query;
+static Hierarchy transform_hierarchy;
+/// indexed by entity slot, the entity the slot was last added to
+/// `transform_hierarchy` for
+static vector(Entity) hierarchy_entities;
+/// world matrix of every node of `transform_hierarchy`
+static vector(mat4) world_matrices;
+/// bumped by every `transform_propagate`, see `WorldTransform.generation`
+static uint32_t transform_generation;
 
 void render_setup(EngineContext *engine_context) {
-    REGISTER_COMPONENT(&engine_context->world, Transform);
+    World *world = &engine_context->world;
+
+    REGISTER_COMPONENT(world, Position);
+    REGISTER_COMPONENT(world, Rotation);
+    REGISTER_COMPONENT(world, Scale);
+    REGISTER_COMPONENT(world, TransformLinks);
+    REGISTER_COMPONENT(world, WorldTransform);
+    REGISTER_COMPONENT(world, Bounds);
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Renderable));
+
+    query_init(&renderable_query, mask);
+    query_optional(&renderable_query, COMPONENT_ID(WorldTransform));
+    query_optional(&renderable_query, COMPONENT_ID(Bounds));
+
+    mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Rotation));
+    cmask_set(&mask, COMPONENT_ID(Scale));
+    cmask_set(&mask, COMPONENT_ID(TransformLinks));
+    cmask_set(&mask, COMPONENT_ID(WorldTransform));
+    cmask_set(&mask, COMPONENT_ID(Bounds));
+
+    query_init(&transform_query, mask);
+    query_filter_changed(&transform_query, COMPONENT_ID(Position));
+    query_filter_changed(&transform_query, COMPONENT_ID(Rotation));
+    query_filter_changed(&transform_query, COMPONENT_ID(Scale));
+    query_filter_changed(&transform_query, COMPONENT_ID(TransformLinks));
+
+    hierarchy_init(&transform_hierarchy);
+    vector_init(hierarchy_entities);
+    vector_init(world_matrices);
+}
+
+void render_destroy(void) {
+    query_destroy(&renderable_query);
+    query_destroy(&transform_query);
+    hierarchy_destroy(&transform_hierarchy);
+    vector_destroy(hierarchy_entities);
+    vector_destroy(world_matrices);
+}
+
+void rotation_from_axis_angle(vec3 axis_angle, versor out) {
+    float angle = glm_vec3_norm(axis_angle);
+
+    if (angle > EPSILON) {
+        glm_quatv(out, angle, axis_angle);
+    } else {
+        glm_quat_identity(out);
+    }
+}
+
+void rotation_to_axis_angle(versor rotation, vec3 out) {
+    vec3 axis;
+    glm_quat_axis(rotation, axis);
+    glm_vec3_scale(axis, glm_quat_angle(rotation), out);
+}
+
+void entity_builder_add_transform(
+        EntityBuilder *builder, Transform *transform) {
+    Position position;
+    glm_vec3_copy(transform->position, position.value);
+
+    Rotation rotation;
+    rotation_from_axis_angle(transform->rotation, rotation.value);
+
+    Scale scale = {.value = transform->scale};
+
+    TransformLinks links = {
+            .parent = ecs_ptr_entity(builder->world, transform->parent),
+            .children = transform->children,
+    };
+
+    // a zeroed model tells `transform_propagate` that the bounds are
+    // already in place
+    WorldTransform world_transform = {0};
+
+    Bounds bounds = {.box = transform->bounding_box};
+
+    entity_builder_add(builder, COMPONENT_ID(Position), &position);
+    entity_builder_add(builder, COMPONENT_ID(Rotation), &rotation);
+    entity_builder_add(builder, COMPONENT_ID(Scale), &scale);
+    entity_builder_add(builder, COMPONENT_ID(TransformLinks), &links);
+    entity_builder_add(
+            builder, COMPONENT_ID(WorldTransform), &world_transform);
+    entity_builder_add(builder, COMPONENT_ID(Bounds), &bounds);
+}
+
+void transform_get(World *world, EntityPtr eptr, Transform *out) {
+    Position *position =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Position));
+    Rotation *rotation =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Rotation));
+    Scale const *scale =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Scale));
+    TransformLinks const *links = ecs_component_from_ptr(
+            world, eptr, COMPONENT_ID(TransformLinks));
+    WorldTransform *world_transform = ecs_component_from_ptr(
+            world, eptr, COMPONENT_ID(WorldTransform));
+    Bounds const *bounds =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Bounds));
+
+    out->bounding_box = bounds->box;
+    glm_vec3_copy(position->value, out->position);
+    rotation_to_axis_angle(rotation->value, out->rotation);
+    out->scale = scale->value;
+    out->parent = ecs_entity_ptr(world, links->parent);
+    out->children = links->children;
+    glm_mat4_copy(world_transform->model, out->cached_model);
+}
+
+void transform_set(World *world, EntityPtr eptr, Transform *transform) {
+    Position position;
+    glm_vec3_copy(transform->position, position.value);
+
+    Rotation rotation;
+    rotation_from_axis_angle(transform->rotation, rotation.value);
+
+    Scale scale = {.value = transform->scale};
+
+    TransformLinks links = {
+            .parent = ecs_ptr_entity(world, transform->parent),
+            .children = transform->children,
+    };
+
+    Bounds bounds = {.box = transform->bounding_box};
+
+    ecs_write_component(world, eptr, COMPONENT_ID(Position), &position);
+    ecs_write_component(world, eptr, COMPONENT_ID(Rotation), &rotation);
+    ecs_write_component(world, eptr, COMPONENT_ID(Scale), &scale);
+    ecs_write_component(
+            world, eptr, COMPONENT_ID(TransformLinks), &links);
+    ecs_write_component(world, eptr, COMPONENT_ID(Bounds), &bounds);
+}
+
+static void transform_local_matrix(
+        World *world, EntityPtr eptr, mat4 local) {
+    Position *position =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Position));
+    Rotation *rotation =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Rotation));
+    Scale const *scale =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Scale));
+
+    // a zeroed quaternion comes out as the identity as well
+    glm_quat_mat4(rotation->value, local);
+    glm_scale_uni(local, scale->value);
+    glm_translate(local, position->value);
 }
 
 void calculate_model_matrix(
@@ -26,95 +197,266 @@ void calculate_model_matrix(
     EntityPtr current = entity;
 
     while (true) {
-        Transform *t = ecs_component_from_ptr(
-                world, current, COMPONENT_ID(Transform));
-
         mat4 local;
-        glm_mat4_identity(local);
+        transform_local_matrix(world, current, local);
+
+        glm_mat4_mul(local, model_matrix, model_matrix);
 
-        float angle = glm_vec3_norm(t->rotation);
-        if (angle > EPSILON) {
-            vec3 axis;
-            glm_vec3_normalize_to(t->rotation, axis);
-            glm_rotate(local, angle, axis);
+        TransformLinks const *links = ecs_component_from_ptr(
+                world, current, COMPONENT_ID(TransformLinks));
+
+        current = ecs_entity_ptr(world, links->parent);
+
+        if (eptr_eql(current, ENTITY_PTR_INVALID)) {
+            break;
         }
+    }
+}
 
-        glm_scale_uni(local, t->scale);
+typedef struct PropagateContext {
+    World *world;
+    /// set for propagations that follow a tick, which start a new blend
+    bool tick;
+} PropagateContext;
+
+static void propagate_transform(
+        Hierarchy const *hierarchy, uint32_t node, void *ctx) {
+    PropagateContext const *propagate = ctx;
+    World *world = propagate->world;
+    EntityPtr eptr = world->entity_ptrs[hierarchy->entities[node]];
+    WorldTransform *world_transform = ecs_component_from_ptr(
+            world, eptr, COMPONENT_ID(WorldTransform));
+    Bounds *bounds =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Bounds));
+    uint32_t parent = hierarchy->parents[node];
+
+    mat4 local;
+    transform_local_matrix(world, eptr, local);
+
+    if (parent == HIERARCHY_ROOT) {
+        glm_mat4_copy(local, world_matrices[node]);
+    } else {
+        glm_mat4_mul(world_matrices[parent], local, world_matrices[node]);
+    }
 
-        glm_translate(local, t->position);
+    // bounding boxes are kept in world space and follow the entity's
+    // world position. a zeroed model hasn't been computed yet, the box
+    // was placed when the entity was spawned.
+    vec4 *previous = world_transform->model;
 
-        glm_mat4_mul(local, model_matrix, model_matrix);
+    if (previous[3][3] != 0.0f) {
+        vec3 offset;
+        glm_vec3_sub(world_matrices[node][3], previous[3], offset);
+        aabb_translate(&bounds->box, offset);
 
-        if (eptr_eql(t->parent, ENTITY_PTR_INVALID)) {
-            break;
+        // between ticks, a transform the latest tick moved keeps blending
+        // from where it was before that tick
+        if (propagate->tick) {
+            glm_mat4_copy(previous, world_transform->previous);
         }
+    } else {
+        // nothing to blend from on the first propagation
+        glm_mat4_copy(world_matrices[node], world_transform->previous);
+    }
 
-        current = t->parent;
+    glm_mat4_copy(world_matrices[node], world_transform->model);
+
+    if (propagate->tick) {
+        world_transform->generation = transform_generation;
     }
 }
 
-void render_world(World /*const*/ *world,
-        Camera const *camera,
-        CommandBuffer *cmdbuf) {
-    Bitmask mask;
-    bitmask_init_empty(ECS_MAX_COMPONENTS, &mask);
-    bitmask_set(&mask, COMPONENT_ID(Renderable));
-
-    WorldIterator it = worldit_create(world, mask);
-
-    while (worldit_is_valid(&it)) {
-        Renderable *renderable =
-                worldit_get_component(&it, COMPONENT_ID(Renderable));
-        Transform *transform =
-                worldit_get_component(&it, COMPONENT_ID(Transform));
-        EntityPtr eptr = worldit_get_entityptr(&it);
-
-        bool visible = true;
-
-        if (transform) {
-            // HACK: when I transition to my own math library, const
-            // when unmutable would be a rule
-            visible = camera_box_within_frustum(
-                    (Camera *)camera, transform->bounding_box);
-
-            if (transform->dirty) {
-                calculate_model_matrix(
-                        world, eptr, renderable->context.model);
-            }
+/// entity slot of the parent in `transform_hierarchy`, a parent that was
+/// removed leaves the entity a root
+static Index transform_parent(
+        World const *world, TransformLinks const *links) {
+    if (!ecs_is_alive(world, links->parent)) {
+        return HIERARCHY_ROOT;
+    }
+
+    return entity_index(links->parent);
+}
+
+static void transform_hierarchy_prune(World *world) {
+    Hierarchy *hierarchy = &transform_hierarchy;
+
+    for (Index entity = 0;
+            entity < vector_size(hierarchy->entity_parents);
+            entity++) {
+        if (!hierarchy_contains(hierarchy, entity)) {
+            continue;
+        }
+
+        EntityPtr eptr = entity < vector_size(world->entity_ptrs)
+                ? world->entity_ptrs[entity]
+                : ENTITY_PTR_INVALID;
+
+        if (eptr_eql(eptr, ENTITY_PTR_INVALID)
+                || !ecs_component_from_ptr(
+                        world, eptr, COMPONENT_ID(WorldTransform))) {
+            hierarchy_remove(hierarchy, entity);
+        }
+    }
+}
+
+/// records the entity now in the slot. the hierarchy only knows slots,
+/// so once a slot changes hands the children of the entity that was
+/// removed from it would follow the new one, even when both happened
+/// since the last propagation and the slot was never pruned.
+static void transform_hierarchy_claim(World const *world, Index slot) {
+    Entity entity = entity_make(slot, world->generations[slot]);
+    size_t num_slots = vector_size(hierarchy_entities);
+
+    if (slot >= num_slots) {
+        size_t new_num_slots = max((size_t)slot + 1, num_slots * 2);
+
+        vector_resize(hierarchy_entities, new_num_slots);
+
+        for (size_t i = num_slots; i < new_num_slots; i++) {
+            hierarchy_entities[i] = ENTITY_INVALID;
         }
+    }
+
+    Entity previous = hierarchy_entities[slot];
+    hierarchy_entities[slot] = entity;
+
+    if (previous != ENTITY_INVALID && previous != entity) {
+        hierarchy_detach_children(&transform_hierarchy, slot);
+    }
+}
+
+static bool transform_row_changed(ArchetypeSpan const *span, size_t i) {
+    return span_row_changed(span, COMPONENT_ID(Position), i)
+            || span_row_changed(span, COMPONENT_ID(Rotation), i)
+            || span_row_changed(span, COMPONENT_ID(Scale), i)
+            || span_row_changed(span, COMPONENT_ID(TransformLinks), i);
+}
+
+static void transform_propagate_changed(
+        World *world, ThreadPool *pool, bool tick) {
+    Hierarchy *hierarchy = &transform_hierarchy;
+
+    if (tick) {
+        transform_generation++;
+    }
+
+    SpanIterator it = spanit_create(world, &transform_query);
+    ArchetypeSpan span;
+
+    while (spanit_next(&it, &span)) {
+        TransformLinks const *links = span_column(&span, TransformLinks);
+
+        for (size_t i = 0; i < span.count; i++) {
+            if (!transform_row_changed(&span, i)) {
+                continue;
+            }
+
+            Index entity = span.archetype->entities[span.begin + i];
 
-        if (visible) {
-            cmdbuf_add_multiple(cmdbuf,
-                    renderable->commands,
-                    vector_size(renderable->commands),
-                    &renderable->context);
+            transform_hierarchy_claim(world, entity);
+            hierarchy_set_parent(hierarchy,
+                    entity,
+                    transform_parent(world, &links[i]));
+            hierarchy_mark_dirty(hierarchy, entity);
         }
+    }
+
+    size_t num_transforms = 0;
+
+    for (size_t i = 0; i < vector_size(transform_query.archetypes); i++) {
+        size_t archetype = transform_query.archetypes[i];
+        num_transforms += world->archetypes[archetype].num_elements;
+    }
 
-        worldit_advance(&it);
+    // every transform was added as soon as it was written, so extra
+    // entities are the ones that were removed or lost their transform
+    if (hierarchy->num_entities > num_transforms) {
+        transform_hierarchy_prune(world);
     }
+
+    // the layout never has more nodes than entities
+    size_t num_nodes = hierarchy->num_entities;
+    vector_resize(world_matrices, num_nodes);
+
+    PropagateContext propagate = {.world = world, .tick = tick};
+    hierarchy_propagate(hierarchy, pool, propagate_transform, &propagate);
 }
 
-static void entity_move_impl(World *world, EntityPtr eptr, vec3 offset) {
-    Transform *t =
-            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Transform));
+void transform_propagate(World *world, ThreadPool *pool) {
+    transform_propagate_changed(world, pool, true);
+}
 
-    aabb_translate(&t->bounding_box, offset);
+void transform_propagate_frame(World *world, ThreadPool *pool) {
+    transform_propagate_changed(world, pool, false);
+}
 
-    if (!t->children) {
+/// blends column by column, which is only meant for the small changes
+/// of a single tick
+static void blend_model(WorldTransform *world_transform,
+        float alpha,
+        mat4 model_out) {
+    if (world_transform->generation != transform_generation) {
+        glm_mat4_copy(world_transform->model, model_out);
         return;
     }
 
-    for (size_t i = 0; i < vector_size(t->children); i++) {
-        entity_move_impl(world, t->children[i], offset);
+    for (size_t i = 0; i < 4; i++) {
+        glm_vec4_lerp(world_transform->previous[i],
+                world_transform->model[i],
+                alpha,
+                model_out[i]);
+    }
+}
+
+void render_world(World /*const*/ *world,
+        Camera const *camera,
+        float alpha,
+        CommandBuffer *cmdbuf) {
+    SpanIterator it = spanit_create(world, &renderable_query);
+    ArchetypeSpan span;
+
+    while (spanit_next(&it, &span)) {
+        Renderable *renderables = span_column(&span, Renderable);
+        // resolved once per span, NULL when the archetype has none
+        WorldTransform *world_transforms =
+                span_column(&span, WorldTransform);
+        Bounds *bounds = span_column(&span, Bounds);
+
+        for (size_t i = 0; i < span.count; i++) {
+            Renderable *renderable = &renderables[i];
+            bool visible = true;
+
+            if (bounds) {
+                // HACK: when I transition to my own math library, const
+                // when unmutable would be a rule
+                visible = camera_box_within_frustum(
+                        (Camera *)camera, bounds[i].box);
+            }
+
+            if (world_transforms) {
+                blend_model(&world_transforms[i],
+                        alpha,
+                        renderable->context.model);
+            }
+
+            if (visible) {
+                cmdbuf_add_multiple(cmdbuf,
+                        renderable->commands,
+                        vector_size(renderable->commands),
+                        &renderable->context);
+            }
+        }
     }
 }
 
 void entity_move(World *world, EntityPtr eptr, vec3 offset) {
-    Transform *t =
-            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Transform));
+    Position *position =
+            ecs_component_from_ptr(world, eptr, COMPONENT_ID(Position));
 
-    glm_vec3_add(t->position, offset, t->position);
-    entity_move_impl(world, eptr, offset);
+    glm_vec3_add(position->value, offset, position->value);
+    // the next `transform_propagate` moves the bounding boxes of the
+    // entity and all its descendants along
+    ecs_mark_changed(world, eptr, COMPONENT_ID(Position));
 }
 
 void entity_get_abspos(World *world, EntityPtr eptr, vec3 out) {
@@ -123,15 +465,17 @@ void entity_get_abspos(World *world, EntityPtr eptr, vec3 out) {
     glm_vec3_zero(out);
 
     while (true) {
-        Transform *t = ecs_component_from_ptr(
-                world, current, COMPONENT_ID(Transform));
+        Position *position = ecs_component_from_ptr(
+                world, current, COMPONENT_ID(Position));
+        TransformLinks const *links = ecs_component_from_ptr(
+                world, current, COMPONENT_ID(TransformLinks));
+
+        glm_vec3_add(out, position->value, out);
 
-        glm_vec3_add(out, t->position, out);
+        current = ecs_entity_ptr(world, links->parent);
 
-        if (eptr_eql(t->parent, ENTITY_PTR_INVALID)) {
+        if (eptr_eql(current, ENTITY_PTR_INVALID)) {
             break;
         }
-
-        current = t->parent;
     }
 }
@@ -0,0 +1,279 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal/math.h"
+#include "internal/time_utils.h"
+#include "internal/utils.h"
+#include "sunset/component_mask.h"
+#include "sunset/ecs.h"
+#include "sunset/ecs_commands.h"
+#include "sunset/thread_pool.h"
+#include "sunset/vector.h"
+
+#include "sunset/scheduler.h"
+
+/// weight of the latest run in `System.avg_time_s`
+#define SYSTEM_TIME_SMOOTHING 0.1f
+
+void scheduler_init(Scheduler *scheduler, World *world, ThreadPool *pool) {
+    scheduler->world = world;
+    scheduler->pool = pool;
+    vector_init(scheduler->systems);
+    scheduler->graph_dirty = false;
+
+    vector_init(scheduler->cmdbufs);
+    vector_resize(scheduler->cmdbufs, thread_pool_num_workers(pool));
+
+    for (size_t i = 0; i < vector_size(scheduler->cmdbufs); i++) {
+        ecs_cmdbuf_init(&scheduler->cmdbufs[i], world);
+    }
+
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->system_finished, NULL);
+    vector_init(scheduler->ready);
+    vector_init(scheduler->num_pending);
+    scheduler->num_finished = 0;
+    scheduler->num_staged = 0;
+    scheduler->dt = 0.0f;
+}
+
+void scheduler_destroy(Scheduler *scheduler) {
+    for (size_t i = 0; i < vector_size(scheduler->systems); i++) {
+        System *system = &scheduler->systems[i];
+
+        vector_destroy(system->dependents);
+    }
+
+    for (size_t i = 0; i < vector_size(scheduler->cmdbufs); i++) {
+        ecs_cmdbuf_destroy(&scheduler->cmdbufs[i]);
+    }
+
+    vector_destroy(scheduler->systems);
+    vector_destroy(scheduler->cmdbufs);
+    vector_destroy(scheduler->ready);
+    vector_destroy(scheduler->num_pending);
+
+    pthread_cond_destroy(&scheduler->system_finished);
+    pthread_mutex_destroy(&scheduler->lock);
+}
+
+Index scheduler_add_system(
+        Scheduler *scheduler, char const *name, SystemFn fn, void *ctx) {
+    System system = {
+            .name = name,
+            .fn = fn,
+            .ctx = ctx,
+            .num_dependencies = 0,
+            .last_time_s = 0.0f,
+            .avg_time_s = 0.0f,
+            .reads = cmask_empty(),
+            .writes = cmask_empty(),
+            .exclusive = false,
+    };
+
+    vector_init(system.dependents);
+
+    vector_append(scheduler->systems, system);
+    scheduler->graph_dirty = true;
+
+    return vector_size(scheduler->systems) - 1;
+}
+
+void scheduler_system_reads(
+        Scheduler *scheduler, Index system, Index component_id) {
+    cmask_set(&scheduler->systems[system].reads, component_id);
+    scheduler->graph_dirty = true;
+}
+
+void scheduler_system_writes(
+        Scheduler *scheduler, Index system, Index component_id) {
+    cmask_set(&scheduler->systems[system].writes, component_id);
+    scheduler->graph_dirty = true;
+}
+
+void scheduler_system_exclusive(Scheduler *scheduler, Index system) {
+    scheduler->systems[system].exclusive = true;
+    scheduler->graph_dirty = true;
+}
+
+System const *scheduler_get_system(
+        Scheduler const *scheduler, Index system) {
+    return &scheduler->systems[system];
+}
+
+static bool systems_conflict(System const *a, System const *b) {
+    return cmask_intersects(&a->writes, &b->writes)
+            || cmask_intersects(&a->writes, &b->reads)
+            || cmask_intersects(&a->reads, &b->writes);
+}
+
+/// adds an edge from every system to each later conflicting one of its
+/// stage. edges implied by a path through another system are kept, the
+/// graph is small and only rebuilt when systems change. exclusive systems
+/// get no edges, stages are ordered by running one after another.
+static void scheduler_build_graph(Scheduler *scheduler) {
+    size_t num_systems = vector_size(scheduler->systems);
+
+    for (size_t i = 0; i < num_systems; i++) {
+        vector_clear(scheduler->systems[i].dependents);
+        scheduler->systems[i].num_dependencies = 0;
+    }
+
+    for (size_t i = 0; i < num_systems; i++) {
+        System *system = &scheduler->systems[i];
+
+        if (system->exclusive) {
+            continue;
+        }
+
+        for (size_t j = i + 1; j < num_systems; j++) {
+            System *later = &scheduler->systems[j];
+
+            if (later->exclusive) {
+                break;
+            }
+
+            if (systems_conflict(system, later)) {
+                vector_append(system->dependents, j);
+                later->num_dependencies++;
+            }
+        }
+    }
+
+    vector_resize(scheduler->num_pending, num_systems);
+    scheduler->graph_dirty = false;
+}
+
+static void system_execute(
+        System *system, SystemContext const *system_context) {
+    Time start = get_time();
+    system->fn(system_context, system->ctx);
+    system->last_time_s = time_since_s(start);
+    system->avg_time_s += SYSTEM_TIME_SMOOTHING
+            * (system->last_time_s - system->avg_time_s);
+}
+
+static void scheduler_worker(
+        void *ctx, size_t task_index, size_t worker_index) {
+    unused(task_index);
+
+    Scheduler *scheduler = ctx;
+
+    SystemContext system_context = {
+            .world = scheduler->world,
+            .cmdbuf = &scheduler->cmdbufs[worker_index],
+            .dt = scheduler->dt,
+            .worker_index = worker_index,
+    };
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    while (scheduler->num_finished < scheduler->num_staged) {
+        if (vector_empty(scheduler->ready)) {
+            // some other worker is still running a system that will
+            // either unlock more work or finish the run
+            pthread_cond_wait(
+                    &scheduler->system_finished, &scheduler->lock);
+            continue;
+        }
+
+        Index index = vector_pop_back(scheduler->ready);
+        System *system = &scheduler->systems[index];
+
+        pthread_mutex_unlock(&scheduler->lock);
+
+        system_execute(system, &system_context);
+
+        pthread_mutex_lock(&scheduler->lock);
+
+        for (size_t i = 0; i < vector_size(system->dependents); i++) {
+            Index dependent = system->dependents[i];
+
+            if (--scheduler->num_pending[dependent] == 0) {
+                vector_append(scheduler->ready, dependent);
+            }
+        }
+
+        scheduler->num_finished++;
+        pthread_cond_broadcast(&scheduler->system_finished);
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/// runs the systems in `[begin, end)` across the pool, none of them
+/// exclusive
+static void scheduler_run_stage(
+        Scheduler *scheduler, size_t begin, size_t end) {
+    vector_clear(scheduler->ready);
+
+    // pushed in reverse so that systems are popped in registration order
+    // when they are all ready at once
+    for (size_t i = end; i-- > begin;) {
+        scheduler->num_pending[i] =
+                scheduler->systems[i].num_dependencies;
+
+        if (scheduler->num_pending[i] == 0) {
+            vector_append(scheduler->ready, i);
+        }
+    }
+
+    scheduler->num_finished = 0;
+    scheduler->num_staged = end - begin;
+
+    size_t num_workers = thread_pool_num_workers(scheduler->pool);
+    size_t num_tasks = min(scheduler->num_staged, num_workers);
+
+    thread_pool_run(
+            scheduler->pool, num_tasks, scheduler_worker, scheduler);
+}
+
+/// runs on the calling thread, which is worker 0 whenever the pool runs
+/// tasks, so it gets that worker's command buffer
+static void scheduler_run_exclusive(Scheduler *scheduler, Index index) {
+    SystemContext system_context = {
+            .world = scheduler->world,
+            .cmdbuf = &scheduler->cmdbufs[0],
+            .dt = scheduler->dt,
+            .worker_index = 0,
+    };
+
+    system_execute(&scheduler->systems[index], &system_context);
+}
+
+void scheduler_run(Scheduler *scheduler, float dt) {
+    size_t num_systems = vector_size(scheduler->systems);
+
+    if (num_systems == 0) {
+        return;
+    }
+
+    if (scheduler->graph_dirty) {
+        scheduler_build_graph(scheduler);
+    }
+
+    scheduler->dt = dt;
+
+    for (size_t begin = 0; begin < num_systems;) {
+        if (scheduler->systems[begin].exclusive) {
+            scheduler_run_exclusive(scheduler, begin);
+            begin++;
+            continue;
+        }
+
+        size_t end = begin + 1;
+
+        while (end < num_systems && !scheduler->systems[end].exclusive) {
+            end++;
+        }
+
+        scheduler_run_stage(scheduler, begin, end);
+        begin = end;
+    }
+
+    ecs_cmdbuf_flush(scheduler->cmdbufs,
+            vector_size(scheduler->cmdbufs),
+            scheduler->world);
+}
@@ -1,3 +1,4 @@
+#include <sched.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
@@ -9,14 +10,25 @@
 #include <cmocka.h>
 // clang-format on
 
+#include "internal/time_utils.h"
 #include "internal/utils.h"
 #include "sunset/base64.h"
-#include "sunset/bitmask.h"
+#include "sunset/broadphase.h"
 #include "sunset/camera.h"
+#include "sunset/component_mask.h"
 #include "sunset/ecs.h"
+#include "sunset/ecs_commands.h"
+#include "sunset/errors.h"
+#include "sunset/fixed_step.h"
+#include "sunset/hierarchy.h"
 #include "sunset/images.h"
+#include "sunset/integrate.h"
+#include "sunset/islands.h"
 #include "sunset/ring_buffer.h"
+#include "sunset/scheduler.h"
+#include "sunset/thread_pool.h"
 #include "sunset/vector.h"
+#include "sunset/vfs.h"
 
 struct element {
     int x;
@@ -230,6 +242,43 @@ DECLARE_COMPONENT_ID(Position);
 DECLARE_COMPONENT_ID(Velocity);
 DECLARE_COMPONENT_ID(Health);
 
+void test_component_mask(void **state) {
+    unused(state);
+
+    // lands in the second word when there is one
+    size_t const middle = 64 % ECS_MAX_COMPONENTS + 3;
+    size_t const last = ECS_MAX_COMPONENTS - 1;
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, 1);
+    cmask_set(&mask, middle);
+    cmask_set(&mask, last);
+
+    ComponentMask other = cmask_empty();
+    cmask_set(&other, last);
+
+    assert_true(cmask_is_superset(&mask, &other));
+    assert_false(cmask_is_superset(&other, &mask));
+    assert_true(cmask_intersects(&mask, &other));
+    assert_int_equal(cmask_popcount(&mask), 3);
+
+    ComponentMask rest = cmask_without(&mask, &other);
+    assert_false(cmask_is_set(&rest, last));
+    assert_false(cmask_intersects(&rest, &other));
+    assert_int_equal(cmask_next(&rest, 0), 1);
+    assert_int_equal(cmask_next(&rest, 2), middle);
+    assert_int_equal(cmask_next(&other, last + 1), ECS_MAX_COMPONENTS);
+
+    cmask_set(&rest, last);
+    assert_true(cmask_is_eql(&rest, &mask));
+    assert_int_equal(cmask_hash(&rest), cmask_hash(&mask));
+
+    cmask_unset(&rest, middle);
+    assert_false(cmask_is_eql(&rest, &mask));
+    assert_false(cmask_is_zero(&rest));
+    assert_true(cmask_is_zero(&(ComponentMask){0}));
+}
+
 void test_ecs(void **state) {
     unused(state);
 
@@ -260,7 +309,7 @@ void test_ecs(void **state) {
     entity_builder_add(&builder, COMPONENT_ID(Velocity), &vel2);
     entity_builder_add(&builder, COMPONENT_ID(Position), &pos2);
     entity_builder_add(&builder, COMPONENT_ID(Health), &hea2);
-    Index e2 = entity_builder_finish(&builder);
+    Entity e2 = entity_builder_finish(&builder);
 
     Position pos3 = {4.0f, 5.0f};
     Velocity vel3 = {0.0f, 0.0f};
@@ -270,10 +319,9 @@ void test_ecs(void **state) {
     entity_builder_add(&builder, COMPONENT_ID(Position), &pos3);
     entity_builder_finish(&builder);
 
-    Bitmask system_mask;
-    bitmask_init_empty(64, &system_mask);
-    bitmask_set(&system_mask, COMPONENT_ID(Position));
-    bitmask_set(&system_mask, COMPONENT_ID(Velocity));
+    ComponentMask system_mask = cmask_empty();
+    cmask_set(&system_mask, COMPONENT_ID(Position));
+    cmask_set(&system_mask, COMPONENT_ID(Velocity));
 
     WorldIterator it = worldit_create(&ecs, system_mask);
 
@@ -321,8 +369,6 @@ void test_ecs(void **state) {
         assert_float_equal(v->y, 0.0f, EPSILON);
     }
 
-    worldit_destroy(&it);
-
     ecs_remove_entity(&ecs, e2);
 
     Position pos4 = {5.0f, 6.0f};
@@ -333,7 +379,7 @@ void test_ecs(void **state) {
     entity_builder_add(&builder, COMPONENT_ID(Velocity), &vel4);
     entity_builder_add(&builder, COMPONENT_ID(Position), &pos4);
     entity_builder_add(&builder, COMPONENT_ID(Health), &hea4);
-    Index e4 = entity_builder_finish(&builder);
+    Entity e4 = entity_builder_finish(&builder);
 
     {
         Velocity *v = ecs_get_component(&ecs, e4, COMPONENT_ID(Velocity));
@@ -342,6 +388,2244 @@ void test_ecs(void **state) {
     }
 }
 
+void test_ecs_archetype_lookup(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    for (size_t i = 0; i < 8; i++) {
+        _ecs_register_component(
+                &ecs, sizeof(int), "int", COMPONENT_STORAGE_TABLE);
+    }
+
+    // every non-empty subset of 8 components, enough to grow the table
+    vector(Entity) entities;
+    vector_init(entities);
+
+    for (size_t subset = 1; subset < 256; subset++) {
+        ComponentMask mask = cmask_empty();
+        mask.words[0] = subset;
+
+        vector_append(entities, ecs_add_entity(&ecs, mask));
+    }
+
+    assert_int_equal(vector_size(ecs.archetypes), 255);
+
+    for (size_t subset = 1; subset < 256; subset++) {
+        Entity entity = entities[subset - 1];
+        ComponentMask mask = cmask_empty();
+        mask.words[0] = subset;
+
+        // same mask resolves to the same archetype
+        Entity again = ecs_add_entity(&ecs, mask);
+        assert_int_equal(ecs_entity_ptr(&ecs, again).archetype,
+                ecs_entity_ptr(&ecs, entity).archetype);
+
+        for (size_t id = 0; id < 8; id++) {
+            void *component = ecs_get_component(&ecs, entity, id);
+            if (subset & (1 << id)) {
+                assert_non_null(component);
+            } else {
+                assert_null(component);
+            }
+        }
+    }
+
+    assert_int_equal(vector_size(ecs.archetypes), 255);
+
+    vector_destroy(entities);
+}
+
+void test_ecs_query(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    ComponentMask query_mask = cmask_empty();
+    cmask_set(&query_mask, COMPONENT_ID(Position));
+
+    Query query;
+    query_init(&query, query_mask);
+
+    Position pos = {1.0f, 2.0f};
+    Health hea = {100};
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+    entity_builder_finish(&builder);
+
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Health), &hea);
+    entity_builder_finish(&builder);
+
+    size_t visited = 0;
+    for (WorldIterator it = worldit_from_query(&ecs, &query);
+            worldit_is_valid(&it);
+            worldit_advance(&it)) {
+        visited++;
+    }
+
+    assert_int_equal(visited, 1);
+    assert_int_equal(vector_size(query.archetypes), 1);
+
+    // a new matching archetype is picked up by the same query
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+    entity_builder_add(&builder, COMPONENT_ID(Health), &hea);
+    entity_builder_finish(&builder);
+
+    visited = 0;
+    for (WorldIterator it = worldit_from_query(&ecs, &query);
+            worldit_is_valid(&it);
+            worldit_advance(&it)) {
+        Position *p = worldit_get_component(&it, COMPONENT_ID(Position));
+        assert_float_equal(p->x, 1.0f, EPSILON);
+        visited++;
+    }
+
+    assert_int_equal(visited, 2);
+    assert_int_equal(vector_size(query.archetypes), 2);
+    assert_int_equal(query.num_archetypes_seen, 3);
+
+    query_destroy(&query);
+}
+
+void test_ecs_spans(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    for (size_t i = 0; i < 10; i++) {
+        Position pos = {i, 0.0f};
+        Velocity vel = {1.0f, 2.0f};
+        Health hea = {1};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        entity_builder_add(&builder, COMPONENT_ID(Velocity), &vel);
+        if (i % 2 == 0) {
+            entity_builder_add(&builder, COMPONENT_ID(Health), &hea);
+        }
+        entity_builder_finish(&builder);
+    }
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Velocity));
+
+    Query query;
+    query_init(&query, mask);
+
+    size_t num_spans = 0;
+    size_t num_rows = 0;
+
+    SpanIterator it = spanit_create(&ecs, &query);
+    ArchetypeSpan span;
+    while (spanit_next(&it, &span)) {
+        Position *p = span_column(&span, Position);
+        Velocity const *v = span_column(&span, Velocity);
+
+        for (size_t i = 0; i < span.count; i++) {
+            p[i].x += v[i].x;
+            p[i].y += v[i].y;
+        }
+
+        num_spans++;
+        num_rows += span.count;
+    }
+
+    assert_int_equal(num_spans, 2);
+    assert_int_equal(num_rows, 10);
+
+    for (Index i = 0; i < 10; i++) {
+        Position *p = ecs_get_component(&ecs, i, COMPONENT_ID(Position));
+        assert_float_equal(p->x, i + 1.0f, EPSILON);
+        assert_float_equal(p->y, 2.0f, EPSILON);
+    }
+
+    query_destroy(&query);
+}
+
+static void add_velocity_span(World *world,
+        ArchetypeSpan const *span,
+        size_t worker_index,
+        void *ctx) {
+    unused(world);
+    unused(worker_index);
+    unused(ctx);
+
+    Position *p = span_column(span, Position);
+    Velocity const *v = span_column(span, Velocity);
+
+    for (size_t i = 0; i < span->count; i++) {
+        p[i].x += v[i].x;
+        p[i].y += v[i].y;
+    }
+}
+
+void test_ecs_par_for(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    size_t const num_entities = 5000;
+
+    for (size_t i = 0; i < num_entities; i++) {
+        Position pos = {i, 0.0f};
+        Velocity vel = {1.0f, 2.0f};
+        Health hea = {1};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        entity_builder_add(&builder, COMPONENT_ID(Velocity), &vel);
+        if (i % 3 == 0) {
+            entity_builder_add(&builder, COMPONENT_ID(Health), &hea);
+        }
+        entity_builder_finish(&builder);
+    }
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Velocity));
+
+    Query query;
+    query_init(&query, mask);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    for (size_t i = 0; i < 4; i++) {
+        ecs_par_for(&ecs, &query, &pool, 64, add_velocity_span, NULL);
+    }
+
+    thread_pool_destroy(&pool);
+
+    for (Index i = 0; i < num_entities; i++) {
+        Position *p = ecs_get_component(&ecs, i, COMPONENT_ID(Position));
+        assert_float_equal(p->x, i + 4.0f, EPSILON);
+        assert_float_equal(p->y, 8.0f, EPSILON);
+    }
+
+    query_destroy(&query);
+}
+
+typedef struct Big {
+    uint8_t bytes[250];
+} Big;
+
+DECLARE_COMPONENT_ID(Big);
+
+void test_ecs_spawn_batch(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Big);
+
+    ComponentMask mask = cmask_empty();
+
+    Entity first = ecs_add_entity(&ecs, mask);
+    ecs_remove_entity(&ecs, first);
+
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Velocity));
+
+    // spread over three pages
+    size_t const count = 2 * ECS_PAGE_ROWS + ECS_PAGE_ROWS / 2;
+    Entity *entities = calloc(count, sizeof(Entity));
+
+    SpanIterator it = ecs_spawn_batch(&ecs, mask, count, entities);
+    ArchetypeSpan span;
+    size_t spawned = 0;
+    size_t num_spans = 0;
+
+    while (spanit_next(&it, &span)) {
+        Position *p = span_column(&span, Position);
+        for (size_t i = 0; i < span.count; i++) {
+            p[i] = (Position){spawned + i, -(float)(spawned + i)};
+        }
+
+        spawned += span.count;
+        num_spans++;
+    }
+
+    assert_int_equal(spawned, count);
+    assert_int_equal(num_spans, 3);
+
+    // the freed slot is handed out first, under a new generation
+    assert_int_equal(entity_index(entities[0]), entity_index(first));
+    assert_int_equal(entity_generation(entities[0]),
+            entity_generation(first) + 1);
+    assert_false(ecs_is_alive(&ecs, first));
+
+    for (size_t i = 0; i < count; i++) {
+        Position *pos = ecs_get_component(
+                &ecs, entities[i], COMPONENT_ID(Position));
+        Velocity *vel = ecs_get_component(
+                &ecs, entities[i], COMPONENT_ID(Velocity));
+
+        assert_float_equal(pos->x, i, EPSILON);
+        assert_float_equal(pos->y, -(float)i, EPSILON);
+        assert_float_equal(vel->x, 0.0f, EPSILON);
+    }
+
+    // the second component spills past the inline builder storage
+    Big big1;
+    memset(big1.bytes, 1, sizeof(big1.bytes));
+    Position pos = {7.0f, 8.0f};
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+    entity_builder_add(&builder, COMPONENT_ID(Big), &big1);
+    Entity e = entity_builder_finish(&builder);
+
+    Big *big = ecs_get_component(&ecs, e, COMPONENT_ID(Big));
+    assert_memory_equal(big->bytes, big1.bytes, sizeof(big1.bytes));
+    Position *p2 = ecs_get_component(&ecs, e, COMPONENT_ID(Position));
+    assert_float_equal(p2->y, 8.0f, EPSILON);
+
+    free(entities);
+}
+
+void test_ecs_paged_columns(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+
+    Position pos = {42.0f, 0.0f};
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+    Entity first = entity_builder_finish(&builder);
+
+    Position *first_pos =
+            ecs_get_component(&ecs, first, COMPONENT_ID(Position));
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+
+    // growing the archetype appends pages instead of moving rows
+    for (size_t i = 0; i < 3; i++) {
+        ecs_spawn_batch(&ecs, mask, ECS_PAGE_ROWS, NULL);
+        assert_ptr_equal(
+                ecs_get_component(&ecs, first, COMPONENT_ID(Position)),
+                first_pos);
+    }
+
+    Query query;
+    query_init(&query, mask);
+
+    SpanIterator it = spanit_create(&ecs, &query);
+    ArchetypeSpan span;
+    size_t num_rows = 0;
+
+    while (spanit_next(&it, &span)) {
+        Position *p = span_column(&span, Position);
+
+        assert_true(span.count <= ECS_PAGE_ROWS);
+        if (span.begin % ECS_PAGE_ROWS == 0) {
+            assert_int_equal((uintptr_t)p % ECS_PAGE_ALIGNMENT, 0);
+        }
+
+        num_rows += span.count;
+    }
+
+    assert_int_equal(num_rows, 3 * ECS_PAGE_ROWS + 1);
+    assert_float_equal(first_pos->x, 42.0f, EPSILON);
+
+    query_destroy(&query);
+    ecs_destroy(&ecs);
+}
+
+void test_ecs_remove_entity(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    Entity entities[5];
+
+    for (size_t i = 0; i < 5; i++) {
+        Position pos = {i, 0.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        entities[i] = entity_builder_finish(&builder);
+    }
+
+    ecs_remove_entity(&ecs, entities[1]);
+    ecs_remove_entity(&ecs, entities[4]);
+
+    Archetype *archetype = &ecs.archetypes[0];
+    assert_int_equal(archetype->num_elements, 3);
+
+    // the last row was moved into the hole and its pointer patched
+    assert_int_equal(ecs_entity_ptr(&ecs, entities[3]).element, 1);
+
+    for (size_t i = 0; i < 5; i++) {
+        if (i == 1 || i == 4) {
+            continue;
+        }
+
+        Position *p = ecs_get_component(
+                &ecs, entities[i], COMPONENT_ID(Position));
+        assert_float_equal(p->x, i, EPSILON);
+
+        EntityPtr eptr = ecs_entity_ptr(&ecs, entities[i]);
+        assert_int_equal(archetype->entities[eptr.element],
+                entity_index(entities[i]));
+    }
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+
+    Query query;
+    query_init(&query, mask);
+
+    size_t visited = 0;
+    for (WorldIterator it = worldit_from_query(&ecs, &query);
+            worldit_is_valid(&it);
+            worldit_advance(&it)) {
+        visited++;
+    }
+
+    assert_int_equal(visited, 3);
+
+    ecs_compress(&ecs);
+
+    // freed slots keep their generations, so the table isn't trimmed
+    assert_int_equal(vector_size(ecs.entity_ptrs), 5);
+    assert_int_equal(vector_size(ecs.free_ids), 2);
+    assert_false(ecs_is_alive(&ecs, entities[4]));
+
+    query_destroy(&query);
+}
+
+void test_ecs_add_remove_component(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    Entity entities[3];
+
+    for (size_t i = 0; i < 3; i++) {
+        Position pos = {i, 1.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        entities[i] = entity_builder_finish(&builder);
+    }
+
+    Health hea = {42};
+
+    for (size_t round = 0; round < 3; round++) {
+        ecs_add_component(&ecs, entities[0], COMPONENT_ID(Health), &hea);
+
+        Health *h =
+                ecs_get_component(&ecs, entities[0], COMPONENT_ID(Health));
+        assert_non_null(h);
+        assert_int_equal(h->value, 42);
+
+        Position *p = ecs_get_component(
+                &ecs, entities[0], COMPONENT_ID(Position));
+        assert_float_equal(p->x, 0.0f, EPSILON);
+        assert_float_equal(p->y, 1.0f, EPSILON);
+
+        ecs_remove_component(&ecs, entities[0], COMPONENT_ID(Health));
+
+        assert_null(
+                ecs_get_component(&ecs, entities[0], COMPONENT_ID(Health)));
+    }
+
+    // toggling only ever touches the two archetypes
+    assert_int_equal(vector_size(ecs.archetypes), 2);
+    assert_int_equal(vector_size(ecs.archetypes[0].edges), 1);
+    assert_int_equal(ecs.archetypes[0].edges[0].add, 1);
+    assert_int_equal(ecs.archetypes[1].edges[0].remove, 0);
+
+    // other entities were shuffled by the swap-removes but kept their data
+    for (size_t i = 1; i < 3; i++) {
+        Position *p = ecs_get_component(
+                &ecs, entities[i], COMPONENT_ID(Position));
+        assert_float_equal(p->x, i, EPSILON);
+    }
+
+    ecs_add_component(&ecs, entities[1], COMPONENT_ID(Velocity), NULL);
+    Velocity *v =
+            ecs_get_component(&ecs, entities[1], COMPONENT_ID(Velocity));
+    assert_non_null(v);
+    assert_float_equal(v->x, 0.0f, EPSILON);
+}
+
+void test_ecs_stale_handles(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    Position pos = {1.0f, 2.0f};
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+    Entity old = entity_builder_finish(&builder);
+
+    ecs_remove_entity(&ecs, old);
+
+    Position pos2 = {3.0f, 4.0f};
+
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &pos2);
+    Entity reused = entity_builder_finish(&builder);
+
+    assert_int_equal(entity_index(reused), entity_index(old));
+    assert_true(ecs_is_alive(&ecs, reused));
+    assert_false(ecs_is_alive(&ecs, old));
+    assert_false(ecs_is_alive(&ecs, ENTITY_INVALID));
+
+    // the old handle must not reach the slot's new occupant
+    assert_null(ecs_get_component(&ecs, old, COMPONENT_ID(Position)));
+    assert_true(eptr_eql(ecs_entity_ptr(&ecs, old), ENTITY_PTR_INVALID));
+    assert_int_equal(
+            ecs_ptr_entity(&ecs, ecs_entity_ptr(&ecs, reused)), reused);
+    assert_int_equal(
+            ecs_ptr_entity(&ecs, ENTITY_PTR_INVALID), ENTITY_INVALID);
+
+    ecs_add_component(&ecs, old, COMPONENT_ID(Health), NULL);
+    ecs_remove_entity(&ecs, old);
+
+    assert_true(ecs_is_alive(&ecs, reused));
+    assert_null(ecs_get_component(&ecs, reused, COMPONENT_ID(Health)));
+
+    Position *p =
+            ecs_get_component(&ecs, reused, COMPONENT_ID(Position));
+    assert_float_equal(p->x, 3.0f, EPSILON);
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+
+    Query query;
+    query_init(&query, mask);
+
+    SpanIterator it = spanit_create(&ecs, &query);
+    ArchetypeSpan span;
+    assert_true(spanit_next(&it, &span));
+    assert_int_equal(span_get_entity(&ecs, &span, 0), reused);
+
+    query_destroy(&query);
+}
+
+typedef struct Hit {
+    uint32_t damage;
+} Hit;
+
+DECLARE_COMPONENT_ID(Hit);
+
+void test_ecs_sparse_components(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_SPARSE_COMPONENT(&ecs, Hit);
+
+    Entity entities[10];
+
+    for (size_t i = 0; i < 10; i++) {
+        Position pos = {i, 0.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        entities[i] = entity_builder_finish(&builder);
+    }
+
+    size_t num_archetypes = vector_size(ecs.archetypes);
+    EntityPtr eptr = ecs_entity_ptr(&ecs, entities[4]);
+
+    // toggling a sparse component neither moves rows nor creates
+    // archetypes
+    for (size_t i = 0; i < 10; i += 2) {
+        Hit hit = {i};
+        ecs_add_component(&ecs, entities[i], COMPONENT_ID(Hit), &hit);
+    }
+
+    assert_int_equal(vector_size(ecs.archetypes), num_archetypes);
+    assert_true(eptr_eql(ecs_entity_ptr(&ecs, entities[4]), eptr));
+
+    Hit *hit = ecs_get_component(&ecs, entities[4], COMPONENT_ID(Hit));
+    assert_int_equal(hit->damage, 4);
+    assert_null(ecs_get_component(&ecs, entities[5], COMPONENT_ID(Hit)));
+
+    ecs_remove_component(&ecs, entities[0], COMPONENT_ID(Hit));
+    ecs_remove_entity(&ecs, entities[2]);
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Hit));
+
+    Query query;
+    query_init(&query, mask);
+
+    // spans only cover rows that have the sparse component
+    SpanIterator it = spanit_create(&ecs, &query);
+    ArchetypeSpan span;
+    size_t num_rows = 0;
+
+    while (spanit_next(&it, &span)) {
+        assert_null(span_get_column(&span, COMPONENT_ID(Hit)));
+
+        for (size_t i = 0; i < span.count; i++) {
+            Position *p = span_get_component(
+                    &ecs, &span, COMPONENT_ID(Position), i);
+            Hit *h = span_get_component(
+                    &ecs, &span, COMPONENT_ID(Hit), i);
+
+            assert_non_null(h);
+            assert_int_equal(h->damage, (uint32_t)p->x);
+            num_rows++;
+        }
+    }
+
+    assert_int_equal(num_rows, 3);
+
+    WorldIterator wit = worldit_from_query(&ecs, &query);
+    num_rows = 0;
+
+    while (worldit_is_valid(&wit)) {
+        Hit *h = worldit_get_component(&wit, COMPONENT_ID(Hit));
+        assert_int_equal(h->damage % 2, 0);
+        num_rows++;
+        worldit_advance(&wit);
+    }
+
+    assert_int_equal(num_rows, 3);
+
+    // builders and batches take sparse components like any other
+    Hit hit2 = {42};
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, &ecs);
+    entity_builder_add(&builder, COMPONENT_ID(Hit), &hit2);
+    Entity tagged = entity_builder_finish(&builder);
+
+    hit = ecs_get_component(&ecs, tagged, COMPONENT_ID(Hit));
+    assert_int_equal(hit->damage, 42);
+
+    Entity spawned[3];
+    ecs_spawn_batch(&ecs, query.mask, 3, spawned);
+    assert_non_null(
+            ecs_get_component(&ecs, spawned[2], COMPONENT_ID(Hit)));
+
+    // sparse sets survive a save and load
+    VfsFile file;
+    assert_int_equal(vfs_create_tempfile(&file), 0);
+
+    Writer writer = vfs_file_writer(&file);
+    assert_int_equal(ecs_save(&ecs, &writer), 0);
+
+    World loaded;
+    ecs_init(&loaded);
+    REGISTER_COMPONENT(&loaded, Position);
+    REGISTER_SPARSE_COMPONENT(&loaded, Hit);
+
+    assert_int_equal(ecs_load(&loaded, &file), 0);
+    vfs_close(&file);
+
+    hit = ecs_get_component(&loaded, entities[8], COMPONENT_ID(Hit));
+    assert_int_equal(hit->damage, 8);
+    assert_null(ecs_get_component(&loaded, entities[0], COMPONENT_ID(Hit)));
+
+    query_destroy(&query);
+    ecs_destroy(&loaded);
+    ecs_destroy(&ecs);
+}
+
+static size_t count_changed_spans(
+        World *ecs, Query *query, size_t *rows_out) {
+    size_t num_spans = 0;
+    *rows_out = 0;
+
+    SpanIterator it = spanit_create(ecs, query);
+    ArchetypeSpan span;
+    while (spanit_next(&it, &span)) {
+        num_spans++;
+
+        for (size_t i = 0; i < span.count; i++) {
+            if (span_row_changed(&span, COMPONENT_ID(Position), i)) {
+                (*rows_out)++;
+            }
+        }
+    }
+
+    return num_spans;
+}
+
+static size_t count_query_rows(World *world, Query *query) {
+    SpanIterator it = spanit_create(world, query);
+    ArchetypeSpan span;
+    size_t num_rows = 0;
+
+    while (spanit_next(&it, &span)) {
+        num_rows += span.count;
+    }
+
+    return num_rows;
+}
+
+void test_ecs_query_terms(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+    REGISTER_SPARSE_COMPONENT(&ecs, Hit);
+
+    ComponentMask pos_mask = cmask_empty();
+    cmask_set(&pos_mask, COMPONENT_ID(Position));
+
+    ComponentMask pos_vel_mask = pos_mask;
+    cmask_set(&pos_vel_mask, COMPONENT_ID(Velocity));
+
+    ComponentMask pos_hea_mask = pos_mask;
+    cmask_set(&pos_hea_mask, COMPONENT_ID(Health));
+
+    ComponentMask vel_mask = cmask_empty();
+    cmask_set(&vel_mask, COMPONENT_ID(Velocity));
+
+    Entity pos_entities[4];
+    Entity pos_hea_entities[2];
+
+    ecs_spawn_batch(&ecs, pos_mask, 4, pos_entities);
+    ecs_spawn_batch(&ecs, pos_vel_mask, 3, NULL);
+    ecs_spawn_batch(&ecs, pos_hea_mask, 2, pos_hea_entities);
+    ecs_spawn_batch(&ecs, vel_mask, 5, NULL);
+
+    ecs_add_component(&ecs, pos_entities[1], COMPONENT_ID(Hit), NULL);
+    ecs_add_component(&ecs, pos_hea_entities[0], COMPONENT_ID(Hit), NULL);
+
+    // optional columns are either there or NULL for a whole span
+    Query moving;
+    query_init(&moving, pos_mask);
+    query_without(&moving, COMPONENT_ID(Velocity));
+    query_optional(&moving, COMPONENT_ID(Health));
+
+    SpanIterator it = spanit_create(&ecs, &moving);
+    ArchetypeSpan span;
+    size_t num_rows = 0;
+    size_t num_health_rows = 0;
+
+    while (spanit_next(&it, &span)) {
+        assert_null(span_get_column(&span, COMPONENT_ID(Velocity)));
+
+        if (span_get_column(&span, COMPONENT_ID(Health))) {
+            num_health_rows += span.count;
+        }
+
+        num_rows += span.count;
+    }
+
+    assert_int_equal(num_rows, 6);
+    assert_int_equal(num_health_rows, 2);
+    assert_int_equal(vector_size(moving.archetypes), 2);
+
+    Query any;
+    query_init(&any, cmask_empty());
+    query_any_of(&any, COMPONENT_ID(Velocity));
+    query_any_of(&any, COMPONENT_ID(Health));
+    assert_int_equal(count_query_rows(&ecs, &any), 10);
+
+    // sparse terms are checked per row
+    Query unhit;
+    query_init(&unhit, pos_mask);
+    query_without(&unhit, COMPONENT_ID(Hit));
+    assert_int_equal(count_query_rows(&ecs, &unhit), 7);
+
+    num_rows = 0;
+    for (WorldIterator wit = worldit_from_query(&ecs, &unhit);
+            worldit_is_valid(&wit);
+            worldit_advance(&wit)) {
+        assert_null(worldit_get_component(&wit, COMPONENT_ID(Hit)));
+        num_rows++;
+    }
+
+    assert_int_equal(num_rows, 7);
+
+    Query hit_or_moving;
+    query_init(&hit_or_moving, cmask_empty());
+    query_any_of(&hit_or_moving, COMPONENT_ID(Velocity));
+    query_any_of(&hit_or_moving, COMPONENT_ID(Hit));
+    assert_int_equal(count_query_rows(&ecs, &hit_or_moving), 10);
+
+    query_destroy(&moving);
+    query_destroy(&any);
+    query_destroy(&unhit);
+    query_destroy(&hit_or_moving);
+    ecs_destroy(&ecs);
+}
+
+typedef struct Surface {
+    float friction;
+    uint32_t color;
+} Surface;
+
+DECLARE_COMPONENT_ID(Surface);
+
+void test_ecs_shared_components(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_SHARED_COMPONENT(&ecs, Surface);
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Surface));
+
+    Surface const wood = {0.5f, 0x8b4513};
+    Surface const ice = {0.05f, 0xe0ffff};
+
+    size_t const num_entities = 100;
+    Entity entities[num_entities];
+
+    SpanIterator it = ecs_spawn_batch(&ecs, mask, num_entities, entities);
+    ArchetypeSpan span;
+    size_t spawned = 0;
+
+    while (spanit_next(&it, &span)) {
+        for (size_t i = 0; i < span.count; i++, spawned++) {
+            ecs_write_component(&ecs,
+                    span_get_entityptr(&span, i),
+                    COMPONENT_ID(Surface),
+                    spawned % 2 ? &ice : &wood);
+        }
+    }
+
+    // the zeroed value and one copy of each material
+    SharedTable const *table = &ecs.shared_tables[COMPONENT_ID(Surface)];
+    assert_int_equal(vector_size(table->refcounts), 3);
+
+    // columns hold handles, equal for equal values
+    Query query;
+    query_init(&query, mask);
+
+    it = spanit_create(&ecs, &query);
+    assert_true(spanit_next(&it, &span));
+
+    SharedRef const *refs =
+            span_get_column(&span, COMPONENT_ID(Surface));
+    SharedRef wood_ref = refs[0];
+    SharedRef ice_ref = refs[1];
+
+    assert_int_equal(refs[2], wood_ref);
+    assert_int_equal(table->refcounts[wood_ref], num_entities / 2);
+    assert_memory_equal(ecs_shared_value(
+                                &ecs, COMPONENT_ID(Surface), ice_ref),
+            &ice,
+            sizeof(ice));
+
+    // writing copies the value for one entity only
+    EntityPtr eptr = ecs_entity_ptr(&ecs, entities[0]);
+    Surface polished = wood;
+    polished.friction = 0.3f;
+    ecs_write_component(&ecs, eptr, COMPONENT_ID(Surface), &polished);
+
+    Surface const *m =
+            ecs_get_component(&ecs, entities[0], COMPONENT_ID(Surface));
+    assert_float_equal(m->friction, 0.3f, EPSILON);
+    m = ecs_get_component(&ecs, entities[2], COMPONENT_ID(Surface));
+    assert_float_equal(m->friction, 0.5f, EPSILON);
+    assert_int_equal(table->refcounts[wood_ref], num_entities / 2 - 1);
+
+    // an unreferenced value is freed and its slot reused
+    ecs_write_component(&ecs, eptr, COMPONENT_ID(Surface), &wood);
+    assert_int_equal(vector_size(table->free_refs), 1);
+    ecs_write_component(&ecs, eptr, COMPONENT_ID(Surface), &polished);
+    assert_int_equal(vector_size(table->refcounts), 4);
+
+    ecs_remove_component(&ecs, entities[1], COMPONENT_ID(Surface));
+    ecs_remove_entity(&ecs, entities[3]);
+    assert_int_equal(table->refcounts[ice_ref], num_entities / 2 - 2);
+
+    VfsFile file;
+    assert_int_equal(vfs_create_tempfile(&file), 0);
+
+    Writer writer = vfs_file_writer(&file);
+    assert_int_equal(ecs_save(&ecs, &writer), 0);
+
+    World loaded;
+    ecs_init(&loaded);
+
+    REGISTER_COMPONENT(&loaded, Position);
+    REGISTER_SHARED_COMPONENT(&loaded, Surface);
+
+    assert_int_equal(ecs_load(&loaded, &file), 0);
+    vfs_close(&file);
+
+    SharedTable const *loaded_table =
+            &loaded.shared_tables[COMPONENT_ID(Surface)];
+
+    for (size_t i = 0; i < vector_size(table->refcounts); i++) {
+        assert_int_equal(loaded_table->refcounts[i], table->refcounts[i]);
+    }
+
+    m = ecs_get_component(&loaded, entities[0], COMPONENT_ID(Surface));
+    assert_float_equal(m->friction, 0.3f, EPSILON);
+
+    // values loaded are deduplicated against like new ones
+    ecs_write_component(&loaded,
+            ecs_entity_ptr(&loaded, entities[0]),
+            COMPONENT_ID(Surface),
+            &ice);
+    assert_int_equal(
+            loaded_table->refcounts[ice_ref], num_entities / 2 - 1);
+
+    query_destroy(&query);
+    ecs_destroy(&loaded);
+    ecs_destroy(&ecs);
+}
+
+void test_ecs_blobs(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+
+    Entity entities[2];
+
+    for (size_t i = 0; i < 2; i++) {
+        Position pos = {i, 0.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        entities[i] = entity_builder_finish(&builder);
+    }
+
+    EntityPtr first = ecs_entity_ptr(&ecs, entities[0]);
+    EntityPtr second = ecs_entity_ptr(&ecs, entities[1]);
+
+    BlobRef path = ecs_blob_alloc(&ecs, first, 3 * sizeof(uint32_t));
+    BlobRef name = ecs_blob_alloc(&ecs, first, 5);
+    BlobRef points = ecs_blob_alloc(&ecs, second, 4 * sizeof(float));
+    BlobRef global = ecs_blob_alloc(&ecs, ENTITY_PTR_INVALID, 6);
+
+    assert_int_not_equal(path, BLOB_REF_NONE);
+    assert_null(blob_arena_get(&ecs.blobs, BLOB_REF_NONE));
+
+    uint32_t *steps = blob_arena_get(&ecs.blobs, path);
+    assert_int_equal(steps[0], 0);
+    assert_int_equal((uintptr_t)steps % BLOB_ALIGNMENT, 0);
+    steps[0] = 7;
+    steps[2] = 9;
+
+    memcpy(blob_arena_get(&ecs.blobs, name), "crate", 5);
+    memcpy(blob_arena_get(&ecs.blobs, global), "global", 6);
+
+    float *coords = blob_arena_get(&ecs.blobs, points);
+    for (size_t i = 0; i < 4; i++) {
+        coords[i] = 0.5f * i;
+    }
+
+    // not the last blob, so growing moves it and leaves garbage behind
+    blob_arena_resize(&ecs.blobs, path, 40 * sizeof(uint32_t));
+    steps = blob_arena_get(&ecs.blobs, path);
+    assert_int_equal(blob_arena_size(&ecs.blobs, path),
+            40 * sizeof(uint32_t));
+    assert_int_equal(steps[0], 7);
+    assert_int_equal(steps[2], 9);
+    assert_int_equal(steps[39], 0);
+    assert_true(ecs.blobs.garbage_size > 0);
+
+    // both blobs of the first entity go with it and their slots are
+    // handed out again
+    ecs_remove_entity(&ecs, entities[0]);
+
+    BlobRef reused = ecs_blob_alloc(&ecs, ENTITY_PTR_INVALID, 1);
+    assert_true(reused == path || reused == name);
+    blob_arena_free(&ecs.blobs, reused);
+
+    ecs_compress(&ecs);
+
+    assert_int_equal(ecs.blobs.garbage_size, 0);
+    assert_int_equal(vector_size(ecs.blobs.data), 2 * BLOB_ALIGNMENT);
+    assert_memory_equal(
+            blob_arena_get(&ecs.blobs, global), "global", 6);
+
+    VfsFile file;
+    assert_int_equal(vfs_create_tempfile(&file), 0);
+
+    Writer writer = vfs_file_writer(&file);
+    assert_int_equal(ecs_save(&ecs, &writer), 0);
+
+    World loaded;
+    ecs_init(&loaded);
+
+    REGISTER_COMPONENT(&loaded, Position);
+
+    assert_int_equal(ecs_load(&loaded, &file), 0);
+    vfs_close(&file);
+
+    coords = blob_arena_get(&loaded.blobs, points);
+    assert_int_equal(blob_arena_size(&loaded.blobs, points),
+            4 * sizeof(float));
+    assert_float_equal(coords[3], 1.5f, EPSILON);
+    assert_memory_equal(
+            blob_arena_get(&loaded.blobs, global), "global", 6);
+
+    // the owner lists are linked again on load
+    ecs_remove_entity(&loaded, entities[1]);
+    assert_int_equal(loaded.blobs.garbage_size, BLOB_ALIGNMENT);
+    assert_int_equal(ecs_blob_alloc(&loaded, ENTITY_PTR_INVALID, 8),
+            points);
+
+    ecs_destroy(&loaded);
+    ecs_destroy(&ecs);
+}
+
+void test_ecs_change_ticks(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+
+    Entity entities[6];
+
+    for (size_t i = 0; i < 6; i++) {
+        Position pos = {i, 0.0f};
+        Velocity vel = {1.0f, 0.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        if (i < 4) {
+            entity_builder_add(&builder, COMPONENT_ID(Velocity), &vel);
+        }
+        entities[i] = entity_builder_finish(&builder);
+    }
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+
+    Query query;
+    query_init(&query, mask);
+    query_filter_changed(&query, COMPONENT_ID(Position));
+
+    size_t rows;
+
+    // everything is new on the first run, nothing on the second
+    assert_int_equal(count_changed_spans(&ecs, &query, &rows), 2);
+    assert_int_equal(rows, 6);
+    assert_int_equal(count_changed_spans(&ecs, &query, &rows), 0);
+
+    uint32_t since = ecs_advance_tick(&ecs);
+
+    EntityPtr eptr = ecs_entity_ptr(&ecs, entities[2]);
+    Position *p =
+            ecs_component_from_ptr(&ecs, eptr, COMPONENT_ID(Position));
+    p->x = 10.0f;
+    ecs_mark_changed(&ecs, eptr, COMPONENT_ID(Position));
+
+    assert_true(
+            ecs_changed_since(&ecs, eptr, COMPONENT_ID(Position), since));
+    assert_false(
+            ecs_changed_since(&ecs, eptr, COMPONENT_ID(Velocity), since));
+
+    // only the archetype of the written row is visited, with a single
+    // changed row
+    assert_int_equal(count_changed_spans(&ecs, &query, &rows), 1);
+    assert_int_equal(rows, 1);
+
+    // swap-removal carries the row's tick along with its data
+    ecs_remove_entity(&ecs, entities[0]);
+    ecs_mark_changed(&ecs,
+            ecs_entity_ptr(&ecs, entities[3]),
+            COMPONENT_ID(Position));
+    ecs_remove_entity(&ecs, entities[1]);
+
+    assert_int_equal(count_changed_spans(&ecs, &query, &rows), 1);
+    assert_int_equal(rows, 1);
+
+    // adding a component counts as a write of the new column only
+    ecs_add_component(&ecs, entities[4], COMPONENT_ID(Velocity), NULL);
+
+    assert_int_equal(count_changed_spans(&ecs, &query, &rows), 1);
+    assert_int_equal(rows, 0);
+    assert_int_equal(count_changed_spans(&ecs, &query, &rows), 0);
+
+    query_destroy(&query);
+}
+
+typedef struct DeferredContext {
+    EcsCommandBuffer *cmdbufs;
+    Entity *entities;
+    Entity *spawned;
+} DeferredContext;
+
+static void record_deferred_span(World *world,
+        ArchetypeSpan const *span,
+        size_t worker_index,
+        void *ctx) {
+    DeferredContext *deferred = ctx;
+    EcsCommandBuffer *cmdbuf = &deferred->cmdbufs[worker_index];
+    Position const *p = span_column(span, Position);
+
+    for (size_t i = 0; i < span->count; i++) {
+        size_t n = p[i].x;
+
+        if (n % 2 == 0) {
+            ecs_cmdbuf_despawn(cmdbuf, deferred->entities[n]);
+        } else if (n % 3 == 0) {
+            Health hea = {n};
+            ecs_cmdbuf_add_component(cmdbuf,
+                    deferred->entities[n],
+                    COMPONENT_ID(Health),
+                    &hea);
+        }
+
+        Position pos = {n, 1.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, world);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        ecs_cmdbuf_spawn(cmdbuf, &builder, &deferred->spawned[n]);
+    }
+}
+
+void test_ecs_command_buffer(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    size_t const num_entities = 300;
+    Entity entities[num_entities];
+    Entity spawned[num_entities];
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Velocity));
+
+    SpanIterator it = ecs_spawn_batch(&ecs, mask, num_entities, entities);
+    ArchetypeSpan span;
+
+    while (spanit_next(&it, &span)) {
+        Position *p = span_column(&span, Position);
+        for (size_t i = 0; i < span.count; i++) {
+            p[i] = (Position){span.begin + i, 0.0f};
+        }
+    }
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    size_t num_cmdbufs = thread_pool_num_workers(&pool);
+    EcsCommandBuffer cmdbufs[num_cmdbufs];
+    for (size_t i = 0; i < num_cmdbufs; i++) {
+        ecs_cmdbuf_init(&cmdbufs[i], &ecs);
+    }
+
+    Query query;
+    query_init(&query, mask);
+
+    DeferredContext deferred = {
+            .cmdbufs = cmdbufs,
+            .entities = entities,
+            .spawned = spawned,
+    };
+    ecs_par_for(&ecs, &query, &pool, 16, record_deferred_span, &deferred);
+
+    // nothing is applied before the flush
+    assert_int_equal(vector_size(ecs.entity_ptrs), num_entities);
+
+    ecs_cmdbuf_flush(cmdbufs, num_cmdbufs, &ecs);
+
+    // all spawns share an archetype and went in as one batch
+    assert_int_equal(vector_size(ecs.archetypes), 3);
+
+    for (size_t n = 0; n < num_entities; n++) {
+        assert_int_equal(ecs_is_alive(&ecs, entities[n]), n % 2 != 0);
+
+        Health *h =
+                ecs_get_component(&ecs, entities[n], COMPONENT_ID(Health));
+        if (n % 2 != 0 && n % 3 == 0) {
+            assert_non_null(h);
+            assert_int_equal(h->value, n);
+        } else {
+            assert_null(h);
+        }
+
+        Position *pos =
+                ecs_get_component(&ecs, spawned[n], COMPONENT_ID(Position));
+        assert_non_null(pos);
+        assert_float_equal(pos->x, n, EPSILON);
+        assert_float_equal(pos->y, 1.0f, EPSILON);
+        assert_null(ecs_get_component(
+                &ecs, spawned[n], COMPONENT_ID(Velocity)));
+    }
+
+    // commands are regrouped by archetype, but the ones on the same
+    // entity still apply in the order they were recorded
+    Health health = {.value = 9};
+
+    ecs_cmdbuf_add_component(
+            &cmdbufs[0], entities[1], COMPONENT_ID(Health), &health);
+    ecs_cmdbuf_remove_component(
+            &cmdbufs[0], entities[3], COMPONENT_ID(Health));
+    ecs_cmdbuf_remove_component(
+            &cmdbufs[0], entities[1], COMPONENT_ID(Health));
+    ecs_cmdbuf_add_component(
+            &cmdbufs[0], entities[3], COMPONENT_ID(Health), &health);
+    ecs_cmdbuf_despawn(&cmdbufs[0], entities[7]);
+
+    ecs_cmdbuf_flush(cmdbufs, num_cmdbufs, &ecs);
+
+    assert_null(
+            ecs_get_component(&ecs, entities[1], COMPONENT_ID(Health)));
+    Health *h = ecs_get_component(&ecs, entities[3], COMPONENT_ID(Health));
+    assert_non_null(h);
+    assert_int_equal(h->value, 9);
+    assert_false(ecs_is_alive(&ecs, entities[7]));
+    assert_true(ecs_is_alive(&ecs, entities[9]));
+
+    // a despawn and an add on the same entity in different buffers apply
+    // in buffer order, whichever comes first. commands on a handle that
+    // was already stale are dropped.
+    ecs_cmdbuf_despawn(&cmdbufs[0], entities[5]);
+    ecs_cmdbuf_add_component(
+            &cmdbufs[1], entities[5], COMPONENT_ID(Health), &health);
+    ecs_cmdbuf_add_component(
+            &cmdbufs[0], entities[11], COMPONENT_ID(Health), &health);
+    ecs_cmdbuf_despawn(&cmdbufs[1], entities[11]);
+    ecs_cmdbuf_add_component(
+            &cmdbufs[1], entities[7], COMPONENT_ID(Health), &health);
+
+    ecs_cmdbuf_flush(cmdbufs, num_cmdbufs, &ecs);
+
+    assert_false(ecs_is_alive(&ecs, entities[5]));
+    assert_false(ecs_is_alive(&ecs, entities[7]));
+    assert_false(ecs_is_alive(&ecs, entities[11]));
+
+    // rows swapped into the removed ones still belong to their entity
+    for (size_t n = 1; n < num_entities; n += 2) {
+        if (n == 5 || n == 7 || n == 11) {
+            continue;
+        }
+
+        Position *pos = ecs_get_component(
+                &ecs, entities[n], COMPONENT_ID(Position));
+        assert_non_null(pos);
+        assert_float_equal(pos->x, n, EPSILON);
+    }
+
+    for (size_t i = 0; i < num_cmdbufs; i++) {
+        assert_true(vector_empty(cmdbufs[i].commands));
+        ecs_cmdbuf_destroy(&cmdbufs[i]);
+    }
+
+    thread_pool_destroy(&pool);
+    query_destroy(&query);
+}
+
+typedef struct TestSystem {
+    Query query;
+    _Atomic size_t *clock;
+    size_t order;
+} TestSystem;
+
+static void integrate_system(
+        SystemContext const *system_context, void *ctx) {
+    TestSystem *system = ctx;
+    system->order = atomic_fetch_add(system->clock, 1);
+
+    SpanIterator it = spanit_create(system_context->world, &system->query);
+    ArchetypeSpan span;
+    while (spanit_next(&it, &span)) {
+        Position *p = span_column(&span, Position);
+        Velocity const *v = span_column(&span, Velocity);
+
+        for (size_t i = 0; i < span.count; i++) {
+            p[i].x += v[i].x;
+        }
+    }
+}
+
+static void damp_system(SystemContext const *system_context, void *ctx) {
+    TestSystem *system = ctx;
+    system->order = atomic_fetch_add(system->clock, 1);
+
+    SpanIterator it = spanit_create(system_context->world, &system->query);
+    ArchetypeSpan span;
+    while (spanit_next(&it, &span)) {
+        Velocity *v = span_column(&span, Velocity);
+
+        for (size_t i = 0; i < span.count; i++) {
+            v[i].x *= 0.5f;
+        }
+    }
+}
+
+static void spawn_system(SystemContext const *system_context, void *ctx) {
+    TestSystem *system = ctx;
+    system->order = atomic_fetch_add(system->clock, 1);
+
+    Health hea = {1};
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, system_context->world);
+    entity_builder_add(&builder, COMPONENT_ID(Health), &hea);
+    ecs_cmdbuf_spawn(system_context->cmdbuf, &builder, NULL);
+}
+
+static void init_test_system(TestSystem *system,
+        _Atomic size_t *clock,
+        Index first_component,
+        Index second_component) {
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, first_component);
+    cmask_set(&mask, second_component);
+
+    query_init(&system->query, mask);
+    system->clock = clock;
+    system->order = SIZE_MAX;
+}
+
+void test_scheduler(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    ComponentMask mask = cmask_empty();
+    cmask_set(&mask, COMPONENT_ID(Position));
+    cmask_set(&mask, COMPONENT_ID(Velocity));
+
+    size_t const num_entities = 100;
+    SpanIterator it = ecs_spawn_batch(&ecs, mask, num_entities, NULL);
+    ArchetypeSpan span;
+
+    while (spanit_next(&it, &span)) {
+        Velocity *v = span_column(&span, Velocity);
+        for (size_t i = 0; i < span.count; i++) {
+            v[i].x = 1.0f;
+        }
+    }
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    Scheduler scheduler;
+    scheduler_init(&scheduler, &ecs, &pool);
+
+    _Atomic size_t clock = 0;
+    TestSystem systems[3];
+    for (size_t i = 0; i < 3; i++) {
+        init_test_system(&systems[i],
+                &clock,
+                COMPONENT_ID(Position),
+                COMPONENT_ID(Velocity));
+    }
+
+    // the spawner doesn't touch any columns and may run alongside both
+    Index spawn = scheduler_add_system(
+            &scheduler, "spawn", spawn_system, &systems[2]);
+    Index integrate = scheduler_add_system(
+            &scheduler, "integrate", integrate_system, &systems[0]);
+    scheduler_system_reads(&scheduler, integrate, COMPONENT_ID(Velocity));
+    scheduler_system_writes(&scheduler, integrate, COMPONENT_ID(Position));
+    Index damp = scheduler_add_system(
+            &scheduler, "damp", damp_system, &systems[1]);
+    scheduler_system_writes(&scheduler, damp, COMPONENT_ID(Velocity));
+
+    for (size_t run = 0; run < 2; run++) {
+        scheduler_run(&scheduler, 1.0f / 60.0f);
+
+        assert_true(systems[0].order < systems[1].order);
+    }
+
+    assert_int_equal(scheduler_get_system(&scheduler, spawn)
+                             ->num_dependencies,
+            0);
+    assert_int_equal(scheduler_get_system(&scheduler, damp)
+                             ->num_dependencies,
+            1);
+    assert_true(scheduler_get_system(&scheduler, integrate)->last_time_s
+            >= 0.0f);
+
+    // integrated with the undamped velocity first, then the halved one
+    for (size_t i = 0; i < num_entities; i++) {
+        Position *p = ecs_get_component(
+                &ecs, entity_make(i, 0), COMPONENT_ID(Position));
+        assert_float_equal(p->x, 1.5f, EPSILON);
+    }
+
+    // the spawns were deferred until the end of each run
+    assert_int_equal(vector_size(ecs.entity_ptrs), num_entities + 2);
+
+    scheduler_destroy(&scheduler);
+    thread_pool_destroy(&pool);
+
+    for (size_t i = 0; i < 3; i++) {
+        query_destroy(&systems[i].query);
+    }
+}
+
+void test_ecs_save_load(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    Entity entities[10];
+
+    for (size_t i = 0; i < 10; i++) {
+        Position pos = {i, 2.0f * i};
+        Health hea = {i};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        if (i % 2 == 0) {
+            entity_builder_add(&builder, COMPONENT_ID(Health), &hea);
+        }
+        entities[i] = entity_builder_finish(&builder);
+    }
+
+    ecs_remove_entity(&ecs, entities[3]);
+
+    VfsFile file;
+    assert_int_equal(vfs_create_tempfile(&file), 0);
+
+    Writer writer = vfs_file_writer(&file);
+    assert_int_equal(ecs_save(&ecs, &writer), 0);
+
+    World loaded;
+    ecs_init(&loaded);
+
+    REGISTER_COMPONENT(&loaded, Position);
+    REGISTER_COMPONENT(&loaded, Velocity);
+    REGISTER_COMPONENT(&loaded, Health);
+
+    assert_int_equal(ecs_load(&loaded, &file), 0);
+    vfs_close(&file);
+
+    // the pages point into the file mapping
+    assert_int_equal(loaded.archetypes[0].columns[0].num_borrowed_pages, 1);
+    assert_false(ecs_is_alive(&loaded, entities[3]));
+
+    for (size_t i = 0; i < 10; i++) {
+        if (i == 3) {
+            continue;
+        }
+
+        Position *p = ecs_get_component(
+                &loaded, entities[i], COMPONENT_ID(Position));
+        assert_float_equal(p->x, i, EPSILON);
+        assert_float_equal(p->y, 2.0f * i, EPSILON);
+
+        Health *h = ecs_get_component(
+                &loaded, entities[i], COMPONENT_ID(Health));
+        if (i % 2 == 0) {
+            assert_int_equal(h->value, i);
+        } else {
+            assert_null(h);
+        }
+    }
+
+    // growing an adopted column moves it to the heap first
+    Position pos = {42.0f, 0.0f};
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, &loaded);
+    entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+    Entity added = entity_builder_finish(&builder);
+
+    assert_int_equal(entity_index(added), entity_index(entities[3]));
+
+    Position *p =
+            ecs_get_component(&loaded, added, COMPONENT_ID(Position));
+    assert_float_equal(p->x, 42.0f, EPSILON);
+    p = ecs_get_component(&loaded, entities[1], COMPONENT_ID(Position));
+    assert_float_equal(p->x, 1.0f, EPSILON);
+
+    ecs_destroy(&loaded);
+
+    // a world with other components registered is rejected
+    assert_int_equal(vfs_create_tempfile(&file), 0);
+    writer = vfs_file_writer(&file);
+    assert_int_equal(ecs_save(&ecs, &writer), 0);
+
+    ecs_init(&loaded);
+    _ecs_register_component(&loaded,
+            sizeof(Velocity),
+            "Velocity",
+            COMPONENT_STORAGE_TABLE);
+    assert_int_equal(ecs_load(&loaded, &file), -ERROR_INVALID_FORMAT);
+    assert_null(loaded.mapping);
+
+    vfs_close(&file);
+    ecs_destroy(&loaded);
+    ecs_destroy(&ecs);
+}
+
+/// the bytes `ecs_save` writes for `world`, freed by the caller
+static uint8_t *save_to_memory(World const *world, size_t *size_out) {
+    VfsFile file;
+    assert_int_equal(vfs_create_tempfile(&file), 0);
+
+    Writer writer = vfs_file_writer(&file);
+    assert_int_equal(ecs_save(world, &writer), 0);
+
+    size_t size = vfs_file_size(&file);
+    uint8_t *data = sunset_malloc(size);
+
+    vfs_file_seek(&file, VFS_SEEK_SET, 0);
+    assert_int_equal(vfs_file_read(&file, size, data), size);
+    vfs_close(&file);
+
+    *size_out = size;
+    return data;
+}
+
+static int load_from_memory(
+        World *world, uint8_t const *data, size_t size) {
+    VfsFile file;
+    assert_int_equal(vfs_create_tempfile(&file), 0);
+    assert_int_equal(vfs_file_write(&file, data, size), size);
+
+    int retval = ecs_load(world, &file);
+    vfs_close(&file);
+
+    return retval;
+}
+
+/// offset of the first occurrence of `needle` in `data`, `SIZE_MAX` if
+/// there is none
+static size_t find_bytes(uint8_t const *data,
+        size_t size,
+        void const *needle,
+        size_t needle_size) {
+    for (size_t i = 0; i + needle_size <= size; i++) {
+        if (memcmp(data + i, needle, needle_size) == 0) {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+static void spawn_positions(World *world, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Position pos = {i, 0.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, world);
+        entity_builder_add(&builder, COMPONENT_ID(Position), &pos);
+        entity_builder_finish(&builder);
+    }
+}
+
+void test_ecs_load_duplicate_archetypes(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+
+    spawn_positions(&ecs, 5);
+
+    for (size_t i = 0; i < 5; i++) {
+        Velocity vel = {i, 0.0f};
+
+        EntityBuilder builder;
+        entity_builder_init(&builder, &ecs);
+        entity_builder_add(&builder, COMPONENT_ID(Velocity), &vel);
+        entity_builder_finish(&builder);
+    }
+
+    size_t size;
+    uint8_t *data = save_to_memory(&ecs, &size);
+
+    // the column ids of an archetype come right before its rows. both
+    // components have the same size, so the file stays well formed
+    // with the velocity archetype turned into a second position one.
+    EntityPtr eptr = ecs.entity_ptrs[5];
+    Archetype const *archetype = &ecs.archetypes[eptr.archetype];
+    size_t rows = find_bytes(data,
+            size,
+            archetype->entities,
+            5 * sizeof(Index));
+    assert_int_not_equal(rows, SIZE_MAX);
+
+    Index position_id = COMPONENT_ID(Position);
+    memcpy(data + rows - sizeof(Index), &position_id, sizeof(Index));
+
+    World loaded;
+    ecs_init(&loaded);
+
+    REGISTER_COMPONENT(&loaded, Position);
+    REGISTER_COMPONENT(&loaded, Velocity);
+
+    assert_int_equal(
+            load_from_memory(&loaded, data, size), -ERROR_INVALID_FORMAT);
+    assert_null(loaded.mapping);
+
+    free(data);
+    ecs_destroy(&loaded);
+    ecs_destroy(&ecs);
+}
+
+void test_ecs_load_mismatched_rows(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Health);
+
+    spawn_positions(&ecs, 4);
+
+    Health hea = {1};
+    ecs_add_component(&ecs, entity_make(0, 0), COMPONENT_ID(Health), &hea);
+
+    size_t size;
+    uint8_t *data = save_to_memory(&ecs, &size);
+
+    // swapping the rows of two slots keeps both within their archetypes,
+    // but neither row names the slot that points at it anymore
+    size_t num_entities = vector_size(ecs.entity_ptrs);
+    size_t entity_ptrs = find_bytes(data,
+            size,
+            ecs.entity_ptrs,
+            num_entities * sizeof(EntityPtr));
+    assert_int_not_equal(entity_ptrs, SIZE_MAX);
+
+    EntityPtr *file_ptrs = (EntityPtr *)(data + entity_ptrs);
+    EntityPtr first = file_ptrs[0];
+    file_ptrs[0] = file_ptrs[1];
+    file_ptrs[1] = first;
+
+    World loaded;
+    ecs_init(&loaded);
+
+    REGISTER_COMPONENT(&loaded, Position);
+    REGISTER_COMPONENT(&loaded, Health);
+
+    assert_int_equal(
+            load_from_memory(&loaded, data, size), -ERROR_INVALID_FORMAT);
+    assert_null(loaded.mapping);
+
+    free(data);
+    ecs_destroy(&loaded);
+    ecs_destroy(&ecs);
+}
+
+#define NUM_HIERARCHY_ENTITIES 1024
+
+typedef struct HierarchyVisits {
+    uint32_t counts[NUM_HIERARCHY_ENTITIES];
+    uint32_t depths[NUM_HIERARCHY_ENTITIES];
+} HierarchyVisits;
+
+static void record_hierarchy_visit(
+        Hierarchy const *hierarchy, uint32_t node, void *ctx) {
+    HierarchyVisits *visits = ctx;
+    Index entity = hierarchy->entities[node];
+    uint32_t parent = hierarchy->parents[node];
+
+    visits->counts[entity]++;
+    visits->depths[entity] = parent == HIERARCHY_ROOT
+            ? 0
+            : visits->depths[hierarchy->entities[parent]] + 1;
+}
+
+static size_t total_hierarchy_visits(HierarchyVisits *visits) {
+    size_t total = 0;
+
+    for (size_t i = 0; i < NUM_HIERARCHY_ENTITIES; i++) {
+        total += visits->counts[i];
+        visits->counts[i] = 0;
+    }
+
+    return total;
+}
+
+void test_hierarchy(void **state) {
+    unused(state);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    Hierarchy hierarchy;
+    hierarchy_init(&hierarchy);
+
+    HierarchyVisits *visits = sunset_malloc(sizeof(HierarchyVisits));
+    memset(visits, 0, sizeof(HierarchyVisits));
+
+    // 0 -> {1, 2}, 1 -> 3, 5 -> 4. 6 names a parent that isn't part of
+    // the hierarchy and 7 and 8 are each other's parent
+    hierarchy_set_parent(&hierarchy, 3, 1);
+    hierarchy_set_parent(&hierarchy, 1, 0);
+    hierarchy_set_parent(&hierarchy, 2, 0);
+    hierarchy_set_parent(&hierarchy, 0, HIERARCHY_ROOT);
+    hierarchy_set_parent(&hierarchy, 4, 5);
+    hierarchy_set_parent(&hierarchy, 5, HIERARCHY_ROOT);
+    hierarchy_set_parent(&hierarchy, 6, 9);
+    hierarchy_set_parent(&hierarchy, 7, 8);
+    hierarchy_set_parent(&hierarchy, 8, 7);
+
+    // plenty of small roots, so that they are split into several tasks
+    for (Index i = 10; i < NUM_HIERARCHY_ENTITIES; i++) {
+        hierarchy_set_parent(&hierarchy, i, HIERARCHY_ROOT);
+    }
+
+    assert_int_equal(hierarchy.num_entities, NUM_HIERARCHY_ENTITIES - 1);
+
+    hierarchy_propagate(
+            &hierarchy, &pool, record_hierarchy_visit, visits);
+
+    assert_int_equal(visits->depths[3], 2);
+    assert_int_equal(visits->depths[4], 1);
+    assert_int_equal(visits->depths[6], 0);
+    assert_int_equal(visits->counts[7], 0);
+    assert_int_equal(visits->counts[8], 0);
+    assert_int_equal(
+            total_hierarchy_visits(visits), NUM_HIERARCHY_ENTITIES - 3);
+
+    // nothing is visited until something is marked
+    hierarchy_propagate(
+            &hierarchy, &pool, record_hierarchy_visit, visits);
+    assert_int_equal(total_hierarchy_visits(visits), 0);
+
+    hierarchy_mark_dirty(&hierarchy, 1);
+    hierarchy_mark_dirty(&hierarchy, 3);
+    hierarchy_mark_dirty(&hierarchy, 4);
+    hierarchy_propagate(
+            &hierarchy, &pool, record_hierarchy_visit, visits);
+
+    assert_int_equal(visits->counts[1], 1);
+    assert_int_equal(visits->counts[3], 1);
+    assert_int_equal(visits->counts[4], 1);
+    assert_int_equal(total_hierarchy_visits(visits), 3);
+
+    // reparenting lays the hierarchy out again
+    hierarchy_set_parent(&hierarchy, 6, 3);
+    hierarchy_remove(&hierarchy, 1);
+    hierarchy_propagate(
+            &hierarchy, &pool, record_hierarchy_visit, visits);
+
+    assert_false(hierarchy_contains(&hierarchy, 1));
+    assert_int_equal(visits->depths[3], 0);
+    assert_int_equal(visits->depths[6], 1);
+    assert_int_equal(
+            total_hierarchy_visits(visits), NUM_HIERARCHY_ENTITIES - 4);
+
+    // an unrelated entity moving into the slot doesn't get its children
+    hierarchy_detach_children(&hierarchy, 1);
+    hierarchy_set_parent(&hierarchy, 1, HIERARCHY_ROOT);
+    hierarchy_propagate(
+            &hierarchy, &pool, record_hierarchy_visit, visits);
+
+    assert_int_equal(visits->depths[1], 0);
+    assert_int_equal(visits->depths[3], 0);
+    assert_int_equal(visits->depths[6], 1);
+    assert_int_equal(
+            total_hierarchy_visits(visits), NUM_HIERARCHY_ENTITIES - 3);
+
+    free(visits);
+    hierarchy_destroy(&hierarchy);
+    thread_pool_destroy(&pool);
+}
+
+#define NUM_BROADPHASE_BOXES 64
+
+static AABB random_box(uint32_t *seed) {
+    AABB box;
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        *seed = *seed * 1664525 + 1013904223;
+        // spread out along x, so that x ends up as the sweep axis
+        float spread = axis == 0 ? 100.0f : 10.0f;
+        float min = (float)(*seed >> 8) / (1 << 24) * spread;
+
+        box.min[axis] = min;
+        box.max[axis] = min + 1.0f + (float)(*seed & 0xff) / 64.0f;
+    }
+
+    return box;
+}
+
+static void check_broadphase_pairs(Broadphase const *broadphase) {
+    size_t num_proxies = vector_size(broadphase->boxes);
+    size_t expected = 0;
+
+    for (size_t a = 0; a < num_proxies; a++) {
+        for (size_t b = a + 1; b < num_proxies; b++) {
+            AABB const *box_a = &broadphase->boxes[a];
+            AABB const *box_b = &broadphase->boxes[b];
+            bool overlap = broadphase->live[a] && broadphase->live[b];
+
+            for (size_t axis = 0; axis < 3; axis++) {
+                overlap = overlap && box_a->max[axis] >= box_b->min[axis]
+                        && box_a->min[axis] <= box_b->max[axis];
+            }
+
+            if (!overlap) {
+                continue;
+            }
+
+            bool found = false;
+
+            for (size_t i = 0; i < vector_size(broadphase->pairs); i++) {
+                BroadphasePair pair = broadphase->pairs[i];
+                found = found || (pair.a == a && pair.b == b);
+            }
+
+            assert_true(found);
+            expected++;
+        }
+    }
+
+    assert_int_equal(vector_size(broadphase->pairs), expected);
+}
+
+void test_broadphase(void **state) {
+    unused(state);
+
+    Broadphase broadphase;
+    broadphase_init(&broadphase);
+
+    uint32_t seed = 1;
+    uint32_t proxies[NUM_BROADPHASE_BOXES];
+
+    for (size_t i = 0; i < NUM_BROADPHASE_BOXES; i++) {
+        AABB box = random_box(&seed);
+        proxies[i] = broadphase_add(&broadphase, &box);
+        assert_int_equal(proxies[i], i);
+    }
+
+    broadphase_find_pairs(&broadphase);
+    assert_int_equal(broadphase.axis, 0);
+    check_broadphase_pairs(&broadphase);
+
+    // boxes drift a little every step
+    for (size_t step = 0; step < 8; step++) {
+        for (size_t i = 0; i < NUM_BROADPHASE_BOXES; i++) {
+            AABB box = broadphase.boxes[proxies[i]];
+            float offset = (float)((i + step) % 5) - 2.0f;
+
+            box.min[0] += offset;
+            box.max[0] += offset;
+            broadphase_update(&broadphase, proxies[i], &box);
+        }
+
+        broadphase_find_pairs(&broadphase);
+        check_broadphase_pairs(&broadphase);
+    }
+
+    // touching boxes are a pair
+    AABB left = {
+            .min = {-20.0f, -20.0f, -20.0f},
+            .max = {-10.0f, -10.0f, -10.0f},
+    };
+    AABB right = {
+            .min = {-10.0f, -20.0f, -20.0f},
+            .max = {-5.0f, -10.0f, -10.0f},
+    };
+    broadphase_update(&broadphase, proxies[0], &left);
+    broadphase_update(&broadphase, proxies[1], &right);
+
+    broadphase_find_pairs(&broadphase);
+    check_broadphase_pairs(&broadphase);
+
+    // removed proxies are left out and handed out again
+    broadphase_remove(&broadphase, proxies[1]);
+    broadphase_remove(&broadphase, proxies[5]);
+    broadphase_find_pairs(&broadphase);
+    check_broadphase_pairs(&broadphase);
+
+    assert_int_equal(broadphase_add(&broadphase, &right), proxies[5]);
+    assert_int_equal(broadphase_add(&broadphase, &right), proxies[1]);
+    assert_int_equal(
+            vector_size(broadphase.endpoints), 2 * NUM_BROADPHASE_BOXES);
+
+    broadphase_find_pairs(&broadphase);
+    check_broadphase_pairs(&broadphase);
+
+    // moving everything along z switches the sweep axis
+    for (size_t i = 0; i < NUM_BROADPHASE_BOXES; i++) {
+        AABB box = broadphase.boxes[proxies[i]];
+        float offset = (float)i * 20.0f;
+
+        box.min[2] += offset;
+        box.max[2] += offset;
+        broadphase_update(&broadphase, proxies[i], &box);
+    }
+
+    broadphase_find_pairs(&broadphase);
+    assert_int_equal(broadphase.axis, 2);
+    check_broadphase_pairs(&broadphase);
+
+    broadphase_destroy(&broadphase);
+}
+
+void test_integrate(void **state) {
+    unused(state);
+
+    IntegrateBatch batch;
+    uint32_t seed = 7;
+
+    float *fields = &batch.position[0][0];
+    size_t num_fields = sizeof(batch) / sizeof(float);
+
+    for (size_t i = 0; i < num_fields; i++) {
+        seed = seed * 1664525 + 1013904223;
+        fields[i] = (float)(seed >> 8) / (1 << 24) * 20.0f - 10.0f;
+    }
+
+    // no damping, full damping and damping that overshoots
+    batch.damping[0] = 0.0f;
+    batch.damping[1] = 60.0f;
+    batch.damping[2] = 1000.0f;
+    for (size_t lane = 3; lane < INTEGRATE_LANES; lane++) {
+        batch.damping[lane] = (float)lane * 0.25f;
+    }
+
+    IntegrateBatch expected = batch;
+
+    for (size_t step = 0; step < 16; step++) {
+        integrate_batch(&batch, 1.0f / 60.0f);
+        integrate_batch_scalar(&expected, INTEGRATE_LANES, 1.0f / 60.0f);
+    }
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        for (size_t lane = 0; lane < INTEGRATE_LANES; lane++) {
+            assert_float_equal(batch.position[axis][lane],
+                    expected.position[axis][lane],
+                    1e-4f);
+            assert_float_equal(batch.velocity[axis][lane],
+                    expected.velocity[axis][lane],
+                    1e-4f);
+        }
+
+        assert_float_equal(batch.velocity[axis][1], 0.0f, 0.0f);
+        assert_float_equal(batch.velocity[axis][2], 0.0f, 0.0f);
+    }
+
+    // without damping the velocity picks up all of the acceleration
+    IntegrateBatch single = {0};
+    single.acceleration[1][0] = -9.8f;
+
+    integrate_batch_scalar(&single, 1, 0.5f);
+    assert_float_equal(single.velocity[1][0], -4.9f, 1e-6f);
+    assert_float_equal(single.position[1][0], -2.45f, 1e-6f);
+}
+
+typedef struct IslandVisits {
+    _Atomic uint32_t counts[16];
+} IslandVisits;
+
+static void record_island_visit(ContactIslands const *islands,
+        uint32_t island,
+        size_t worker_index,
+        void *ctx) {
+    unused(islands);
+    unused(worker_index);
+
+    IslandVisits *visits = ctx;
+    atomic_fetch_add(&visits->counts[island], 1);
+}
+
+void test_contact_islands(void **state) {
+    unused(state);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    ContactIslands islands;
+    contact_islands_init(&islands);
+
+    // 0-1-2 and 3-4 are chained, 5 is fixed and touches both chains
+    // without joining them, 6 and 7 are fixed as well
+    bool fixed[8] = {[5] = true, [6] = true, [7] = true};
+    BroadphasePair pairs[] = {
+            {3, 4},
+            {1, 2},
+            {0, 5},
+            {6, 7},
+            {0, 1},
+            {4, 5},
+    };
+
+    contact_islands_build(&islands, 8, fixed, pairs, 6);
+    assert_int_equal(contact_islands_count(&islands), 2);
+
+    // numbered by their first pair, the pair of fixed bodies is left out
+    uint32_t const expected_pairs[] = {0, 5, 1, 2, 4};
+    uint32_t const expected_offsets[] = {0, 2, 5};
+
+    assert_memory_equal(islands.island_pairs,
+            expected_pairs,
+            sizeof(expected_pairs));
+    assert_memory_equal(islands.island_offsets,
+            expected_offsets,
+            sizeof(expected_offsets));
+
+    IslandVisits visits = {0};
+    contact_islands_run(&islands, &pool, record_island_visit, &visits);
+
+    assert_int_equal(visits.counts[0], 1);
+    assert_int_equal(visits.counts[1], 1);
+
+    // rebuilding reuses the storage and merges the chains
+    BroadphasePair merged[] = {{0, 1}, {1, 2}, {2, 3}, {3, 4}};
+
+    contact_islands_build(&islands, 8, fixed, merged, 4);
+    assert_int_equal(contact_islands_count(&islands), 1);
+    assert_int_equal(islands.island_offsets[1], 4);
+
+    contact_islands_build(&islands, 8, fixed, NULL, 0);
+    assert_int_equal(contact_islands_count(&islands), 0);
+    contact_islands_run(&islands, &pool, record_island_visit, &visits);
+
+    contact_islands_destroy(&islands);
+    thread_pool_destroy(&pool);
+}
+
+typedef struct ExclusiveSolve {
+    ContactIslands *islands;
+    ThreadPool *pool;
+    _Atomic uint32_t workers;
+    _Atomic size_t *clock;
+    size_t order;
+} ExclusiveSolve;
+
+/// holds on to the island until a second worker picked up another one,
+/// so that the result doesn't depend on how fast the workers wake up
+static void record_island_worker(ContactIslands const *islands,
+        uint32_t island,
+        size_t worker_index,
+        void *ctx) {
+    unused(islands);
+    unused(island);
+
+    ExclusiveSolve *solve = ctx;
+    atomic_fetch_or(&solve->workers, 1u << worker_index);
+
+    Time start = get_time();
+
+    while (__builtin_popcount(atomic_load(&solve->workers)) < 2
+            && time_since_s(start) < 1.0f) {
+        sched_yield();
+    }
+}
+
+static void exclusive_solve_system(
+        SystemContext const *system_context, void *ctx) {
+    unused(system_context);
+
+    ExclusiveSolve *solve = ctx;
+    solve->order = atomic_fetch_add(solve->clock, 1);
+
+    contact_islands_run(
+            solve->islands, solve->pool, record_island_worker, solve);
+}
+
+void test_scheduler_exclusive(void **state) {
+    unused(state);
+
+    World ecs;
+    ecs_init(&ecs);
+
+    REGISTER_COMPONENT(&ecs, Position);
+    REGISTER_COMPONENT(&ecs, Velocity);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    // four chains, each large enough to be a task of its own
+    size_t const num_chains = 4;
+    size_t const chain_length = ISLAND_GRAIN_SIZE + 1;
+    size_t const num_bodies = num_chains * chain_length;
+
+    vector(BroadphasePair) pairs;
+    vector_init(pairs);
+
+    for (size_t chain = 0; chain < num_chains; chain++) {
+        for (size_t i = 0; i + 1 < chain_length; i++) {
+            uint32_t body = chain * chain_length + i;
+            BroadphasePair pair = {body, body + 1};
+            vector_append(pairs, pair);
+        }
+    }
+
+    bool *fixed = calloc(num_bodies, sizeof(bool));
+
+    ContactIslands islands;
+    contact_islands_init(&islands);
+    contact_islands_build(
+            &islands, num_bodies, fixed, pairs, vector_size(pairs));
+    assert_int_equal(contact_islands_count(&islands), num_chains);
+
+    Scheduler scheduler;
+    scheduler_init(&scheduler, &ecs, &pool);
+
+    _Atomic size_t clock = 0;
+    TestSystem systems[2];
+    for (size_t i = 0; i < 2; i++) {
+        init_test_system(&systems[i],
+                &clock,
+                COMPONENT_ID(Position),
+                COMPONENT_ID(Velocity));
+    }
+
+    ExclusiveSolve solve = {
+            .islands = &islands,
+            .pool = &pool,
+            .clock = &clock,
+    };
+
+    // none of them conflict, the exclusive one still runs in between
+    scheduler_add_system(
+            &scheduler, "integrate", integrate_system, &systems[0]);
+    Index exclusive = scheduler_add_system(
+            &scheduler, "solve", exclusive_solve_system, &solve);
+    scheduler_system_exclusive(&scheduler, exclusive);
+    scheduler_add_system(&scheduler, "damp", damp_system, &systems[1]);
+
+    scheduler_run(&scheduler, 1.0f / 60.0f);
+
+    assert_true(systems[0].order < solve.order);
+    assert_true(solve.order < systems[1].order);
+
+    // the islands were spread across the pool instead of running
+    // serially on the worker of the system
+    assert_true(__builtin_popcount(atomic_load(&solve.workers)) >= 2);
+
+    scheduler_destroy(&scheduler);
+    contact_islands_destroy(&islands);
+    free(fixed);
+    vector_destroy(pairs);
+    thread_pool_destroy(&pool);
+
+    for (size_t i = 0; i < 2; i++) {
+        query_destroy(&systems[i].query);
+    }
+
+    ecs_destroy(&ecs);
+}
+
+void test_fixed_step(void **state) {
+    unused(state);
+
+    FixedStep fixed_step;
+    fixed_step_init(&fixed_step, 0.25f, 4);
+
+    // short frames add up to a tick
+    assert_int_equal(fixed_step_advance(&fixed_step, 0.125f), 0);
+    assert_float_equal(fixed_step_alpha(&fixed_step), 0.5f, 1e-6f);
+    assert_int_equal(fixed_step_advance(&fixed_step, 0.125f), 1);
+    assert_float_equal(fixed_step_alpha(&fixed_step), 0.0f, 1e-6f);
+
+    // the remainder carries over
+    assert_int_equal(fixed_step_advance(&fixed_step, 0.625f), 2);
+    assert_float_equal(fixed_step_alpha(&fixed_step), 0.5f, 1e-6f);
+
+    // a long frame is clamped and the time past it dropped
+    assert_int_equal(fixed_step_advance(&fixed_step, 10.0f), 4);
+    assert_float_equal(fixed_step_alpha(&fixed_step), 1.0f, 1e-6f);
+    assert_int_equal(fixed_step_advance(&fixed_step, 0.0f), 1);
+    assert_int_equal(fixed_step_advance(&fixed_step, 0.0f), 0);
+
+    // frames shorter than a tick run none and the blend keeps going.
+    // engine_run still propagates transforms written by their handlers.
+    fixed_step_init(&fixed_step, 0.25f, 4);
+    assert_int_equal(fixed_step_advance(&fixed_step, 0.0625f), 0);
+    assert_float_equal(fixed_step_alpha(&fixed_step), 0.25f, 1e-6f);
+    assert_int_equal(fixed_step_advance(&fixed_step, 0.0625f), 0);
+    assert_float_equal(fixed_step_alpha(&fixed_step), 0.5f, 1e-6f);
+
+    // ticks line up with elapsed time over many uneven frames
+    fixed_step_init(&fixed_step, 1.0f / 30.0f, FIXED_STEP_MAX_SUBSTEPS);
+    size_t num_ticks = 0;
+
+    for (size_t frame = 0; frame < 600; frame++) {
+        float frame_time = frame % 3 == 0 ? 1.0f / 50.0f : 1.0f / 100.0f;
+        num_ticks += fixed_step_advance(&fixed_step, frame_time);
+    }
+
+    // 8 seconds
+    assert_true(num_ticks >= 239 && num_ticks <= 240);
+}
+
 int main(void) {
     const struct CMUnitTest general_tests[] = {
             cmocka_unit_test(test_ring_buffer),
@@ -350,7 +2634,33 @@ int main(void) {
             cmocka_unit_test(test_base64_encode),
             cmocka_unit_test(test_base64_decode),
             cmocka_unit_test(test_base64_invalid_input),
+            cmocka_unit_test(test_component_mask),
             cmocka_unit_test(test_ecs),
+            cmocka_unit_test(test_ecs_archetype_lookup),
+            cmocka_unit_test(test_ecs_query),
+            cmocka_unit_test(test_ecs_spans),
+            cmocka_unit_test(test_ecs_par_for),
+            cmocka_unit_test(test_ecs_spawn_batch),
+            cmocka_unit_test(test_ecs_paged_columns),
+            cmocka_unit_test(test_ecs_remove_entity),
+            cmocka_unit_test(test_ecs_add_remove_component),
+            cmocka_unit_test(test_ecs_stale_handles),
+            cmocka_unit_test(test_ecs_sparse_components),
+            cmocka_unit_test(test_ecs_query_terms),
+            cmocka_unit_test(test_ecs_shared_components),
+            cmocka_unit_test(test_ecs_blobs),
+            cmocka_unit_test(test_ecs_change_ticks),
+            cmocka_unit_test(test_ecs_command_buffer),
+            cmocka_unit_test(test_scheduler),
+            cmocka_unit_test(test_ecs_save_load),
+            cmocka_unit_test(test_ecs_load_duplicate_archetypes),
+            cmocka_unit_test(test_ecs_load_mismatched_rows),
+            cmocka_unit_test(test_hierarchy),
+            cmocka_unit_test(test_broadphase),
+            cmocka_unit_test(test_integrate),
+            cmocka_unit_test(test_contact_islands),
+            cmocka_unit_test(test_scheduler_exclusive),
+            cmocka_unit_test(test_fixed_step),
     };
 
     return cmocka_run_group_tests(general_tests, NULL, NULL);
@@ -0,0 +1,180 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "internal/utils.h"
+#include "sunset/errors.h"
+#include "sunset/vector.h"
+
+#include "sunset/thread_pool.h"
+
+static _Thread_local ThreadPool *current_pool = NULL;
+static _Thread_local size_t current_worker = 0;
+
+static void pool_work(ThreadPool *pool, size_t worker_index) {
+    while (true) {
+        size_t task = atomic_fetch_add(&pool->next_task, 1);
+
+        if (task >= pool->num_tasks) {
+            return;
+        }
+
+        pool->fn(pool->ctx, task, worker_index);
+
+        atomic_fetch_add(&pool->tasks_done, 1);
+    }
+}
+
+static void *worker_main(void *arg) {
+    ThreadPoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+
+    current_pool = pool;
+    current_worker = worker->index;
+
+    uint64_t seen_generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (!pool->stopping && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+
+        if (pool->stopping) {
+            break;
+        }
+
+        seen_generation = pool->generation;
+        pool->active_workers++;
+
+        pthread_mutex_unlock(&pool->lock);
+        pool_work(pool, worker->index);
+        pthread_mutex_lock(&pool->lock);
+
+        // the batch can only be retired once no worker is reading it
+        if (--pool->active_workers == 0) {
+            pthread_cond_broadcast(&pool->work_done);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int thread_pool_init(ThreadPool *pool, size_t num_threads) {
+    pool->fn = NULL;
+    pool->ctx = NULL;
+    pool->num_tasks = 0;
+    atomic_init(&pool->next_task, 0);
+    atomic_init(&pool->tasks_done, 0);
+    pool->active_workers = 0;
+    pool->generation = 0;
+    pool->stopping = false;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    vector_init(pool->workers);
+    // sized once up front, workers keep a pointer to their slot
+    vector_resize(pool->workers, num_threads);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        ThreadPoolWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i + 1;
+
+        if (pthread_create(&worker->thread, NULL, worker_main, worker)) {
+            vector_resize(pool->workers, i);
+            thread_pool_destroy(pool);
+            return -ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    return 0;
+}
+
+void thread_pool_destroy(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < vector_size(pool->workers); i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    vector_destroy(pool->workers);
+
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+size_t thread_pool_num_workers(ThreadPool const *pool) {
+    return vector_size(pool->workers) + 1;
+}
+
+void thread_pool_run(
+        ThreadPool *pool, size_t num_tasks, TaskFn fn, void *ctx) {
+    if (num_tasks == 0) {
+        return;
+    }
+
+    bool nested = current_pool == pool;
+
+    if (nested || num_tasks == 1 || vector_empty(pool->workers)) {
+        for (size_t i = 0; i < num_tasks; i++) {
+            fn(ctx, i, current_worker);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    // a worker that woke up late for the previous batch may still be
+    // looking at it
+    while (pool->active_workers > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->num_tasks = num_tasks;
+    atomic_store(&pool->next_task, 0);
+    atomic_store(&pool->tasks_done, 0);
+    pool->generation++;
+
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    current_pool = pool;
+    current_worker = 0;
+
+    pool_work(pool, 0);
+
+    current_pool = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (atomic_load(&pool->tasks_done) < num_tasks
+            || pool->active_workers > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+
+    pool->fn = NULL;
+    pool->ctx = NULL;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t thread_pool_default_num_threads(void) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return num_cpus > 1 ? (size_t)num_cpus - 1 : 0;
+}
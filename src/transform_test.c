@@ -0,0 +1,143 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <cmocka.h>
+// clang-format on
+
+#include "internal/mem_utils.h"
+#include "internal/utils.h"
+#include "sunset/ecs.h"
+#include "sunset/engine.h"
+#include "sunset/render.h"
+#include "sunset/thread_pool.h"
+
+static Entity spawn_transform(World *world, Entity parent, float x) {
+    Transform transform = {
+            .bounding_box = {.min = {x, 0, 0}, .max = {x + 1, 1, 1}},
+            .position = {x, 0, 0},
+            .scale = 1.0f,
+            .parent = ecs_entity_ptr(world, parent),
+            .children = BLOB_REF_NONE,
+    };
+
+    EntityBuilder builder;
+    entity_builder_init(&builder, world);
+    entity_builder_add_transform(&builder, &transform);
+
+    return entity_builder_finish(&builder);
+}
+
+static float world_x(World *world, Entity entity) {
+    WorldTransform const *world_transform = ecs_get_component(
+            world, entity, COMPONENT_ID(WorldTransform));
+
+    return world_transform->model[3][0];
+}
+
+void test_transform_reused_parent(void **state) {
+    unused(state);
+
+    EngineContext *context = sunset_calloc(1, sizeof(EngineContext));
+    World *world = &context->world;
+    ecs_init(world);
+    render_setup(context);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    Entity parent = spawn_transform(world, ENTITY_INVALID, 10.0f);
+    Entity child = spawn_transform(world, parent, 1.0f);
+
+    transform_propagate(world, &pool);
+    assert_float_equal(world_x(world, child), 11.0f, 1e-6f);
+
+    // the parent's slot changes hands between two propagations
+    ecs_remove_entity(world, parent);
+    Entity other = spawn_transform(world, ENTITY_INVALID, 100.0f);
+    assert_int_equal(entity_index(other), entity_index(parent));
+
+    transform_propagate(world, &pool);
+
+    // the orphan is a root now rather than a child of the new entity
+    assert_float_equal(world_x(world, other), 100.0f, 1e-6f);
+    assert_float_equal(world_x(world, child), 1.0f, 1e-6f);
+
+    thread_pool_destroy(&pool);
+    render_destroy();
+    ecs_destroy(world);
+    free(context);
+}
+
+static void move_to(World *world, Entity entity, float x) {
+    Position *position =
+            ecs_get_component(world, entity, COMPONENT_ID(Position));
+    position->value[0] = x;
+    ecs_mark_changed(
+            world, ecs_entity_ptr(world, entity), COMPONENT_ID(Position));
+}
+
+void test_transform_between_ticks(void **state) {
+    unused(state);
+
+    EngineContext *context = sunset_calloc(1, sizeof(EngineContext));
+    World *world = &context->world;
+    ecs_init(world);
+    render_setup(context);
+
+    ThreadPool pool;
+    assert_int_equal(thread_pool_init(&pool, 3), 0);
+
+    Entity ticked = spawn_transform(world, ENTITY_INVALID, 0.0f);
+    Entity idle = spawn_transform(world, ENTITY_INVALID, 0.0f);
+    transform_propagate(world, &pool);
+
+    move_to(world, ticked, 1.0f);
+    transform_propagate(world, &pool);
+
+    WorldTransform const *ticked_transform = ecs_get_component(
+            world, ticked, COMPONENT_ID(WorldTransform));
+    WorldTransform const *idle_transform =
+            ecs_get_component(world, idle, COMPONENT_ID(WorldTransform));
+    uint32_t generation = ticked_transform->generation;
+
+    assert_float_equal(ticked_transform->previous[3][0], 0.0f, 1e-6f);
+    assert_float_equal(ticked_transform->model[3][0], 1.0f, 1e-6f);
+    assert_int_not_equal(idle_transform->generation, generation);
+
+    // a frame without a tick, where a handler moves both entities
+    move_to(world, ticked, 3.0f);
+    move_to(world, idle, 5.0f);
+    transform_propagate_frame(world, &pool);
+
+    Bounds const *bounds =
+            ecs_get_component(world, ticked, COMPONENT_ID(Bounds));
+
+    // the tick's blend goes on towards the new position
+    assert_float_equal(ticked_transform->previous[3][0], 0.0f, 1e-6f);
+    assert_float_equal(ticked_transform->model[3][0], 3.0f, 1e-6f);
+    assert_int_equal(ticked_transform->generation, generation);
+    assert_float_equal(bounds->box.min[0], 3.0f, 1e-6f);
+
+    // and what the tick didn't move is drawn where it is
+    assert_float_equal(world_x(world, idle), 5.0f, 1e-6f);
+    assert_int_not_equal(idle_transform->generation, generation);
+
+    thread_pool_destroy(&pool);
+    render_destroy();
+    ecs_destroy(world);
+    free(context);
+}
+
+int main(void) {
+    const struct CMUnitTest transform_tests[] = {
+            cmocka_unit_test(test_transform_reused_parent),
+            cmocka_unit_test(test_transform_between_ticks),
+    };
+
+    return cmocka_run_group_tests(transform_tests, NULL, NULL);
+}
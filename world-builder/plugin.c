@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <string.h>
 
 #include <cglm/affine.h>
 #include <cglm/mat4.h>
@@ -28,11 +29,21 @@ typedef struct Clickable {
     void (*clicked_callback)(EngineContext *, EntityPtr clicked_entity);
     void (*dragged_callback)(
             EngineContext *, EntityPtr clicked_entity, Point offset);
-    uint64_t click_id;
 } Clickable;
 
 DECLARE_COMPONENT_ID(Clickable);
 
+/// sparse, set on the clickables under the crosshair at the latest click
+/// and dropped from the others
+typedef struct Selected {
+    uint64_t click_id;
+} Selected;
+
+DECLARE_COMPONENT_ID(Selected);
+
+DECLARE_RESOURCE_ID(selected_query);
+DECLARE_RESOURCE_ID(clickable_transform_query);
+
 static void object_drag_handler(EngineContext *engine_context,
         void * /*local_context*/,
         Event const event) {
@@ -49,19 +60,20 @@ static void object_drag_handler(EngineContext *engine_context,
         return;
     }
 
-    Bitmask bitmask;
-    bitmask_init_empty(ECS_MAX_COMPONENTS, &bitmask);
-    bitmask_set(&bitmask, COMPONENT_ID(Clickable));
+    Query *query =
+            rman_get(&engine_context->rman, RESOURCE_ID(selected_query));
 
-    WorldIterator it = worldit_create(&engine_context->world, bitmask);
+    WorldIterator it = worldit_from_query(&engine_context->world, query);
     while (worldit_is_valid(&it)) {
         EntityPtr eptr = worldit_get_entityptr(&it);
 
         Clickable *clickable = ecs_component_from_ptr(
                 &engine_context->world, eptr, COMPONENT_ID(Clickable));
+        Selected *selected = ecs_component_from_ptr(
+                &engine_context->world, eptr, COMPONENT_ID(Selected));
 
         if (clickable->dragged_callback
-                && clickable->click_id + 1
+                && selected->click_id + 1
                         == backend_get_click_id(
                                 &engine_context->render_context)) {
             clickable->dragged_callback(
@@ -70,8 +82,6 @@ static void object_drag_handler(EngineContext *engine_context,
 
         worldit_advance(&it);
     }
-
-    worldit_destroy(&it);
 }
 
 static void object_click_handler(EngineContext *engine_context,
@@ -90,33 +100,39 @@ static void object_click_handler(EngineContext *engine_context,
         return;
     }
 
-    Bitmask bitmask;
-    bitmask_init_empty(ECS_MAX_COMPONENTS, &bitmask);
-    bitmask_set(&bitmask, COMPONENT_ID(Clickable));
-    bitmask_set(&bitmask, COMPONENT_ID(Transform));
+    Query *query = rman_get(
+            &engine_context->rman, RESOURCE_ID(clickable_transform_query));
 
-    WorldIterator it = worldit_create(&engine_context->world, bitmask);
+    WorldIterator it = worldit_from_query(&engine_context->world, query);
     while (worldit_is_valid(&it)) {
         EntityPtr eptr = worldit_get_entityptr(&it);
+        Entity entity = worldit_get_entity(&it);
 
-        Transform *transform = ecs_component_from_ptr(
-                &engine_context->world, eptr, COMPONENT_ID(Transform));
+        Bounds *bounds = ecs_component_from_ptr(
+                &engine_context->world, eptr, COMPONENT_ID(Bounds));
         Clickable *clickable = ecs_component_from_ptr(
                 &engine_context->world, eptr, COMPONENT_ID(Clickable));
 
+        // sparse, so (de)selecting doesn't move the row being iterated
         if (camera_crosshair_over(
-                    &engine_context->camera, &transform->bounding_box)) {
-            clickable->click_id = mouse_click->click_id;
+                    &engine_context->camera, &bounds->box)) {
+            Selected selected = {.click_id = mouse_click->click_id};
+            ecs_add_component(&engine_context->world,
+                    entity,
+                    COMPONENT_ID(Selected),
+                    &selected);
 
             if (clickable->clicked_callback) {
                 clickable->clicked_callback(engine_context, eptr);
             }
+        } else {
+            ecs_remove_component(&engine_context->world,
+                    entity,
+                    COMPONENT_ID(Selected));
         }
 
         worldit_advance(&it);
     }
-
-    worldit_destroy(&it);
 }
 
 static void player_controller_handler_mouse(
@@ -179,7 +195,7 @@ DECLARE_RESOURCE_ID(axis_arrow_texture2);
 DECLARE_RESOURCE_ID(axis_arrow_texture3);
 
 typedef struct AxisArrow {
-    EntityPtr parent;
+    Entity parent;
     vec3 axis;
 } AxisArrow;
 
@@ -209,15 +225,25 @@ static void axis_arrow_dragged(
     vec3 offset_vec;
     glm_vec3_scale(axis_arrow->axis, off, offset_vec);
 
-    entity_move(&engine_context->world, axis_arrow->parent, offset_vec);
+    EntityPtr parent =
+            ecs_entity_ptr(&engine_context->world, axis_arrow->parent);
+
+    if (eptr_eql(parent, ENTITY_PTR_INVALID)) {
+        return;
+    }
+
+    entity_move(&engine_context->world, parent, offset_vec);
 }
 
 DECLARE_RESOURCE_ID(axis_arrow_aabb);
 
-static EntityPtr spawn_axis_arrow(EngineContext *engine_context,
-        EntityPtr parent,
+static Entity spawn_axis_arrow(EngineContext *engine_context,
+        Entity parent,
         vec3 axis, // should be const
         uint32_t texture) {
+    World *world = &engine_context->world;
+    EntityPtr parent_eptr = ecs_entity_ptr(world, parent);
+
     Renderable rend;
     vector_init(rend.commands);
 
@@ -230,11 +256,11 @@ static EntityPtr spawn_axis_arrow(EngineContext *engine_context,
             .mesh = {.mesh_id = *mesh_id, .texture_id = texture}};
 
     Transform new_transform = {
-            .parent = parent, .bounding_box = *arrow_aabb, .dirty = true};
+            .parent = parent_eptr, .bounding_box = *arrow_aabb};
 
     glm_vec3_scale(axis, 0.1, new_transform.position);
     vec3 abspos;
-    entity_get_abspos(&engine_context->world, parent, abspos);
+    entity_get_abspos(world, parent_eptr, abspos);
 
     aabb_translate(&new_transform.bounding_box, abspos);
     aabb_translate(&new_transform.bounding_box, new_transform.position);
@@ -262,44 +288,37 @@ static EntityPtr spawn_axis_arrow(EngineContext *engine_context,
     Clickable clickable = {.dragged_callback = axis_arrow_dragged};
 
     EntityBuilder builder;
-    entity_builder_init(&builder, &engine_context->world);
-    entity_builder_add(&builder, COMPONENT_ID(Transform), &new_transform);
+    entity_builder_init(&builder, world);
+    entity_builder_add_transform(&builder, &new_transform);
     entity_builder_add(&builder, COMPONENT_ID(Renderable), &rend);
     entity_builder_add(&builder, COMPONENT_ID(AxisArrow), &arrow);
     entity_builder_add(&builder, COMPONENT_ID(Clickable), &clickable);
 
-    return engine_context->world
-            .entity_ptrs[entity_builder_finish(&builder)];
+    return entity_builder_finish(&builder);
 }
 
-static Order order_entityptr(void const *a, void const *b) {
-    EntityPtr *eptr_a = (EntityPtr *)a;
-    EntityPtr *eptr_b = (EntityPtr *)b;
+static Order order_entity(void const *a, void const *b) {
+    Entity const *entity_a = a;
+    Entity const *entity_b = b;
 
-    if (eptr_a->archetype < eptr_b->archetype) {
+    if (*entity_a < *entity_b) {
         return ORDER_LESS_THAN;
     }
 
-    if (eptr_a->archetype > eptr_b->archetype) {
-        return ORDER_GREATER_THAN;
-    }
-
-    if (eptr_a->element < eptr_b->element) {
-        return ORDER_LESS_THAN;
-    }
-
-    if (eptr_a->element > eptr_b->element) {
+    if (*entity_a > *entity_b) {
         return ORDER_GREATER_THAN;
     }
 
     return ORDER_EQUAL;
 }
 
-void spawn_axis_arrows(EngineContext *engine_context, EntityPtr target) {
-    map(EntityPtr) *spawned_arrows =
+void spawn_axis_arrows(EngineContext *engine_context, EntityPtr eptr) {
+    World *world = &engine_context->world;
+    Entity target = ecs_ptr_entity(world, eptr);
+    map(Entity) *spawned_arrows =
             rman_get(&engine_context->rman, RESOURCE_ID(spawned_arrows));
 
-    if (map_get(*spawned_arrows, target, order_entityptr)) {
+    if (map_get(*spawned_arrows, target, order_entity)) {
         return;
     }
 
@@ -310,28 +329,39 @@ void spawn_axis_arrows(EngineContext *engine_context, EntityPtr target) {
     uint32_t *texture3 = rman_get(
             &engine_context->rman, RESOURCE_ID(axis_arrow_texture3));
 
-    EntityPtr x = spawn_axis_arrow(
+    Entity x = spawn_axis_arrow(
             engine_context, target, (vec3){1, 0, 0}, *texture2);
-    EntityPtr y = spawn_axis_arrow(
+    Entity y = spawn_axis_arrow(
             engine_context, target, (vec3){0, 1, 0}, *texture1);
-    EntityPtr z = spawn_axis_arrow(
+    Entity z = spawn_axis_arrow(
             engine_context, target, (vec3){0, 0, -1}, *texture3);
 
-    Transform *target_t = ecs_component_from_ptr(
-            &engine_context->world, target, COMPONENT_ID(Transform));
+    TransformLinks *links = ecs_component_from_ptr(
+            world, eptr, COMPONENT_ID(TransformLinks));
+
+    if (links->children == BLOB_REF_NONE) {
+        links->children = ecs_blob_alloc(world, eptr, 0);
+    }
+
+    Entity arrows[] = {x, y, z};
+    BlobArena *blobs = &world->blobs;
+    size_t num_children =
+            blob_arena_size(blobs, links->children) / sizeof(Entity);
 
-    vector_append(target_t->children, x);
-    vector_append(target_t->children, y);
-    vector_append(target_t->children, z);
+    blob_arena_resize(blobs,
+            links->children,
+            (num_children + 3) * sizeof(Entity));
+    Entity *children = blob_arena_get(blobs, links->children);
+    memcpy(children + num_children, arrows, sizeof(arrows));
 
-    map_insert(*spawned_arrows, target, order_entityptr);
+    map_insert(*spawned_arrows, target, order_entity);
 }
 
 static void subject_click(EngineContext *engine_context, EntityPtr eptr) {
-    Transform const *target_t = ecs_component_from_ptr(
-            &engine_context->world, eptr, COMPONENT_ID(Transform));
+    TransformLinks const *links = ecs_component_from_ptr(
+            &engine_context->world, eptr, COMPONENT_ID(TransformLinks));
 
-    if (!target_t) {
+    if (!links) {
         return;
     }
 
@@ -424,10 +454,9 @@ void test_stuff(EngineContext *engine_context) {
                     },
             .position = {0.0, 0.0, -1.0},
             .scale = 1.0,
-            .dirty = true,
             .rotation = {},
+            .children = BLOB_REF_NONE,
     };
-    vector_init(transform.children);
 
     aabb_translate(&transform.bounding_box, transform.position);
 
@@ -443,7 +472,7 @@ void test_stuff(EngineContext *engine_context) {
     EntityBuilder builder;
     entity_builder_init(&builder, &engine_context->world);
     entity_builder_add(&builder, COMPONENT_ID(Renderable), &rend);
-    entity_builder_add(&builder, COMPONENT_ID(Transform), &transform);
+    entity_builder_add_transform(&builder, &transform);
     entity_builder_add(&builder, COMPONENT_ID(Clickable), &clickable);
     entity_builder_finish(&builder);
 
@@ -471,8 +500,31 @@ void test_stuff(EngineContext *engine_context) {
             &engine_context->rman, axis_arrow_aabb, models[0].bounding_box);
 }
 
+static void register_queries(EngineContext *engine_context) {
+    Query selected;
+    ComponentMask selected_mask = cmask_empty();
+    cmask_set(&selected_mask, COMPONENT_ID(Clickable));
+    cmask_set(&selected_mask, COMPONENT_ID(Selected));
+    query_init(&selected, selected_mask);
+
+    REGISTER_RESOURCE(&engine_context->rman, selected_query, selected);
+
+    Query clickable_transforms;
+    ComponentMask clickable_transforms_mask = cmask_empty();
+    cmask_set(&clickable_transforms_mask, COMPONENT_ID(Clickable));
+    cmask_set(&clickable_transforms_mask, COMPONENT_ID(Bounds));
+    query_init(&clickable_transforms, clickable_transforms_mask);
+
+    REGISTER_RESOURCE(&engine_context->rman,
+            clickable_transform_query,
+            clickable_transforms);
+}
+
 int plugin_load(EngineContext *engine_context) {
     REGISTER_COMPONENT(&engine_context->world, Clickable);
+    REGISTER_SPARSE_COMPONENT(&engine_context->world, Selected);
+
+    register_queries(engine_context);
 
     event_queue_add_handler(&engine_context->event_queue,
             SYSTEM_EVENT_KEY_DOWN,
@@ -495,7 +547,7 @@ int plugin_load(EngineContext *engine_context) {
     test_stuff(engine_context);
     // crosshair(engine_context);
 
-    map(EntityPtr) arrows_created;
+    map(Entity) arrows_created;
     map_init(arrows_created);
 
     REGISTER_RESOURCE(
@@ -503,3 +555,15 @@ int plugin_load(EngineContext *engine_context) {
 
     return 0;
 }
+
+int plugin_unload(EngineContext *engine_context) {
+    Query *selected =
+            rman_get(&engine_context->rman, RESOURCE_ID(selected_query));
+    Query *clickable_transforms = rman_get(
+            &engine_context->rman, RESOURCE_ID(clickable_transform_query));
+
+    query_destroy(selected);
+    query_destroy(clickable_transforms);
+
+    return 0;
+}